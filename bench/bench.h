@@ -0,0 +1,42 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <string>
+#include <thread>
+#include <atomic>
+
+#include "measure.h"
+#include "../server/Server.h"
+
+// a chat server running on its own thread in this process
+class LocalServer{
+public:
+	LocalServer(unsigned short port, const std::string &dbpath)
+		: server(port, dbpath, 128)
+		, running(true)
+		, thread([this]{
+			while(running.load())
+				server.accept();
+		})
+	{}
+
+	~LocalServer(){
+		running.store(false);
+		thread.join();
+	}
+
+	Server server;
+
+private:
+	std::atomic<bool> running;
+	std::thread thread;
+};
+
+// workloads
+int bench_introduce(const Options&);
+int bench_search(const Options&);
+int bench_engines(const Options&);
+int bench_reconnect(const Options&);
+int bench_load(const Options&);
+
+#endif // BENCH_H
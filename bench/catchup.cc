@@ -0,0 +1,86 @@
+#include <iostream>
+#include <vector>
+#include <random>
+#include <exception>
+#include <cstdio>
+
+#include "measure.h"
+#include "../chat.h"
+#include "../client/Database.h"
+
+// how long the client library takes to store the backlog that comes with subscribing to a chat it's been away from
+// a separate program from chat-bench, the client's Database can't share a binary with the server's
+
+static void usage(){
+	std::cout << "usage: chat-bench-catchup [--option value ...]" << std::endl;
+	std::cout << "  --messages N (10000) --page N (500) --db PATH (chat-bench-catchup.db)" << std::endl;
+}
+
+static std::vector<Message> backlog(int messages){
+	std::mt19937 rng(1234);
+	std::uniform_int_distribution<int> length(10, 200);
+	std::uniform_int_distribution<int> letter('a', 'z');
+
+	std::vector<Message> msgs;
+	msgs.reserve(messages);
+	for(int i = 0; i < messages; ++i){
+		std::string text(length(rng), ' ');
+		for(char &c : text)
+			c = letter(rng);
+
+		msgs.emplace_back(i + 1, MessageType::TEXT, 1500000000 + i, text, "user" + std::to_string(rng() % 500), (unsigned char*)NULL, 0);
+	}
+
+	return msgs;
+}
+
+// stores <msgs> in a brand new database at <path>, <page> at a time (0 for one insert each, the old way)
+static void catchup(const std::string &path, const std::vector<Message> &msgs, int page, const std::string &label){
+	std::remove(path.c_str());
+
+	Database db(path);
+
+	const Stopwatch elapsed;
+	if(page == 0){
+		for(const Message &msg : msgs)
+			db.newmsg("bench", msg, "catchup");
+	}
+	else{
+		for(size_t i = 0; i < msgs.size(); i += page){
+			const auto end = msgs.begin() + std::min(msgs.size(), i + page);
+			db.newmsgs("bench", std::vector<Message>(msgs.begin() + i, end), "catchup");
+		}
+	}
+	const double seconds = elapsed.seconds();
+
+	char line[200];
+	snprintf(line, sizeof(line), "  %-14s %6zu messages in %8.3fs, %9.0f/s", label.c_str(), msgs.size(), seconds, msgs.size() / seconds);
+	std::cout << line << std::endl;
+}
+
+int main(int argc, char **argv){
+	const Options options(argc - 1, argv + 1);
+	if(argc % 2 == 0){
+		usage();
+		return 1;
+	}
+
+	try{
+		const int messages = options.integer("messages", 10000);
+		const int page = options.integer("page", 500); // MAX_RANGE_MESSAGES
+		const std::string path = options.str("db", "chat-bench-catchup.db");
+
+		const std::vector<Message> msgs = backlog(messages);
+
+		std::cout << "storing a backlog of " << messages << " messages" << std::endl;
+		catchup(path, msgs, 0, "one at a time");
+		catchup(path, msgs, page, "pages of " + std::to_string(page));
+
+		std::remove(path.c_str());
+	}catch(const std::exception &e){
+		std::cerr << "\033[31;1mfatal error:\033[0m " << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,99 @@
+#include <iostream>
+#include <vector>
+#include <random>
+#include <filesystem>
+#include <cstdio>
+
+#include "bench.h"
+
+// <messages> messages through Database::new_msg, every <image_every>th one an image with a thumbnail
+static void fill(Database &db, const Chat &chat, int messages, int image_every, std::mt19937 &rng){
+	std::uniform_int_distribution<int> length(10, 200);
+	std::uniform_int_distribution<int> letter('a', 'z');
+
+	std::vector<unsigned char> thumbnail(2048);
+	for(unsigned char &c : thumbnail)
+		c = rng();
+
+	const Stopwatch elapsed;
+	for(int i = 0; i < messages; ++i){
+		std::string text(length(rng), ' ');
+		for(char &c : text)
+			c = letter(rng);
+
+		const bool image = image_every > 0 && i % image_every == 0;
+		Message msg(0, image ? MessageType::IMAGE : MessageType::TEXT, 1500000000 + i, text, "user" + std::to_string(rng() % 500), NULL, 0);
+
+		if(image){
+			// distinct content, so every image is a blob of its own
+			msg.raw_size = 16 * 1024;
+			msg.raw = new unsigned char[msg.raw_size];
+			for(unsigned long long b = 0; b < msg.raw_size; ++b)
+				msg.raw[b] = rng();
+			thumbnail[0] = i;
+			thumbnail[1] = i >> 8;
+			thumbnail[2] = i >> 16;
+		}
+
+		db.new_msg(chat, msg, image ? thumbnail : std::vector<unsigned char>());
+	}
+
+	char line[200];
+	snprintf(line, sizeof(line), "  insert           %d messages, %.0f/s", messages, messages / elapsed.seconds());
+	std::cout << line << std::endl;
+}
+
+// backlogs of clients that are <behind> messages behind, read with the chat freshly opened so none come from memory
+static void backlogs(Database &db, const Chat &chat, int messages, int behind, int reads){
+	Latencies latencies;
+	unsigned long long total = 0;
+
+	for(int i = 0; i < reads; ++i){
+		const Stopwatch watch;
+		total += db.get_messages_since(messages - behind, chat.id).size();
+		latencies.add(watch.seconds());
+	}
+
+	char line[200];
+	snprintf(line, sizeof(line), "  %7d behind   %5zu reads, p50 %8.3fms, p99 %8.3fms, %9.0f messages/s at p50",
+		behind, latencies.count(), latencies.percentile(50) * 1000.0, latencies.percentile(99) * 1000.0,
+		(double)total / reads / latencies.percentile(50));
+	std::cout << line << std::endl;
+}
+
+// the same chat stored by each engine in turn: insert throughput, then backlog latency from various distances behind
+// both run from scratch every time
+int bench_engines(const Options &options){
+	const int messages = options.integer("messages", 200000);
+	const int reads = options.integer("reads", 50);
+	const int image_every = options.integer("image-every", 20);
+	const std::string dbpath = options.str("db", "chat-bench-engines-db");
+
+	const std::vector<std::pair<std::string, Engine>> engines = {
+		{"sqlite", Engine::SQLITE},
+		{"log", Engine::LOG}
+	};
+
+	for(const auto &engine : engines){
+		const std::string path = dbpath + "-" + engine.first;
+		std::filesystem::remove_all(path);
+
+		std::cout << engine.first << std::endl;
+
+		std::mt19937 rng(1234);
+		Chat chat;
+		{
+			Database db(path, 16, engine.second);
+			chat = db.new_chat({"engines", "chat-bench", "storage engine benchmark"});
+			fill(db, chat, messages, image_every, rng);
+		}
+
+		Database db(path, 16, engine.second);
+		for(const int behind : {100, 1000, 10000, 100000}){
+			if(behind <= messages)
+				backlogs(db, chat, messages, behind, reads);
+		}
+	}
+
+	return 0;
+}
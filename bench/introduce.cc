@@ -0,0 +1,97 @@
+#include <iostream>
+#include <vector>
+#include <memory>
+#include <cstdio>
+
+#include "bench.h"
+
+// read the client's INTRODUCE receipt, skipping heartbeats
+static bool recv_introduce(net::tcp &tcp, std::string &name){
+	for(;;){
+		ServerCommand type;
+		tcp.recv_block(&type, sizeof(type));
+		if(tcp.error())
+			return false;
+
+		if(type == ServerCommand::HEARTBEAT)
+			continue;
+		if(type != ServerCommand::INTRODUCE)
+			return false;
+
+		std::uint32_t size;
+		tcp.recv_block(&size, sizeof(size));
+
+		std::vector<char> raw(size + 1);
+		tcp.recv_block(&raw[0], size);
+		raw[size] = 0;
+
+		name = &raw[0];
+		return !tcp.error();
+	}
+}
+
+// every round, <clients> clients connect and introduce themselves all at once, then all hang up
+// this is what a server sees when it (or the network) comes back after an outage
+int bench_introduce(const Options &options){
+	const int clients = options.integer("clients", 400);
+	const int rounds = options.integer("rounds", 5);
+	const unsigned short port = options.integer("port", 28860);
+
+	LocalServer local(port, options.str("db", "chat-bench-db"));
+
+	double total_seconds = 0.0;
+	for(int round = 1; round <= rounds; ++round){
+		std::vector<std::unique_ptr<net::tcp>> connections;
+
+		const Stopwatch storm;
+
+		// everyone reconnects
+		for(int i = 0; i < clients; ++i){
+			auto tcp = std::make_unique<net::tcp>("127.0.0.1", port);
+			if(!tcp->connect(5))
+				throw std::runtime_error("couldn't connect client " + std::to_string(i));
+
+			connections.push_back(std::move(tcp));
+		}
+		const double connect_seconds = storm.seconds();
+
+		// everyone introduces themselves
+		const Stopwatch introduce;
+		for(int i = 0; i < clients; ++i){
+			const ClientCommand type = ClientCommand::INTRODUCE;
+			const std::string name = "bench-" + std::to_string(i);
+			const std::uint32_t size = name.length();
+
+			connections[i]->send_block(&type, sizeof(type));
+			connections[i]->send_block(&size, sizeof(size));
+			connections[i]->send_block(name.c_str(), size);
+		}
+
+		int renamed = 0;
+		for(int i = 0; i < clients; ++i){
+			std::string name;
+			if(!recv_introduce(*connections[i], name))
+				throw std::runtime_error("client " + std::to_string(i) + " got no INTRODUCE receipt");
+
+			if(name != "bench-" + std::to_string(i))
+				++renamed;
+		}
+		const double introduce_seconds = introduce.seconds();
+		total_seconds += storm.seconds();
+
+		char line[200];
+		snprintf(line, sizeof(line), "round %d: %d clients, connect %.3fs, introduce %.3fs (%.0f introductions/s), %d renamed",
+			round, clients, connect_seconds, introduce_seconds, clients / introduce_seconds, renamed);
+		std::cout << line << std::endl;
+
+		// everyone hangs up, and gives the server a moment to notice
+		connections.clear();
+		std::this_thread::sleep_for(std::chrono::milliseconds(500));
+	}
+
+	char line[200];
+	snprintf(line, sizeof(line), "total: %d reconnects in %.3fs (%.0f reconnects/s)", clients * rounds, total_seconds, (clients * rounds) / total_seconds);
+	std::cout << line << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,810 @@
+#include <iostream>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <functional>
+#include <random>
+#include <ctime>
+#include <cstdio>
+
+#include "bench.h"
+
+// <clients> clients speaking the protocol to a chat server, all subscribed to the same chat, <senders> of them posting to it
+// every message carries the time it was sent, and every client that gets it (the sender too) records how long it took
+// the clients are threads in this process, so they share a clock wherever the server is
+
+namespace{
+
+using Clock = std::chrono::steady_clock;
+
+enum class Scenario{CHATTER, IMAGES, FILES, STORM};
+
+struct Params{
+	std::string address;
+	unsigned short port;
+	int clients;
+	int senders;
+	int seconds;
+	int rate; // text messages a second from each sender
+	int text_bytes;
+	int burst; // images each sender posts at once
+	int burst_every; // ms between bursts
+	int image_bytes;
+	int thumbnail_bytes;
+	int downloaders; // clients that download the same file over and over, while the senders chat
+	int file_bytes;
+	int storm_every; // ms between everyone but the senders hanging up and coming back at once
+};
+
+long long now_ns(){
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+// what the clients share, what they're to do and what happened to them
+class Load{
+public:
+	Load(const Params &p, Scenario s, const std::string &c)
+		: params(p)
+		, scenario(s)
+		, chat(c)
+	{}
+
+	// message <id>, sent at <sent>, made it to one of the clients
+	void delivered(unsigned long long id, long long sent, unsigned long long bytes){
+		const long long now = now_ns();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		delivery.add((now - sent) / 1e9);
+		++deliveries;
+		delivered_bytes += bytes;
+
+		// and to the last of them
+		Spread &spread = spreads[id];
+		spread.last = std::max(spread.last, now);
+		if(++spread.count == params.clients){
+			fanout.add((spread.last - sent) / 1e9);
+			spreads.erase(id);
+		}
+	}
+
+	void receipt(bool worked){
+		std::lock_guard<std::mutex> lock(mutex);
+		++(worked ? accepted : refused);
+	}
+
+	void downloaded(double seconds, unsigned long long bytes){
+		std::lock_guard<std::mutex> lock(mutex);
+		downloads.add(seconds);
+		download_bytes += bytes;
+	}
+
+	void reconnected(double seconds, bool resumed){
+		std::lock_guard<std::mutex> lock(mutex);
+		reconnects.add(seconds);
+		if(resumed)
+			++resumes;
+	}
+
+	void failed(int client, const std::string &what){
+		std::lock_guard<std::mutex> lock(mutex);
+		if(failures++ == 0)
+			first_failure = "client " + std::to_string(client) + ": " + what;
+	}
+
+	const Params &params;
+	const Scenario scenario;
+	const std::string chat;
+
+	std::atomic<int> ready{0}; // clients that are subscribed
+	std::atomic<bool> sending{false};
+	std::atomic<bool> running{true};
+	std::atomic<int> storms{0};
+	std::atomic<unsigned long long> file{0}; // message id of the file to download
+
+	// guards everything below
+	std::mutex mutex;
+	unsigned long long posted = 0;
+	unsigned long long posted_bytes = 0;
+	unsigned long long accepted = 0;
+	unsigned long long refused = 0;
+	unsigned long long deliveries = 0;
+	unsigned long long delivered_bytes = 0;
+	Latencies delivery; // send to one client getting it
+	Latencies fanout; // send to the last client getting it
+	Latencies downloads;
+	unsigned long long download_bytes = 0;
+	Latencies reconnects; // hanging up to being back in the chat
+	unsigned long long resumes = 0;
+	unsigned long long failures = 0;
+	std::string first_failure;
+
+private:
+	struct Spread{
+		int count = 0;
+		long long last = 0;
+	};
+
+	std::map<unsigned long long, Spread> spreads; // messages not everyone has yet
+};
+
+// the server hung up
+class LostException : public std::runtime_error{
+public:
+	LostException()
+		: std::runtime_error("lost the server")
+	{}
+};
+
+// have the server make chat <name>, over a connection of its own
+void create_chat(const Params &params, const std::string &name){
+	net::tcp tcp(params.address, params.port);
+	if(!tcp.connect(5))
+		throw std::runtime_error("couldn't connect to " + params.address + ":" + std::to_string(params.port));
+
+	auto send_string = [&tcp](const std::string &str){
+		const std::uint32_t size = str.length();
+		tcp.send_block(&size, sizeof(size));
+		tcp.send_block(str.c_str(), size);
+	};
+
+	const ClientCommand command = ClientCommand::NEW_CHAT;
+	tcp.send_block(&command, sizeof(command));
+	send_string(name);
+	send_string("chat-bench");
+	send_string("made by chat-bench load");
+
+	// the receipt, after the heartbeat and maybe the announcement of the chat
+	for(;;){
+		ServerCommand type;
+		tcp.recv_block(&type, sizeof(type));
+		if(tcp.error())
+			throw LostException();
+
+		if(type == ServerCommand::HEARTBEAT)
+			continue;
+
+		if(type == ServerCommand::CHAT_CREATED){
+			std::uint64_t version, id;
+			tcp.recv_block(&version, sizeof(version));
+			tcp.recv_block(&id, sizeof(id));
+			for(int i = 0; i < 3; ++i){
+				std::uint32_t size;
+				tcp.recv_block(&size, sizeof(size));
+				std::vector<char> skip(size);
+				tcp.recv_block(skip.data(), size);
+			}
+			continue;
+		}
+
+		if(type != ServerCommand::NEW_CHAT)
+			throw std::runtime_error("unexpected reply to NEW_CHAT");
+
+		std::uint8_t worked;
+		tcp.recv_block(&worked, sizeof(worked));
+		if(tcp.error())
+			throw LostException();
+		if(!worked)
+			throw std::runtime_error("the server wouldn't make chat \"" + name + "\"");
+
+		return;
+	}
+}
+
+// one of the clients, on a thread of its own
+// it only ever sends from run(), what comes in while it's sending is read as it goes so the server never blocks on it
+class Peer{
+public:
+	Peer(Load &l, int i)
+		: load(l)
+		, index(i)
+		, sender(i < l.params.senders)
+		, downloader(l.scenario == Scenario::FILES && i >= l.params.senders && i < l.params.senders + l.params.downloaders)
+		, rng(i)
+	{}
+
+	void operator()(){
+		try{
+			open();
+
+			// the file to download goes up before anyone starts
+			if(load.scenario == Scenario::FILES && index == 0)
+				post_file();
+
+			++load.ready;
+			run();
+		}catch(const std::exception &e){
+			load.failed(index, e.what());
+			++load.ready;
+		}
+	}
+
+private:
+	void run(){
+		const int interval = load.scenario == Scenario::IMAGES ? load.params.burst_every : 1000 / std::max(load.params.rate, 1);
+		Clock::time_point next_post = Clock::now();
+		Clock::time_point next_heartbeat = Clock::now();
+		int storm = 0;
+		bool started = false;
+
+		while(load.running.load()){
+			const Clock::time_point now = Clock::now();
+
+			if(load.scenario == Scenario::STORM && !sender && storm != load.storms.load()){
+				storm = load.storms.load();
+				reconnect();
+				continue;
+			}
+
+			// messages it noticed it missed, taken first as receive() can add to them while this sends
+			std::vector<std::pair<unsigned long long, unsigned long long>> missed;
+			std::swap(missed, gaps);
+			for(const auto &[after, through] : missed){
+				const ClientCommand type = ClientCommand::GET_RANGE;
+				const std::uint64_t a = after, t = through;
+				send(&type, sizeof(type));
+				send(&a, sizeof(a));
+				send(&t, sizeof(t));
+			}
+
+			if(sender && load.sending.load()){
+				if(!started){
+					started = true;
+					next_post = now;
+				}
+
+				if(now >= next_post){
+					if(load.scenario == Scenario::IMAGES){
+						for(int i = 0; i < load.params.burst; ++i)
+							post(MessageType::IMAGE);
+					}
+					else
+						post(MessageType::TEXT);
+
+					// a sender that fell behind by more than a second starts over rather than catching up all at once
+					next_post += std::chrono::milliseconds(interval);
+					if(next_post < Clock::now() - std::chrono::seconds(1))
+						next_post = Clock::now();
+				}
+			}
+
+			if(downloader && load.sending.load() && !fetching)
+				fetch();
+
+			if(now >= next_heartbeat){
+				const ClientCommand type = ClientCommand::HEARTBEAT;
+				send(&type, sizeof(type));
+				next_heartbeat = now + std::chrono::seconds(HEARTBEAT_FREQUENCY);
+			}
+
+			// until the next post is due, a bit at a time so it notices storms and being told to stop
+			int wait = 50;
+			if(sender && load.sending.load() && started)
+				wait = std::clamp<int>(std::chrono::duration_cast<std::chrono::milliseconds>(next_post - Clock::now()).count(), 0, wait);
+
+			if(tcp->poll_recv(wait))
+				receive();
+			else if(tcp->error())
+				throw LostException();
+		}
+	}
+
+	// connect, introduce itself and subscribe
+	void open(){
+		connect();
+		introduce();
+		subscribe();
+	}
+
+	void connect(){
+		tcp = std::make_unique<net::tcp>(load.params.address, load.params.port);
+		if(!tcp->connect(5))
+			throw std::runtime_error("couldn't connect");
+	}
+
+	void introduce(){
+		introduced = false;
+
+		const ClientCommand type = ClientCommand::INTRODUCE;
+		send(&type, sizeof(type));
+		send_string("load-" + std::to_string(index));
+
+		until([this]{ return introduced; });
+	}
+
+	// anything after <last> comes with the receipt
+	void subscribe(){
+		subscribed.reset();
+
+		const ClientCommand type = ClientCommand::SUBSCRIBE;
+		send(&type, sizeof(type));
+		send_string(load.chat);
+		const std::uint64_t max = last;
+		send(&max, sizeof(max));
+
+		until([this]{ return subscribed.has_value(); });
+		if(!*subscribed)
+			throw std::runtime_error("couldn't subscribe to " + load.chat);
+	}
+
+	// hang up and come back, like a client on a flaky network would
+	// the session is picked up where it left off if the server has it parked, otherwise it starts a new one
+	void reconnect(){
+		const Stopwatch elapsed;
+
+		tcp.reset();
+		connect();
+		resumed.reset();
+
+		const ClientCommand type = ClientCommand::RESUME;
+		send(&type, sizeof(type));
+		send_string(token);
+
+		until([this]{ return resumed.has_value(); });
+
+		if(*resumed){
+			// everything after what the server had sent before it noticed is still in its out queue
+			if(resumed_through > last)
+				gap(resumed_through + 1);
+		}
+		else{
+			introduce();
+			subscribe();
+		}
+
+		load.reconnected(elapsed.seconds(), *resumed);
+	}
+
+	// text, or an image with a thumbnail
+	void post(MessageType kind){
+		std::string text = "sent " + std::to_string(now_ns()) + " by " + std::to_string(index) + " ";
+		while((int)text.size() < load.params.text_bytes)
+			text += (char)('a' + rng() % 26);
+
+		std::vector<unsigned char> image;
+		std::vector<unsigned char> thumbnail;
+		if(kind == MessageType::IMAGE){
+			image = noise(load.params.image_bytes);
+			thumbnail = noise(load.params.thumbnail_bytes);
+		}
+
+		const ClientCommand type = ClientCommand::MESSAGE;
+		send(&type, sizeof(type));
+		send(&kind, sizeof(kind));
+		send_string(text);
+
+		const std::uint64_t raw_size = image.size();
+		send(&raw_size, sizeof(raw_size));
+		send(image.data(), image.size());
+
+		if(kind == MessageType::IMAGE){
+			const std::uint64_t thumbnail_size = thumbnail.size();
+			send(&thumbnail_size, sizeof(thumbnail_size));
+			send(thumbnail.data(), thumbnail.size());
+		}
+
+		std::lock_guard<std::mutex> lock(load.mutex);
+		++load.posted;
+		load.posted_bytes += text.size() + image.size();
+	}
+
+	// the file the downloaders fetch, its id is known once it comes back
+	void post_file(){
+		const std::vector<unsigned char> content = noise(load.params.file_bytes);
+		const MessageType kind = MessageType::FILE;
+		file_receipt = true;
+
+		const ClientCommand type = ClientCommand::MESSAGE;
+		send(&type, sizeof(type));
+		send(&kind, sizeof(kind));
+		send_string("load.bin");
+		const std::uint64_t raw_size = content.size();
+		send(&raw_size, sizeof(raw_size));
+		send(content.data(), content.size());
+
+		until([this]{ return load.file.load() != 0; });
+	}
+
+	void fetch(){
+		fetching = true;
+		fetch_started = Clock::now();
+		fetch_size.reset();
+		fetch_got = 0;
+
+		const ClientCommand type = ClientCommand::GET_FILE;
+		const std::uint64_t id = load.file.load();
+		const std::uint64_t offset = 0;
+		send(&type, sizeof(type));
+		send(&id, sizeof(id));
+		send(&offset, sizeof(offset));
+	}
+
+	// one command from the server
+	// it never sends, that could land in the middle of something run() is sending
+	void receive(){
+		ServerCommand type;
+		recv(&type, sizeof(type));
+
+		switch(type){
+		case ServerCommand::HEARTBEAT:
+			break;
+		case ServerCommand::INTRODUCE:
+			recv_string();
+			token = recv_string();
+			introduced = true;
+			break;
+		case ServerCommand::RESUME:{
+			std::uint8_t worked;
+			recv(&worked, sizeof(worked));
+			if(worked){
+				recv_string();
+				token = recv_string();
+				std::uint64_t through;
+				recv(&through, sizeof(through));
+				resumed_through = through;
+			}
+			resumed = worked != 0;
+			break;
+		}
+		case ServerCommand::SUBSCRIBE:{
+			std::uint8_t worked;
+			recv(&worked, sizeof(worked));
+			if(worked)
+				recv_messages();
+			subscribed = worked != 0;
+			break;
+		}
+		case ServerCommand::RANGE:{
+			std::uint64_t through;
+			recv(&through, sizeof(through));
+			recv_messages();
+			break;
+		}
+		case ServerCommand::MESSAGE:
+			recv_message();
+			break;
+		case ServerCommand::MESSAGE_RECEIPT:{
+			std::uint8_t worked;
+			recv(&worked, sizeof(worked));
+			const std::string err = worked ? "" : recv_string();
+
+			// the file's isn't one of the messages being measured
+			if(file_receipt){
+				file_receipt = false;
+				if(!worked)
+					throw std::runtime_error("the server wouldn't take the file: " + err);
+			}
+			else
+				load.receipt(worked != 0);
+			break;
+		}
+		case ServerCommand::CHAT_CREATED:{
+			std::uint64_t version, id;
+			recv(&version, sizeof(version));
+			recv(&id, sizeof(id));
+			recv_string();
+			recv_string();
+			recv_string();
+			break;
+		}
+		case ServerCommand::SEND_FILE:{
+			std::uint64_t size, from;
+			recv(&size, sizeof(size));
+			recv_string();
+			recv(&from, sizeof(from));
+			if(size == 0)
+				throw std::runtime_error("the server doesn't have the file");
+			fetch_size = size;
+			break;
+		}
+		case ServerCommand::FILE_DATA:{
+			std::uint32_t length;
+			recv(&length, sizeof(length));
+			scratch.resize(length);
+			recv(scratch.data(), length);
+
+			fetch_got += length;
+			if(fetching && fetch_size && fetch_got >= *fetch_size){
+				load.downloaded(std::chrono::duration<double>(Clock::now() - fetch_started).count(), fetch_got);
+				fetching = false;
+			}
+			break;
+		}
+		default:
+			throw std::runtime_error("unexpected command " + std::to_string((int)type) + " from the server");
+		}
+	}
+
+	// a count, then that many messages, the way SUBSCRIBE and RANGE replies carry them
+	void recv_messages(){
+		std::uint64_t count;
+		recv(&count, sizeof(count));
+		for(std::uint64_t i = 0; i < count; ++i)
+			recv_message();
+	}
+
+	void recv_message(){
+		std::uint64_t id;
+		MessageType type;
+		std::int32_t unixtime;
+		recv(&id, sizeof(id));
+		recv(&type, sizeof(type));
+		recv(&unixtime, sizeof(unixtime));
+		const std::string text = recv_string();
+		recv_string();
+		std::uint64_t raw_size;
+		recv(&raw_size, sizeof(raw_size));
+		scratch.resize(raw_size);
+		recv(scratch.data(), raw_size);
+
+		if(id < seen.size() && seen[id])
+			return;
+		if(id >= seen.size())
+			seen.resize(id * 2 + 1);
+		seen[id] = true;
+
+		// something in between went missing, the server dropped it from the out queue of a client that fell behind
+		if(id > last + 1)
+			gap(id);
+		last = std::max<unsigned long long>(last, id);
+
+		if(type == MessageType::FILE && text.rfind("load.bin", 0) == 0)
+			load.file.store(id);
+
+		long long sent;
+		if(std::sscanf(text.c_str(), "sent %lld", &sent) == 1)
+			load.delivered(id, sent, text.size() + raw_size);
+	}
+
+	// ask for what's missing before <id>, unless it has been already
+	void gap(unsigned long long id){
+		const unsigned long long after = std::max(last, asked);
+		if(id <= after + 1)
+			return;
+
+		gaps.push_back({after, id - 1});
+		asked = id - 1;
+	}
+
+	void until(const std::function<bool()> &done){
+		const Stopwatch elapsed;
+		while(!done()){
+			if(elapsed.seconds() > 30)
+				throw std::runtime_error("the server took too long to answer");
+
+			if(tcp->poll_recv(50))
+				receive();
+			else if(tcp->error())
+				throw LostException();
+		}
+	}
+
+	// what comes in while the server won't take any more is read, so it never waits on this client to send to it
+	void send(const void *data, unsigned size){
+		unsigned sent = 0;
+		while(sent != size){
+			const int n = tcp->send_nonblock((const char*)data + sent, size - sent);
+			sent += n;
+
+			if(tcp->error())
+				throw LostException();
+
+			if(n == 0){
+				if(tcp->poll_recv(1))
+					receive();
+				else if(tcp->error())
+					throw LostException();
+			}
+		}
+	}
+
+	void send_string(const std::string &str){
+		const std::uint32_t size = str.length();
+		send(&size, sizeof(size));
+		send(str.c_str(), size);
+	}
+
+	void recv(void *data, unsigned size){
+		if(size == 0)
+			return;
+
+		tcp->recv_block(data, size);
+		if(tcp->error())
+			throw LostException();
+	}
+
+	std::string recv_string(){
+		std::uint32_t size;
+		recv(&size, sizeof(size));
+
+		std::string str(size, 0);
+		recv(&str[0], size);
+		return str;
+	}
+
+	std::vector<unsigned char> noise(int bytes){
+		std::vector<unsigned char> data(bytes);
+		for(unsigned char &c : data)
+			c = rng();
+
+		return data;
+	}
+
+	Load &load;
+	const int index;
+	const bool sender;
+	const bool downloader;
+	std::mt19937 rng;
+	std::unique_ptr<net::tcp> tcp;
+	std::string token;
+
+	bool introduced = false;
+	std::optional<bool> subscribed;
+	std::optional<bool> resumed;
+	unsigned long long resumed_through = 0;
+
+	std::vector<bool> seen; // by message id
+	unsigned long long last = 0; // newest message id it has
+	unsigned long long asked = 0; // newest message id it asked for with GET_RANGE
+	std::vector<std::pair<unsigned long long, unsigned long long>> gaps; // for run() to ask for
+
+	bool file_receipt = false; // the next receipt is for post_file()
+	bool fetching = false;
+	Clock::time_point fetch_started;
+	std::optional<unsigned long long> fetch_size;
+	unsigned long long fetch_got = 0;
+
+	std::vector<unsigned char> scratch;
+};
+
+const char *name(Scenario scenario){
+	switch(scenario){
+	case Scenario::CHATTER:
+		return "chatter";
+	case Scenario::IMAGES:
+		return "images";
+	case Scenario::FILES:
+		return "files";
+	case Scenario::STORM:
+		return "storm";
+	}
+
+	return "";
+}
+
+void percentiles(const char *what, Latencies &latencies, const char *meaning){
+	char line[200];
+	snprintf(line, sizeof(line), "  %-10s p50 %8.2fms, p99 %8.2fms, p999 %8.2fms (%zu, %s)", what,
+		latencies.percentile(50) * 1000.0, latencies.percentile(99) * 1000.0, latencies.percentile(99.9) * 1000.0, latencies.count(), meaning);
+	std::cout << line << std::endl;
+}
+
+// one scenario, on a chat of its own
+void run(const Params &params, Scenario scenario){
+	const std::string chat = std::string("load-") + name(scenario) + "-" + std::to_string(time(NULL));
+	create_chat(params, chat);
+
+	Load load(params, scenario, chat);
+
+	std::vector<std::unique_ptr<Peer>> peers;
+	std::vector<std::thread> threads;
+	for(int i = 0; i < params.clients; ++i){
+		peers.push_back(std::make_unique<Peer>(load, i));
+		threads.emplace_back(std::ref(*peers.back()));
+	}
+
+	// everyone is subscribed (or has given up) before anyone posts
+	while(load.ready.load() < params.clients)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+	const Stopwatch window;
+	load.sending.store(true);
+
+	double next_storm = std::max(params.storm_every, 100) / 1000.0;
+	while(window.seconds() < params.seconds){
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+		if(scenario == Scenario::STORM && window.seconds() >= next_storm && window.seconds() < params.seconds){
+			++load.storms;
+			next_storm += std::max(params.storm_every, 100) / 1000.0;
+		}
+	}
+
+	load.sending.store(false);
+	const double seconds = window.seconds();
+
+	// let what's on its way get where it's going
+	const Stopwatch drain;
+	for(;;){
+		{
+			std::lock_guard<std::mutex> lock(load.mutex);
+			if(load.accepted + load.refused >= load.posted && load.deliveries >= load.accepted * params.clients)
+				break;
+		}
+
+		if(drain.seconds() > 10)
+			break;
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+
+	load.running.store(false);
+	for(std::thread &thread : threads)
+		thread.join();
+
+	const unsigned long long expected = load.accepted * params.clients;
+	char line[300];
+	snprintf(line, sizeof(line), "%s: %d clients, %d of them posting for %.1fs", name(scenario), params.clients, params.senders, seconds);
+	std::cout << line << std::endl;
+
+	snprintf(line, sizeof(line), "  posted     %llu (%.1f/s, %.2fMB/s, %llu refused), %llu deliveries (%.0f/s, %.2fMB/s), %llu missing",
+		load.posted, load.posted / seconds, load.posted_bytes / seconds / 1024.0 / 1024.0, load.refused,
+		load.deliveries, load.deliveries / seconds, load.delivered_bytes / seconds / 1024.0 / 1024.0,
+		expected > load.deliveries ? expected - load.deliveries : 0ULL);
+	std::cout << line << std::endl;
+
+	percentiles("delivery", load.delivery, "sent to one client having it");
+	percentiles("fan-out", load.fanout, "sent to every client having it");
+
+	if(scenario == Scenario::FILES){
+		snprintf(line, sizeof(line), "  downloads  %zu of %.1fMB (%.2fMB/s)", load.downloads.count(), params.file_bytes / 1024.0 / 1024.0,
+			load.download_bytes / seconds / 1024.0 / 1024.0);
+		std::cout << line << std::endl;
+		percentiles("download", load.downloads, "GET_FILE to the last byte");
+	}
+
+	if(scenario == Scenario::STORM){
+		snprintf(line, sizeof(line), "  reconnects %zu, %llu resumed, the rest introduced and subscribed again", load.reconnects.count(), load.resumes);
+		std::cout << line << std::endl;
+		percentiles("reconnect", load.reconnects, "hanging up to being back in the chat");
+	}
+
+	if(load.failures > 0){
+		snprintf(line, sizeof(line), "  %llu clients failed, the first with %s", load.failures, load.first_failure.c_str());
+		std::cout << line << std::endl;
+	}
+}
+
+}
+
+// throughput and fan-out latency of text chatter, image bursts, file downloads and reconnect storms
+int bench_load(const Options &options){
+	Params params;
+	params.address = options.str("server", "");
+	params.port = options.integer("port", 28861);
+	params.clients = options.integer("clients", 100);
+	params.senders = std::min(options.integer("senders", 5), params.clients);
+	params.seconds = options.integer("seconds", 10);
+	params.rate = options.integer("rate", 10);
+	params.text_bytes = options.integer("text-bytes", 100);
+	params.burst = options.integer("burst", 4);
+	params.burst_every = options.integer("burst-every", 1000);
+	params.image_bytes = options.integer("image-bytes", 256 * 1024);
+	params.thumbnail_bytes = options.integer("thumbnail-bytes", 16 * 1024);
+	params.downloaders = options.integer("downloaders", 10);
+	params.file_bytes = options.integer("file-bytes", 4 * 1024 * 1024);
+	params.storm_every = options.integer("storm-every", 2500);
+
+	const std::string which = options.str("scenario", "all");
+	std::vector<Scenario> scenarios;
+	for(Scenario scenario : {Scenario::CHATTER, Scenario::IMAGES, Scenario::FILES, Scenario::STORM}){
+		if(which == "all" || which == name(scenario))
+			scenarios.push_back(scenario);
+	}
+
+	if(scenarios.empty())
+		throw std::runtime_error("no scenario \"" + which + "\"");
+
+	// a server of its own, unless it was given one
+	std::unique_ptr<LocalServer> local;
+	if(params.address.empty()){
+		local = std::make_unique<LocalServer>(params.port, options.str("db", "chat-bench-load-db"));
+		params.address = "127.0.0.1";
+	}
+
+	for(Scenario scenario : scenarios)
+		run(params, scenario);
+
+	return 0;
+}
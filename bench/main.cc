@@ -0,0 +1,57 @@
+#include <iostream>
+#include <exception>
+
+#include <signal.h>
+
+#include "bench.h"
+
+static void usage(){
+	std::cout << "usage: chat-bench <workload> [--option value ...]" << std::endl;
+	std::cout << "workloads:" << std::endl;
+	std::cout << "  introduce   INTRODUCE throughput while every client reconnects at once" << std::endl;
+	std::cout << "              --clients N (400) --rounds N (5) --port N (28860) --db PATH (chat-bench-db)" << std::endl;
+	std::cout << "  search      SEARCH query latency over one big chat, filled on the first run" << std::endl;
+	std::cout << "              --messages N (10000000) --queries N (200) --page N (20) --db PATH (chat-bench-search-db)" << std::endl;
+	std::cout << "  engines     insert throughput and backlog latency of the sqlite and log storage engines" << std::endl;
+	std::cout << "              --messages N (200000) --reads N (50) --image-every N (20) --db PATH (chat-bench-engines-db)" << std::endl;
+	std::cout << "  reconnect   simulated time until every client is back after a server outage, fixed retry vs backoff" << std::endl;
+	std::cout << "              --clients N (10000) --outage MS (5000) --detect MS (0) --rate N (2500) --backlog N (4096)" << std::endl;
+	std::cout << "              --base MS (250) --multiplier N (2) --cap MS (10000) --attempt MS (2000) --seed N (1234)" << std::endl;
+	std::cout << "  load        throughput and fan-out latency of clients speaking the protocol, one chat per scenario" << std::endl;
+	std::cout << "              --scenario chatter|images|files|storm|all (all) --clients N (100) --senders N (5) --seconds N (10)" << std::endl;
+	std::cout << "              --rate N (10) --text-bytes N (100) --burst N (4) --burst-every MS (1000) --image-bytes N (262144)" << std::endl;
+	std::cout << "              --thumbnail-bytes N (16384) --downloaders N (10) --file-bytes N (4194304) --storm-every MS (2500)" << std::endl;
+	std::cout << "              --server ADDRESS (one in this process) --port N (28861) --db PATH (chat-bench-load-db)" << std::endl;
+}
+
+int main(int argc, char **argv){
+	if(argc < 2){
+		usage();
+		return 1;
+	}
+
+	// the benchmarks hang up on the server all the time
+	signal(SIGPIPE, SIG_IGN);
+
+	const std::string workload = argv[1];
+	const Options options(argc - 2, argv + 2);
+
+	try{
+		if(workload == "introduce")
+			return bench_introduce(options);
+		if(workload == "search")
+			return bench_search(options);
+		if(workload == "engines")
+			return bench_engines(options);
+		if(workload == "reconnect")
+			return bench_reconnect(options);
+		if(workload == "load")
+			return bench_load(options);
+	}catch(const std::exception &e){
+		std::cerr << "\033[31;1mfatal error:\033[0m " << e.what() << std::endl;
+		return 1;
+	}
+
+	usage();
+	return 1;
+}
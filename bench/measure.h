@@ -0,0 +1,86 @@
+#ifndef MEASURE_H
+#define MEASURE_H
+
+#include <string>
+#include <map>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+// option parsing and timing, shared by chat-bench and chat-bench-catchup
+// nothing in here may depend on the server, chat-bench-catchup links the client library's code instead
+
+// command line options of the form "--name value"
+class Options{
+public:
+	Options(int argc, char **argv){
+		for(int i = 0; i + 1 < argc; i += 2){
+			std::string key = argv[i];
+			if(key.rfind("--", 0) == 0)
+				key = key.substr(2);
+
+			values[key] = argv[i + 1];
+		}
+	}
+
+	int integer(const std::string &key, int def)const{
+		auto it = values.find(key);
+		return it == values.end() ? def : std::stoi(it->second);
+	}
+
+	std::string str(const std::string &key, const std::string &def)const{
+		auto it = values.find(key);
+		return it == values.end() ? def : it->second;
+	}
+
+private:
+	std::map<std::string, std::string> values;
+};
+
+// measures elapsed wall time
+class Stopwatch{
+public:
+	Stopwatch()
+		: start(std::chrono::steady_clock::now())
+	{}
+
+	double seconds()const{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+private:
+	std::chrono::steady_clock::time_point start;
+};
+
+// a set of latency samples, in seconds
+class Latencies{
+public:
+	void add(double seconds){
+		samples.push_back(seconds);
+		sorted = false;
+	}
+
+	// <p> between 0 and 100
+	double percentile(double p){
+		if(samples.empty())
+			return 0.0;
+
+		if(!sorted){
+			std::sort(samples.begin(), samples.end());
+			sorted = true;
+		}
+
+		const size_t index = (size_t)((p / 100.0) * (samples.size() - 1) + 0.5);
+		return samples[index];
+	}
+
+	size_t count()const{
+		return samples.size();
+	}
+
+private:
+	std::vector<double> samples;
+	bool sorted = false;
+};
+
+#endif // MEASURE_H
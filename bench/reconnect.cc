@@ -0,0 +1,279 @@
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <queue>
+#include <random>
+#include <cstdio>
+
+#include "bench.h"
+#include "../client/Backoff.h"
+
+// a simulation of <clients> clients that all lose the server at once, then find their way back to it when it returns
+// no sockets, the numbers that matter are the server's accept/INTRODUCE rate (measure it with the introduce workload)
+// and what the kernel does with connection attempts: a closed port refuses them, a full listen backlog drops the SYN,
+// and the client's kernel retransmits it 1, 2, 4 ... seconds later, up to 6 times, before the connect fails
+
+namespace{
+
+struct Params{
+	int clients;
+	double outage; // ms until the server is back
+	double detect; // ms over which the clients notice they lost the server
+	double rate; // connections the server accepts and introduces per second
+	unsigned backlog; // listen backlog
+};
+
+// how the client library tries to reconnect
+struct Strategy{
+	std::string name;
+	Backoff backoff;
+	double attempt; // ms each attempt waits for the server to answer, 0 to just poll the connect
+	bool delay_first; // wait before the first attempt too
+};
+
+struct Result{
+	std::vector<double> back; // ms from the outage until each client was back
+	unsigned long long syns = 0;
+	unsigned long long dropped = 0;
+	unsigned long long refused = 0;
+};
+
+enum class Event{ATTEMPT, RETRANSMIT, ATTEMPT_OVER, SERVE};
+
+struct Scheduled{
+	double at;
+	unsigned long long seq;
+	Event event;
+	int client;
+
+	bool operator>(const Scheduled &rhs)const{
+		return at != rhs.at ? at > rhs.at : seq > rhs.seq;
+	}
+};
+
+struct Peer{
+	unsigned attempt = 0; // attempts the library has made
+	bool watching = false; // the library is waiting on a connect
+	bool pending = false; // the kernel is still trying to deliver a SYN
+	double rto = 1000.0;
+	int retransmits = 0;
+	bool handshaken = false; // sitting in the listen backlog, or accepted
+	double accepted = -1.0;
+	double noticed = -1.0; // the library saw the connect succeed
+};
+
+class Simulation{
+public:
+	Simulation(const Params &p, const Strategy &s, unsigned seed)
+		: params(p)
+		, strategy(s)
+		, clients(p.clients)
+		, rng(seed)
+	{}
+
+	Result run(){
+		std::uniform_real_distribution<double> detect(0.0, params.detect);
+		for(int i = 0; i < params.clients; ++i){
+			const double lost = params.detect > 0.0 ? detect(rng) : 0.0;
+			schedule(lost + (strategy.delay_first ? strategy.backoff.delay(clients[i].attempt++, rng) : 0.0), Event::ATTEMPT, i);
+		}
+
+		while(!events.empty() && remaining > 0){
+			const Scheduled next = events.top();
+			events.pop();
+
+			switch(next.event){
+			case Event::ATTEMPT:
+				attempt(next.at, next.client);
+				break;
+			case Event::RETRANSMIT:
+				syn(next.at, next.client);
+				break;
+			case Event::ATTEMPT_OVER:
+				attempt_over(next.at, next.client);
+				break;
+			case Event::SERVE:
+				serve(next.at);
+				break;
+			}
+		}
+
+		return result;
+	}
+
+private:
+	void schedule(double at, Event event, int client){
+		events.push({at, seq++, event, client});
+	}
+
+	// the library calls connect
+	void attempt(double now, int i){
+		Peer &client = clients[i];
+
+		if(client.handshaken){
+			notice(now, i);
+			return;
+		}
+
+		if(!client.pending)
+			syn(now, i);
+
+		if(client.handshaken){
+			notice(now, i);
+			return;
+		}
+
+		if(strategy.attempt > 0.0 && client.pending){
+			client.watching = true;
+			schedule(now + strategy.attempt, Event::ATTEMPT_OVER, i);
+		}
+		else
+			retry(now, i);
+	}
+
+	void attempt_over(double now, int i){
+		Peer &client = clients[i];
+		if(!client.watching)
+			return;
+
+		client.watching = false;
+		retry(now, i);
+	}
+
+	void retry(double now, int i){
+		schedule(now + strategy.backoff.delay(clients[i].attempt++, rng), Event::ATTEMPT, i);
+	}
+
+	// a SYN reaches the server
+	void syn(double now, int i){
+		Peer &client = clients[i];
+		++result.syns;
+
+		if(now < params.outage){
+			++result.refused;
+			client.pending = false;
+			return;
+		}
+
+		if(backlog.size() >= params.backlog){
+			++result.dropped;
+
+			// the kernel tries again by itself, until it gives up on the connect
+			client.pending = client.retransmits < 6;
+			if(client.pending){
+				schedule(now + client.rto, Event::RETRANSMIT, i);
+				client.rto *= 2.0;
+				++client.retransmits;
+			}
+			else{
+				client.rto = 1000.0;
+				client.retransmits = 0;
+			}
+
+			return;
+		}
+
+		client.pending = false;
+		client.handshaken = true;
+		backlog.push_back(i);
+
+		if(!serving){
+			serving = true;
+			schedule(std::max(now, idle), Event::SERVE, -1);
+		}
+
+		if(client.watching)
+			notice(now, i);
+	}
+
+	// the server accepts the oldest connection in the backlog
+	void serve(double now){
+		const int i = backlog.front();
+		backlog.pop_front();
+
+		clients[i].accepted = now;
+		idle = now + 1000.0 / params.rate;
+		finish(i);
+
+		if(backlog.empty())
+			serving = false;
+		else
+			schedule(idle, Event::SERVE, -1);
+	}
+
+	void notice(double now, int i){
+		Peer &client = clients[i];
+		if(client.noticed >= 0.0)
+			return;
+
+		client.watching = false;
+		client.noticed = now;
+		finish(i);
+	}
+
+	// back once the server has accepted it and it has introduced itself
+	void finish(int i){
+		const Peer &client = clients[i];
+		if(client.accepted < 0.0 || client.noticed < 0.0)
+			return;
+
+		result.back.push_back(std::max(client.accepted + 1000.0 / params.rate, client.noticed) - params.outage);
+		--remaining;
+	}
+
+	const Params params;
+	const Strategy strategy;
+	std::vector<Peer> clients;
+	std::mt19937 rng;
+	std::priority_queue<Scheduled, std::vector<Scheduled>, std::greater<Scheduled>> events;
+	unsigned long long seq = 0;
+	std::deque<int> backlog;
+	bool serving = false;
+	double idle = 0.0; // when the server can accept the next connection
+	int remaining = params.clients;
+	Result result;
+};
+
+}
+
+// time until every client is back after a server outage, with the old fixed 50ms retry and with backoff
+int bench_reconnect(const Options &options){
+	Params params;
+	params.clients = options.integer("clients", 10000);
+	params.outage = options.integer("outage", 5000);
+	params.detect = options.integer("detect", 0);
+	params.rate = options.integer("rate", 2500);
+	params.backlog = options.integer("backlog", 4096);
+	const unsigned seed = options.integer("seed", 1234);
+	const double attempt = options.integer("attempt", 2000); // RECONNECT_ATTEMPT_SECONDS in the client library
+
+	const Backoff backoff(options.integer("base", 250), options.integer("multiplier", 2), options.integer("cap", 10000), true);
+	Backoff lockstep = backoff;
+	lockstep.jitter = false;
+
+	const std::vector<Strategy> strategies = {
+		{"fixed 50ms", Backoff(50, 1.0, 50, false), 0.0, false},
+		{"backoff", lockstep, attempt, true},
+		{"backoff+jitter", backoff, attempt, true}
+	};
+
+	char line[300];
+	snprintf(line, sizeof(line), "%d clients, server back after %.0fms, accepting %.0f/s with a backlog of %u",
+		params.clients, params.outage, params.rate, params.backlog);
+	std::cout << line << std::endl;
+
+	for(const Strategy &strategy : strategies){
+		Result result = Simulation(params, strategy, seed).run();
+		std::sort(result.back.begin(), result.back.end());
+
+		auto at = [&result](double p){
+			return result.back.empty() ? 0.0 : result.back[(size_t)((p / 100.0) * (result.back.size() - 1) + 0.5)] / 1000.0;
+		};
+
+		snprintf(line, sizeof(line), "  %-16s %5zu back, p50 %7.3fs, p99 %7.3fs, all %7.3fs, %9llu SYNs (%llu refused, %llu dropped by a full backlog)",
+			strategy.name.c_str(), result.back.size(), at(50), at(99), at(100), result.syns, result.refused, result.dropped);
+		std::cout << line << std::endl;
+	}
+
+	return 0;
+}
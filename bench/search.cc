@@ -0,0 +1,178 @@
+#include <iostream>
+#include <vector>
+#include <random>
+#include <unordered_set>
+#include <cstdio>
+
+#include "bench.h"
+
+// made up words, a few of them common and most of them rare, like real chat
+class Vocabulary{
+public:
+	explicit Vocabulary(std::mt19937 &r)
+		: rng(r)
+		, skew(0.0, 1.0)
+	{
+		const char *const syllables[] = {"ka", "lo", "mi", "ne", "su", "ta", "ri", "po", "ve", "da", "zu", "gi", "ho", "be", "fa", "wy"};
+
+		std::uniform_int_distribution<int> syllable(0, 15);
+		std::uniform_int_distribution<int> length(2, 5);
+		std::unordered_set<std::string> seen;
+		while(words.size() < 20000){
+			std::string word;
+			const int n = length(rng);
+			for(int i = 0; i < n; ++i)
+				word += syllables[syllable(rng)];
+
+			if(seen.insert(word).second)
+				words.push_back(word);
+		}
+	}
+
+	// the lower the index, the more often the word is picked
+	const std::string &word(){
+		const double u = skew(rng);
+		return words[(size_t)(u * u * u * (words.size() - 1))];
+	}
+
+	const std::string &at(size_t index)const{
+		return words.at(index);
+	}
+
+	size_t size()const{
+		return words.size();
+	}
+
+private:
+	std::mt19937 &rng;
+	std::uniform_real_distribution<double> skew;
+	std::vector<std::string> words;
+};
+
+// add messages to the chat database at <path> until it has <target>
+// goes around Database::new_msg, a transaction per message would take all day at this size,
+// but indexes each message the same way
+static void fill(const std::string &path, long long target, Vocabulary &vocab, std::mt19937 &rng){
+	lite3::connection conn(path);
+
+	long long have;
+	{
+		lite3::statement count(conn, "select count(*) from messages;");
+		count.execute();
+		have = count.long_integer(0);
+	}
+
+	if(have >= target)
+		return;
+
+	std::cout << "filling " << path << " from " << have << " to " << target << " messages" << std::endl;
+	const Stopwatch elapsed;
+
+	std::uniform_int_distribution<int> length(3, 25);
+	const long long batch = 100000;
+	while(have < target){
+		conn.begin();
+		{
+			lite3::statement insert(conn, "insert into messages (type,unixtime,message,name) values (0,?,?,?);");
+			lite3::statement index(conn, "insert into search (rowid,message,name) values (last_insert_rowid(),?,?);");
+
+			for(long long i = 0; i < batch && have < target; ++i, ++have){
+				std::string text;
+				const int n = length(rng);
+				for(int w = 0; w < n; ++w)
+					text += (w == 0 ? "" : " ") + vocab.word();
+
+				const std::string sender = "user" + std::to_string(rng() % 500);
+
+				insert.reset();
+				insert.bind(1, (std::int32_t)(1500000000 + have));
+				insert.bind(2, text);
+				insert.bind(3, sender);
+				insert.execute();
+
+				index.reset();
+				index.bind(1, text);
+				index.bind(2, sender);
+				index.execute();
+			}
+		}
+		conn.commit();
+
+		char line[100];
+		snprintf(line, sizeof(line), "  %lld messages, %.0f/s", have, have / elapsed.seconds());
+		std::cout << line << std::endl;
+	}
+
+	// merge the index segments, like a long running chat would have by now
+	conn.execute("insert into search (search) values ('optimize');");
+}
+
+static void report(const std::string &name, Latencies &latencies, long long results){
+	char line[200];
+	snprintf(line, sizeof(line), "%-16s %5zu queries, %6.1f results avg, p50 %8.3fms, p90 %8.3fms, p99 %8.3fms, max %8.3fms",
+		name.c_str(), latencies.count(), (double)results / latencies.count(),
+		latencies.percentile(50) * 1000.0, latencies.percentile(90) * 1000.0, latencies.percentile(99) * 1000.0, latencies.percentile(100) * 1000.0);
+	std::cout << line << std::endl;
+}
+
+// latency of Database::search over one chat with <messages> messages
+// the chat is kept between runs, only the first run at a given size has to fill it
+int bench_search(const Options &options){
+	const long long messages = options.integer("messages", 10000000);
+	const int queries = options.integer("queries", 200);
+	const int page = options.integer("page", 20);
+	const std::string dbpath = options.str("db", "chat-bench-search-db");
+
+	std::mt19937 rng(1234);
+	Vocabulary vocab(rng);
+
+	Database db(dbpath, 16);
+
+	Chat chat;
+	for(const Chat &c : db.get_chats()){
+		if(c.name == "search")
+			chat = c;
+	}
+	if(chat.id == 0)
+		chat = db.new_chat({"search", "chat-bench", "full text search benchmark"});
+
+	fill(dbpath + "/" + std::to_string(chat.id), messages, vocab, rng);
+
+	// common words match a huge number of messages, the ones in the tail far fewer
+	struct Kind{
+		std::string name;
+		std::function<std::string()> query;
+		unsigned long long offset;
+	};
+
+	std::uniform_int_distribution<size_t> common(0, 20);
+	std::uniform_int_distribution<size_t> middling(200, 2000);
+	std::uniform_int_distribution<size_t> tail(10000, vocab.size() - 1);
+
+	const std::vector<Kind> kinds = {
+		{"common word", [&]{ return vocab.at(common(rng)); }, 0},
+		{"common, page 10", [&]{ return vocab.at(common(rng)); }, (unsigned long long)page * 9},
+		{"middling word", [&]{ return vocab.at(middling(rng)); }, 0},
+		{"tail word", [&]{ return vocab.at(tail(rng)); }, 0},
+		{"two words", [&]{ return vocab.at(middling(rng)) + " AND " + vocab.at(common(rng)); }, 0},
+		{"phrase", [&]{ return "\"" + vocab.at(common(rng)) + " " + vocab.at(common(rng)) + "\""; }, 0},
+		{"prefix", [&]{ return vocab.at(middling(rng)).substr(0, 4) + "*"; }, 0}
+	};
+
+	for(const Kind &kind : kinds){
+		Latencies latencies;
+		long long results = 0;
+
+		for(int i = 0; i < queries; ++i){
+			const std::string query = kind.query();
+
+			const Stopwatch watch;
+			results += db.search(chat.id, query, kind.offset, page).size();
+			latencies.add(watch.seconds());
+		}
+
+		report(kind.name, latencies, results);
+	}
+
+	return 0;
+}
@@ -12,30 +12,59 @@
 #define HEARTBEAT_FREQUENCY 7
 #define TIMEOUT_SECONDS (HEARTBEAT_FREQUENCY * 3)
 
+// how long the server keeps the session of a client that dropped off the network, for it to RESUME
+#define RESUME_SECONDS 60
+
 #define MAX_IMAGE_BYTES (6*1024*1024)
 #define MAX_FILE_BYTES (50*1024*1024)
 
+// IMAGE messages are sent with a thumbnail, which is all that goes out in backlogs and fan-out
+// the full image is fetched on demand with GET_FILE
+#define THUMBNAIL_PIXELS 100 // longest side
+#define MAX_THUMBNAIL_BYTES (64*1024)
+
+// most results a SEARCH can ask for at a time
+#define MAX_SEARCH_RESULTS 50
+
+// most messages a RANGE reply carries, the client asks again for the rest
+#define MAX_RANGE_MESSAGES 500
+
+// most file content one UPLOAD_DATA or FILE_DATA carries, other commands can go between them
+#define TRANSFER_SLICE_BYTES (64*1024)
+
 // command from the server
 enum class ServerCommand:std::uint8_t{
-	INTRODUCE, // introduction receipt
-	LIST_CHATS, // sending client list of chats
+	INTRODUCE, // introduction receipt, with a token the client can RESUME the session with later
+	LIST_CHATS, // sending client list of chats (only those newer than the client's directory version)
 	NEW_CHAT, // sending client receipt of new chat
 	SUBSCRIBE, // server is confirming successful subscription
 	MESSAGE, // server is sending a client a message
 	MESSAGE_RECEIPT, // server is sending success boolean for previous message
-	SEND_FILE, // server sending a file to the client
-	HEARTBEAT // server is sending a heartbeat to client
+	SEND_FILE, // server is about to send a file (or the rest of it, from where GET_FILE asked) in FILE_DATA slices, with its sha-256
+	HEARTBEAT, // server is sending a heartbeat to client
+	CHAT_CREATED, // server is telling the client that someone created a new chat
+	SEARCH_RESULTS, // server is sending one page of search results
+	RANGE, // server is sending messages the client asked for by id
+	RESUME, // server is telling the client if it got its old session back
+	UPLOAD, // server is telling the client how much of an UPLOAD it already has
+	FILE_DATA, // server is sending the next slice of the file from SEND_FILE
+	UPLOAD_RECEIPT // server is sending the success boolean for an UPLOAD, which other messages may have overtaken
 };
 
 // command from the client
 enum class ClientCommand:std::uint8_t{
 	INTRODUCE, // client wants to introduce himself
-	LIST_CHATS, // client wants the list of chats
+	LIST_CHATS, // client wants the chats created since the directory version it last saw
 	NEW_CHAT, // client wants to create a new chat
 	SUBSCRIBE, // client wants to subscribe to a chat
-	MESSAGE, // client is sending a message
-	GET_FILE, // client is requesting file from the server
-	HEARTBEAT // client is sending heartbeat to server
+	MESSAGE, // client is sending a message (IMAGE messages are followed by a thumbnail, which may be empty)
+	GET_FILE, // client is requesting file from the server, from an offset to pick up where a cut off one left off
+	HEARTBEAT, // client is sending heartbeat to server
+	SEARCH, // client is searching the chat it is subscribed to
+	GET_RANGE, // client is asking for messages it missed in the chat it is subscribed to
+	RESUME, // client has reconnected, and wants its session back instead of introducing and subscribing again
+	UPLOAD, // client wants to send a file or image (with its thumbnail) that can pick up where it left off if the connection goes
+	UPLOAD_DATA // client is sending the next slice of an UPLOAD, starting from where the server said it had got to
 };
 
 enum class MessageType:std::uint8_t{
@@ -119,7 +148,7 @@ struct Message{
 		return *this;
 	}
 
-	unsigned long long id;
+	unsigned long long id; // handed out in order with no gaps in each chat, so a skipped id is a missed message
 	MessageType type;
 	std::int32_t unixtime;
 	std::string msg;
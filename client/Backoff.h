@@ -0,0 +1,34 @@
+#ifndef BACKOFF_H
+#define BACKOFF_H
+
+#include <random>
+#include <algorithm>
+
+// how long a client waits before each attempt to reconnect to a server it lost
+// the waits grow exponentially up to a cap, and with <jitter> each one is picked at random between 0 and that ("full jitter"),
+// so clients that all lost the server at the same moment don't all come back at the same moment
+struct Backoff{
+	Backoff(unsigned b=250,double m=2.0,unsigned c=10000,bool j=true)
+	:base(b),multiplier(m),cap(c),jitter(j){}
+
+	// milliseconds to wait before attempt number <attempt>, counting from 0
+	template<typename Generator> unsigned delay(unsigned attempt,Generator &rng)const{
+		double ceiling=base;
+		for(unsigned i=0;i<attempt&&ceiling<cap;++i)
+			ceiling*=multiplier;
+		ceiling=std::min<double>(ceiling,cap);
+
+		if(!jitter)
+			return ceiling;
+
+		std::uniform_real_distribution<double> wait(0.0,ceiling);
+		return wait(rng);
+	}
+
+	unsigned base; // milliseconds before the first attempt (at most, with jitter)
+	double multiplier; // each attempt waits this much longer than the last
+	unsigned cap; // most milliseconds to wait
+	bool jitter;
+};
+
+#endif // BACKOFF_H
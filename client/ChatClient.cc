@@ -1,6 +1,12 @@
 #include "ChatClient.h"
 
-ChatClient::ChatClient(const std::string &dbpath):service(dbpath){
+// a client with a loop thread and local database of its own
+ChatClient::ChatClient(const std::string &dbpath):own(new ChatLoop(dbpath)),service(*own){
+}
+
+// one of any number of clients (connections, to the same server or others) sharing <loop>'s thread and local database
+// each one connect()s, subscribes and so on separately, and calls back from <loop>'s thread
+ChatClient::ChatClient(ChatLoop &loop):service(loop){
 }
 
 ChatClient::~ChatClient(){
@@ -10,6 +16,11 @@ bool ChatClient::connected()const{
 	return service.is_connected();
 }
 
+// how to space out attempts to reconnect after losing the server, see Backoff
+void ChatClient::set_backoff(const Backoff &policy){
+	service.set_backoff(policy);
+}
+
 // connect to server
 void ChatClient::connect(const std::string &target,const std::string &myname,std::function<void(bool,const std::string&)> callback){
 	auto unit=new ChatWorkUnitConnect(target,myname,callback);
@@ -17,8 +28,9 @@ void ChatClient::connect(const std::string &target,const std::string &myname,std
 }
 
 // refresh the chat list
-void ChatClient::list_chats(std::function<void(std::vector<Chat>)> fn){
-	auto unit=new ChatWorkUnitListChats(fn);
+// <created> (optional) is called whenever the server announces a newly created chat
+void ChatClient::list_chats(std::function<void(std::vector<Chat>)> fn,std::function<void(Chat)> created){
+	auto unit=new ChatWorkUnitListChats(fn,created);
 	service.add_work(unit);
 }
 
@@ -29,6 +41,8 @@ void ChatClient::newchat(const std::string &name,const std::string &desc,std::fu
 }
 
 // subscribe to a chat
+// <success_callback> gets the newest HISTORY_MESSAGES messages already stored for the chat, without images' thumbnails
+// (history() pages back from there, get_thumbnail() fills them in), then <msg_callback> gets everything the server sends
 void ChatClient::subscribe(const std::string &name,std::function<void(bool,std::vector<Message>)> success_callback,std::function<void(Message)> msg_callback){
 	auto unit=new ChatWorkUnitSubscribe(name,success_callback,msg_callback);
 	service.add_work(unit);
@@ -41,8 +55,10 @@ void ChatClient::send(const std::string &text, std::function<void(bool,const std
 }
 
 // send an image
-void ChatClient::send_image(const std::string &filename, unsigned char *buffer, int size, std::atomic<int> &percent, std::function<void(bool,const std::string&)> fn){
-	auto unit=new ChatWorkUnitMessage(MessageType::IMAGE, filename, buffer, size, &percent, fn);
+// other clients get <thumbnail> (at most THUMBNAIL_PIXELS on a side) until they ask for the full image with get_file()
+// it may be left empty for images no bigger than MAX_THUMBNAIL_BYTES, they are their own thumbnail
+void ChatClient::send_image(const std::string &filename, unsigned char *buffer, int size, const std::vector<unsigned char> &thumbnail, std::atomic<int> &percent, std::function<void(bool,const std::string&)> fn){
+	auto unit=new ChatWorkUnitMessage(MessageType::IMAGE, filename, buffer, size, &percent, fn, thumbnail);
 	service.add_work(unit);
 }
 
@@ -53,9 +69,64 @@ void ChatClient::send_file(const std::string &filename, unsigned char *buffer, i
 	service.add_work(unit);
 }
 
+// send the image at <path>, read from disk as it goes out instead of all at once
+// if the connection goes partway through, it picks up where it left off once it's back
+void ChatClient::send_image(const std::string &filename, const std::string &path, const std::vector<unsigned char> &thumbnail, std::atomic<int> &percent, std::function<void(bool,const std::string&)> fn){
+	percent.store(0);
+	auto unit=new ChatWorkUnitMessage(MessageType::IMAGE, filename, path, &percent, fn, thumbnail);
+	service.add_work(unit);
+}
+
+// send the file at <path> the same way, however big it is only a piece of it is ever in memory
+// it's measured when it's sent, <fn> hears about it if it can't be read or is bigger than MAX_FILE_BYTES
+void ChatClient::send_file(const std::string &filename, const std::string &path, std::atomic<int> &percent, std::function<void(bool,const std::string&)> fn){
+	percent.store(0);
+	auto unit=new ChatWorkUnitMessage(MessageType::FILE, filename, path, &percent, fn);
+	service.add_work(unit);
+}
+
+// search the subscribed chat, best matches first
+// <query> uses sqlite's fts5 syntax, e.g. words, "a phrase", prefix*, this AND that
+// results are paged, <offset> is how many to skip and <count> how many to get (at most MAX_SEARCH_RESULTS)
+// the text of each result is a snippet around the matching words, which are [bracketed]
+void ChatClient::search(const std::string &query, unsigned long long offset, unsigned count, std::function<void(bool,const std::string&,std::vector<Message>)> fn){
+	auto unit=new ChatWorkUnitSearch(query, offset, count, fn);
+	service.add_work(unit);
+}
+
+// the <count> messages of the subscribed chat that came before message id <before>, oldest first, from the local database
+// images come without their thumbnail, like the ones handed over with a subscribe
+void ChatClient::history(unsigned long long before, unsigned count, std::function<void(std::vector<Message>)> fn){
+	auto unit=new ChatWorkUnitHistory(before, count, fn);
+	service.add_work(unit);
+}
+
+// the stored thumbnail of image message <msgid> in the subscribed chat, empty if there isn't one
+void ChatClient::get_thumbnail(unsigned long long msgid, std::function<void(unsigned long long,std::vector<unsigned char>)> fn){
+	auto unit=new ChatWorkUnitThumbnail(msgid, fn);
+	service.add_work(unit);
+}
+
 // request a file from the server
 void ChatClient::get_file(unsigned long long msgid, std::atomic<int> &percent, std::function<void(const unsigned char*,int)> fn){
 	percent.store(0);
 	auto unit=new ChatWorkUnitGetFile(msgid, &percent, fn);
 	service.add_work(unit);
 }
+
+// request a file from the server, handed to <sink> a piece at a time as it arrives rather than all at once
+// <sink> returns false to give up on the rest, then <done> says whether all of it made it to <sink>
+void ChatClient::get_file(unsigned long long msgid, std::atomic<int> &percent, std::function<bool(const unsigned char*,int)> sink, std::function<void(bool)> done){
+	percent.store(0);
+	auto unit=new ChatWorkUnitGetFile(msgid, &percent, sink, done);
+	service.add_work(unit);
+}
+
+// request a file from the server and write it to <path> as it arrives
+// it goes to <path>.part until it's all there, if the connection goes (or the program does) the next try picks up from there
+// <fn> says whether it all made it and matched the server's sha-256, if not there's nothing left at <path>
+void ChatClient::get_file(unsigned long long msgid, const std::string &path, std::atomic<int> &percent, std::function<void(bool)> fn){
+	percent.store(0);
+	auto unit=new ChatWorkUnitGetFile(msgid, path, &percent, fn);
+	service.add_work(unit);
+}
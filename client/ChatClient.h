@@ -5,7 +5,9 @@
 #include <functional>
 #include <vector>
 #include <atomic>
+#include <memory>
 
+#include "ChatLoop.h"
 #include "ChatService.h"
 
 #ifdef _WIN32
@@ -15,18 +17,28 @@ class ChatClient{
 #endif // _WIN32
 public:
 	ChatClient(const std::string&);
+	explicit ChatClient(ChatLoop&);
 	~ChatClient();
 	bool connected()const;
+	void set_backoff(const Backoff&);
 	void connect(const std::string&,const std::string&,std::function<void(bool,const std::string&)>);
-	void list_chats(std::function<void(std::vector<Chat>)>);
+	void list_chats(std::function<void(std::vector<Chat>)>,std::function<void(Chat)> = nullptr);
 	void newchat(const std::string&,const std::string&,std::function<void(bool)>);
 	void subscribe(const std::string&,std::function<void(bool,std::vector<Message>)>,std::function<void(Message)>);
 	void send(const std::string&, std::function<void(bool,const std::string&)> fn);
-	void send_image(const std::string&, unsigned char*, int, std::atomic<int> &percent, std::function<void(bool,const std::string&)> fn);
+	void send_image(const std::string&, unsigned char*, int, const std::vector<unsigned char>&, std::atomic<int> &percent, std::function<void(bool,const std::string&)> fn);
 	void send_file(const std::string&, unsigned char*, int, std::atomic<int> &percent, std::function<void(bool,const std::string&)> fn);
+	void send_image(const std::string&, const std::string&, const std::vector<unsigned char>&, std::atomic<int> &percent, std::function<void(bool,const std::string&)> fn);
+	void send_file(const std::string&, const std::string&, std::atomic<int> &percent, std::function<void(bool,const std::string&)> fn);
 	void get_file(unsigned long long, std::atomic<int>&, std::function<void(const unsigned char*,int)>);
+	void get_file(unsigned long long, std::atomic<int>&, std::function<bool(const unsigned char*,int)>, std::function<void(bool)>);
+	void get_file(unsigned long long, const std::string&, std::atomic<int>&, std::function<void(bool)>);
+	void search(const std::string&, unsigned long long, unsigned, std::function<void(bool,const std::string&,std::vector<Message>)>);
+	void history(unsigned long long, unsigned, std::function<void(std::vector<Message>)>);
+	void get_thumbnail(unsigned long long, std::function<void(unsigned long long,std::vector<unsigned char>)>);
 
 private:
+	std::unique_ptr<ChatLoop> own; // the loop of a client made with a database path, which has it to itself
 	ChatService service;
 };
 
@@ -0,0 +1,117 @@
+#include <algorithm>
+#include <chrono>
+
+#include "ChatLoop.h"
+#include "ChatService.h"
+#include "log.h"
+
+ChatLoop::ChatLoop(const std::string &dbpath):
+	db(dbpath),
+	working(true),
+	handle(&ChatLoop::loop,this),
+	maintenance(&ChatLoop::maintain,this)
+{
+}
+
+ChatLoop::~ChatLoop(){
+	{
+		std::lock_guard<std::mutex> lock(maintenance_mutex);
+		working.store(false);
+	}
+	maintenance_cvar.notify_one();
+	wake.notify();
+
+	handle.join();
+	maintenance.join();
+}
+
+// accessed from multiple threads
+// <service> is looked after from the next time around the loop
+void ChatLoop::add(ChatService *service){
+	std::lock_guard<std::mutex> lock(services_lock);
+	services.push_back(service);
+	wake.notify();
+}
+
+// accessed from multiple threads, but never the loop thread (from a callback, say), which it waits on
+// once it returns the loop thread won't touch <service> again
+void ChatLoop::remove(ChatService *service){
+	std::unique_lock<std::mutex> lock(services_lock);
+	leaving.push_back(service);
+	wake.notify();
+
+	left.wait(lock,[this,service]{
+		return std::find(services.begin(),services.end(),service)==services.end();
+	});
+}
+
+// entry point for the loop thread
+// each time around, every connection gets to process one unit of work, then they all wait on their sockets together
+void ChatLoop::loop(){
+	net::poller poller;
+
+	while(working.load()){
+		// cleared before looking for work, work that comes in after this wakes the poll below
+		wake.clear();
+
+		std::vector<ChatService*> current;
+		{
+			std::lock_guard<std::mutex> lock(services_lock);
+			if(!leaving.empty()){
+				for(ChatService *service:leaving)
+					services.erase(std::remove(services.begin(),services.end(),service),services.end());
+				leaving.clear();
+				left.notify_all();
+			}
+
+			current=services;
+		}
+
+		// a unit at a time from each, so one with a lot queued doesn't hold up the others
+		bool busy=false;
+		for(ChatService *service:current)
+			busy=service->work()||busy;
+
+		// don't sleep while there's work left, otherwise until something happens or the soonest timer is due
+		poller.clear();
+		poller.add(wake);
+		int timeout=busy?0:-1;
+		for(ChatService *service:current){
+			service->watch(poller);
+
+			const int due=service->due();
+			if(due>=0&&(timeout<0||due<timeout))
+				timeout=due;
+		}
+
+		poller.wait(timeout);
+
+		for(ChatService *service:current)
+			service->io(poller);
+	}
+
+	// nothing is looked after any more, don't leave anyone waiting in remove()
+	std::lock_guard<std::mutex> lock(services_lock);
+	services.clear();
+	leaving.clear();
+	left.notify_all();
+}
+
+// maintenance thread, every CACHE_MAINTENANCE_SECONDS until the loop shuts down
+// nothing the user is waiting on (a subscribe, say) has to wait for the cache to be cleaned up
+void ChatLoop::maintain(){
+	std::unique_lock<std::mutex> lock(maintenance_mutex);
+
+	while(!maintenance_cvar.wait_for(lock,std::chrono::seconds(CACHE_MAINTENANCE_SECONDS),[this]{ return !working.load(); })){
+		lock.unlock();
+
+		// not just sqlite's, anything that got out of this thread would take the user's program down with it
+		try{
+			db.maintain(working);
+		}catch(const std::exception &e){
+			log_error(std::string("cache maintenance: ")+e.what());
+		}
+
+		lock.lock();
+	}
+}
@@ -0,0 +1,54 @@
+#ifndef CHATLOOP_H
+#define CHATLOOP_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+#include "network.h"
+#include "Database.h"
+
+// how often the local database is cleaned up, see Database::maintain()
+#define CACHE_MAINTENANCE_SECONDS 120
+
+class ChatService;
+
+// one thread that looks after any number of connections (ChatServices, one per ChatClient) to any number of servers
+// they share it and the local database, so each one costs a socket and its state rather than a thread
+// every ChatClient made with it has to be gone before it is
+#ifdef _WIN32
+class __declspec(dllexport) ChatLoop{
+#else
+class ChatLoop{
+#endif // _WIN32
+public:
+	explicit ChatLoop(const std::string&);
+	ChatLoop(const ChatLoop&)=delete;
+	~ChatLoop();
+	ChatLoop &operator=(const ChatLoop&)=delete;
+
+private:
+	friend class ChatService;
+
+	void add(ChatService*);
+	void remove(ChatService*);
+	void loop();
+	void maintain();
+
+	Database db;
+	net::wakeup wake; // notified whenever any of the connections has work, or one is leaving
+	std::atomic<bool> working; // loop thread currently running
+	std::vector<ChatService*> services;
+	std::vector<ChatService*> leaving; // waiting on the loop thread to let go of them, see remove()
+	std::mutex services_lock; // guards <services> and <leaving>
+	std::condition_variable left; // the loop thread has let go of <leaving>
+	std::mutex maintenance_mutex;
+	std::condition_variable maintenance_cvar; // wakes the maintenance thread early to shut down
+	std::thread handle;
+	std::thread maintenance; // keeps the local database in check, off the loop thread
+};
+
+#endif // CHATLOOP_H
@@ -1,24 +1,48 @@
 #include <chrono>
+#include <algorithm>
 #include <climits>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
 
 #include <time.h>
 
 #include "ChatService.h"
+#include "sha256.h"
 #include "log.h"
 
-ChatService::ChatService(const std::string &dbpath):
-	db(dbpath),
-	working(true),
+ChatService::ChatService(ChatLoop &l):
+	loop(l),
+	db(l.db),
+	link(Link::OFFLINE),
+	reconnecting(false),
+	attempts(0),
+	polled(-1),
+	flushed(0),
+	consumed(0),
+	command(0),
 	connected(false),
+	chats_version(0),
+	last_id(0),
+	subscribing(false),
+	resyncing(false),
+	work_queue(l.wake),
 	last_heartbeat(0),
-	handle(std::ref(*this))
+	rng(std::random_device{}())
 {
-	callback.percent = NULL;
+	upload.sending = false;
+	upload.stalled = false;
+	partial.offset = 0;
+
+	loop.add(this);
 }
 
 ChatService::~ChatService(){
-	working.store(false);
-	handle.join();
+	loop.remove(this);
+
+	const int leftover = work_queue.count();
+	if(leftover>0)
+		log_error(std::string("shutting down with ")+std::to_string(leftover)+" commands left in the queue!");
 }
 
 // accessed from multiple threads
@@ -27,77 +51,22 @@ void ChatService::add_work(const ChatWorkUnit *unit){
 	work_queue.push(unit);
 }
 
-// entry point for the worker thread
-void ChatService::operator()(){
-	try{
-		loop();
-	}catch(const NetworkException &e){
-		connected.store(false);
-		reconnect();
-		connected.store(true);
-		// recurse
-		this->operator()();
-	}catch(const ShutdownException &e){
-		const int leftover = work_queue.count();
-
-		if(leftover>0)
-			log_error(std::string("shutting down with ")+std::to_string(leftover)+" commands left in the queue!");
-	}
-	catch(const lite3::exception &e){
-		log_error(e.what());
-		// recurse
-		this->operator()();
-	}
-
-	connected.store(false);
-}
-
-void ChatService::send(const void *data,int size,std::atomic<int> *percent){
-	int sent=0;
-	while(sent!=size){
-		const int sendblock = 4096;
-		const int sendcap = size - sent > sendblock ? sendblock : (size - sent);
-		sent+=tcp.send_nonblock((char*)data+sent,sendcap);
-
-		if(!tcp){
-			if(percent != NULL)
-				percent->store(-1);
-			throw NetworkException();
-		}
-
-		if(!working.load()){
-			if(percent != NULL)
-				percent->store(-1);
-			throw ShutdownException();
-		}
+// queue <data> to go out once the socket will take it, see flush()
+void ChatService::send(const void *data,int size){
+	if(!tcp)
+		throw NetworkException();
 
-		// update percent
-		if(percent != NULL)
-			percent->store(((float)sent / size) * 100);
-	}
+	const unsigned char *const bytes=(const unsigned char*)data;
+	outbox.insert(outbox.end(),bytes,bytes+size);
 }
 
-void ChatService::recv(void *data,int size,std::atomic<int> *percent){
-	int got=0;
-	while(got!=size){
-		got+=tcp.recv_nonblock((char*)data+got,size-got);
-
-		if(!tcp){
-			if(percent != NULL)
-				percent->store(-1);
-			throw NetworkException();
-		}
-
-		if(!working.load()){
-			if(percent != NULL)
-				percent->store(-1);
-			throw ShutdownException();
-		}
+// the next <size> bytes of the command being handled, see receive()
+void ChatService::recv(void *data,int size){
+	if(inbox.size()-consumed<(size_t)size)
+		throw IncompleteException();
 
-		// update percent
-		if(percent != NULL)
-			percent->store(((float)got / size) * 100);
-	}
+	memcpy(data,inbox.data()+consumed,size);
+	consumed+=size;
 }
 
 // send a string on the network
@@ -117,63 +86,236 @@ std::string ChatService::get_string(){
 	recv(&size,sizeof(size));
 
 	// get the string
-	std::vector<char> raw(size+1);
-	recv(&raw[0],size);
-	raw[size]=0;
+	if(inbox.size()-consumed<size)
+		throw IncompleteException();
+
+	const std::string str((const char*)inbox.data()+consumed,size);
+	consumed+=size;
 
-	return {&raw[0]};
+	return str;
 }
 
 bool ChatService::is_connected()const{
 	return connected.load();
 }
 
-// work unit loop
-void ChatService::loop(){
-	while(working.load()){
-		// process work units
-		const ChatWorkUnit *unit = work_queue.pop_wait(200);
-		if(unit!=NULL){
-			switch(unit->type){
-			case WorkUnitType::CONNECT:
-				process_connect(*dynamic_cast<const ChatWorkUnitConnect*>(unit));
-				break;
-			case WorkUnitType::LIST_CHATS:
-				process_list_chats(*dynamic_cast<const ChatWorkUnitListChats*>(unit));
-				break;
-			case WorkUnitType::NEW_CHAT:
-				process_newchat(*dynamic_cast<const ChatWorkUnitNewChat*>(unit));
-				break;
-			case WorkUnitType::SUBSCRIBE:
-				process_subscribe(*dynamic_cast<const ChatWorkUnitSubscribe*>(unit));
-				break;
-			case WorkUnitType::MESSAGE:
-				process_send_message(*dynamic_cast<const ChatWorkUnitMessage*>(unit));
-				break;
-			case WorkUnitType::GET_FILE:
-				process_get_file(*dynamic_cast<const ChatWorkUnitGetFile*>(unit));
-				break;
-			}
+// change how reconnects are spaced out, takes effect the next time the connection is lost
+void ChatService::set_backoff(const Backoff &policy){
+	std::lock_guard<std::mutex> lock(backoff_lock);
+	backoff=policy;
+}
 
-			// unit was processed successfully
-			delete unit;
-		}
+// process the next unit of work, if there is one and the connection can take it
+// returns true if there's more waiting
+bool ChatService::work(){
+	// finding (or finding the way back to) the server, everything waits until it's there
+	if(link==Link::CONNECTING||link==Link::WAITING)
+		return false;
+
+	const std::unique_ptr<const ChatWorkUnit> unit(work_queue.pop());
+	if(!unit)
+		return false;
+
+	try{
+		process(*unit);
+	}catch(const NetworkException &e){
+		lost();
+	}catch(const lite3::exception &e){
+		log_error(e.what());
+	}
 
-		// if connected
-		if(tcp){
+	return (link==Link::UP||link==Link::OFFLINE)&&work_queue.count()>0;
+}
+
+// add the socket to what ChatLoop waits on, if there's anything to wait for
+void ChatService::watch(net::poller &poller){
+	switch(link){
+	case Link::UP:
+		polled=poller.add(tcp,net::READABLE|(pending()>0?net::WRITABLE:0));
+		break;
+	case Link::CONNECTING:
+		// writable once it has connected, or failed to
+		polled=poller.add(tcp,net::WRITABLE);
+		break;
+	default:
+		polled=-1;
+	}
+}
+
+// whatever the connection needs doing after ChatLoop's wait
+void ChatService::io(const net::poller &poller){
+	const int events=poller.events(polled);
+	polled=-1;
+
+	try{
+		switch(link){
+		case Link::OFFLINE:
+			break;
+		case Link::WAITING:
+			if(std::chrono::steady_clock::now()>=next)
+				attempt();
+			break;
+		case Link::CONNECTING:
+			if(events!=0){
+				if(tcp.connect())
+					established();
+				else
+					attempt_failed();
+			}
+			else if(std::chrono::steady_clock::now()>=deadline)
+				attempt_failed();
+			break;
+		case Link::UP:
 			// see if the server has anything to say
-			recv_server_cmd();
+			if(events&net::READABLE)
+				receive();
 
 			// maybe send a heartbeat
 			heartbeat();
+
+			flush();
+
+			// the socket has taken most of the last slice of an upload, on to the next
+			if(upload.stalled&&pending()<TRANSFER_SLICE_BYTES){
+				upload.stalled=false;
+				if(upload.sending&&!uploads.empty())
+					add_work(new ChatWorkUnitSlice(uploads.front()->transfer,upload.sent));
+			}
+			break;
 		}
+	}catch(const NetworkException &e){
+		lost();
 	}
 }
 
-void ChatService::recv_server_cmd(){
-	if(tcp.peek()<sizeof(ServerCommand))
-		return;
+// milliseconds until io() has something to do without hearing from the socket, -1 if never
+int ChatService::due()const{
+	const auto until=[](std::chrono::steady_clock::time_point when){
+		const auto left=std::chrono::duration_cast<std::chrono::milliseconds>(when-std::chrono::steady_clock::now()).count();
+		return left>0?(int)std::min<long long>(left,INT_MAX):0;
+	};
+
+	switch(link){
+	case Link::UP:
+		return heartbeat_due();
+	case Link::CONNECTING:
+		return until(deadline);
+	case Link::WAITING:
+		return until(next);
+	default:
+		return -1;
+	}
+}
+
+void ChatService::process(const ChatWorkUnit &unit){
+	switch(unit.type){
+	case WorkUnitType::CONNECT:
+		process_connect(dynamic_cast<const ChatWorkUnitConnect&>(unit));
+		break;
+	case WorkUnitType::LIST_CHATS:
+		process_list_chats(dynamic_cast<const ChatWorkUnitListChats&>(unit));
+		break;
+	case WorkUnitType::NEW_CHAT:
+		process_newchat(dynamic_cast<const ChatWorkUnitNewChat&>(unit));
+		break;
+	case WorkUnitType::SUBSCRIBE:
+		process_subscribe(dynamic_cast<const ChatWorkUnitSubscribe&>(unit));
+		break;
+	case WorkUnitType::MESSAGE:
+		process_send_message(dynamic_cast<const ChatWorkUnitMessage&>(unit));
+		break;
+	case WorkUnitType::GET_FILE:
+		process_get_file(dynamic_cast<const ChatWorkUnitGetFile&>(unit));
+		break;
+	case WorkUnitType::SEARCH:
+		process_search(dynamic_cast<const ChatWorkUnitSearch&>(unit));
+		break;
+	case WorkUnitType::HISTORY:
+		process_history(dynamic_cast<const ChatWorkUnitHistory&>(unit));
+		break;
+	case WorkUnitType::THUMBNAIL:
+		process_thumbnail(dynamic_cast<const ChatWorkUnitThumbnail&>(unit));
+		break;
+	case WorkUnitType::SLICE:
+		process_slice(dynamic_cast<const ChatWorkUnitSlice&>(unit));
+		break;
+	}
+}
+
+// hand the socket as much of <outbox> as it will take
+void ChatService::flush(){
+	while(flushed<outbox.size()){
+		const int n=tcp.send_nonblock(outbox.data()+flushed,outbox.size()-flushed);
+		if(!tcp)
+			throw NetworkException();
+		if(n==0)
+			break;
+
+		flushed+=n;
+	}
+
+	// let go of what has gone, all at once when it can be, so the rest isn't moved every time
+	if(flushed==outbox.size()){
+		outbox.clear();
+		flushed=0;
+	}
+	else if(flushed>outbox.size()/2){
+		outbox.erase(outbox.begin(),outbox.begin()+flushed);
+		flushed=0;
+	}
+}
+
+// read what the server has sent, then handle every command that's all there
+void ChatService::receive(){
+	for(size_t budget=0;budget<RECV_BUDGET_BYTES;){
+		const size_t have=inbox.size();
+		inbox.resize(have+TRANSFER_SLICE_BYTES);
+		const int n=tcp.recv_nonblock(inbox.data()+have,TRANSFER_SLICE_BYTES);
+		inbox.resize(have+n);
+
+		if(!tcp)
+			throw NetworkException();
 
+		// readable with nothing to read means the server hung up
+		if(n==0&&budget==0){
+			tcp.close();
+			throw NetworkException();
+		}
+		if(n==0)
+			break;
+
+		budget+=n;
+	}
+
+	while(inbox.size()-consumed>=sizeof(ServerCommand)){
+		const size_t start=consumed;
+		command=start;
+
+		try{
+			recv_server_cmd();
+		}catch(const IncompleteException &e){
+			// once the rest is here it's read again from the start, see the note in recv_server_cmd()
+			// (long lists of messages pick up where they left off, see recv_messages())
+			consumed=start;
+			break;
+		}catch(const lite3::exception &e){
+			log_error(e.what());
+		}
+	}
+
+	inbox.erase(inbox.begin(),inbox.begin()+consumed);
+	consumed=0;
+}
+
+// bytes sent that the socket hasn't taken yet
+unsigned long long ChatService::pending()const{
+	return outbox.size()-flushed;
+}
+
+// handle the server command at the front of <inbox>
+// a command that isn't all there yet is given up on at the first read that comes up short, and handled again later,
+// so the servercmd_* functions read all of it before they change anything
+void ChatService::recv_server_cmd(){
 	ServerCommand type;
 	recv(&type,sizeof(type));
 
@@ -202,6 +344,27 @@ void ChatService::recv_server_cmd(){
 	case ServerCommand::HEARTBEAT:
 		// ignore
 		break;
+	case ServerCommand::CHAT_CREATED:
+		servercmd_chat_created();
+		break;
+	case ServerCommand::SEARCH_RESULTS:
+		servercmd_search_results();
+		break;
+	case ServerCommand::RANGE:
+		servercmd_range();
+		break;
+	case ServerCommand::RESUME:
+		servercmd_resume();
+		break;
+	case ServerCommand::UPLOAD:
+		servercmd_upload();
+		break;
+	case ServerCommand::FILE_DATA:
+		servercmd_file_data();
+		break;
+	case ServerCommand::UPLOAD_RECEIPT:
+		servercmd_upload_receipt();
+		break;
 	default:
 		// illegal
 		log_error(std::string("received an illegal command from the server: ")+std::to_string(static_cast<uint8_t>(type)));
@@ -222,76 +385,162 @@ void ChatService::heartbeat(){
 	}
 }
 
-// try to reconnect
-void ChatService::reconnect(){
-	try{
-		log_error("lost connection! attempting to reconnect");
+// milliseconds until heartbeat() will send the next one
+int ChatService::heartbeat_due()const{
+	const time_t current=time(NULL);
+	if(last_heartbeat>current)
+		return 0;
 
-		tcp.target(target,CHAT_PORT);
+	const time_t due=last_heartbeat+HEARTBEAT_FREQUENCY+1;
+	return due>current?(due-current)*1000:0;
+}
 
-		bool reconnected=false;
-		while(!reconnected){
-			reconnected=tcp.connect();
+// try connecting again, the socket may still be working on the last try
+void ChatService::attempt(){
+	if(!tcp&&!tcp.target(target,CHAT_PORT)){
+		attempt_failed();
+		return;
+	}
 
-			// see if services needs to shut down
-			if(!working.load())
-				throw ShutdownException();
+	// a reconnect gives each attempt a while, a connect has CONNECT_SECONDS for all of them
+	if(reconnecting)
+		deadline=std::chrono::steady_clock::now()+std::chrono::seconds(RECONNECT_ATTEMPT_SECONDS);
 
-			// don't burn out the cpu
-			std::this_thread::sleep_for(std::chrono::milliseconds(50));
-		}
+	if(tcp.connect())
+		established();
+	else
+		link=Link::CONNECTING;
+}
+
+// the socket has connected
+void ChatService::established(){
+	link=Link::UP;
+	connected.store(true);
+
+	if(!reconnecting){
+		// introduce myself
+		clientcmd_introduce();
+		return;
+	}
 
-		// reconnect to the server
-		auto unit=new ChatWorkUnitConnect(target,name,callback.connect);
-		add_work(unit);
-		// resubscribe, if necessary
-		if(chatname!=""){
-			auto unit2=new ChatWorkUnitSubscribe(chatname,[](bool,std::vector<Message>){},callback.message);
-			add_work(unit2);
+	reconnecting=false;
+
+	// the server may still have the session, which saves introducing and subscribing all over again
+	if(token!="")
+		clientcmd_resume();
+	else
+		reintroduce();
+
+	log("reconnected successfully");
+}
+
+// the socket didn't connect, or didn't in time
+void ChatService::attempt_failed(){
+	const auto now=std::chrono::steady_clock::now();
+
+	if(reconnecting){
+		// if the server went down, everyone else lost it too, don't all come back at once
+		Backoff policy;
+		{
+			std::lock_guard<std::mutex> lock(backoff_lock);
+			policy=backoff;
 		}
 
-		log("reconnected successfully");
-	}catch(const ShutdownException &e){}
+		link=Link::WAITING;
+		next=now+std::chrono::milliseconds(policy.delay(attempts++,rng));
+		return;
+	}
+
+	if(now<deadline){
+		link=Link::WAITING;
+		next=now+std::chrono::milliseconds(CONNECT_RETRY_MILLIS);
+		return;
+	}
+
+	link=Link::OFFLINE;
+	tcp.close();
+	callback.connect(false,{});
+}
+
+// the connection went, start finding the way back
+void ChatService::lost(){
+	connected.store(false);
+	tcp.close();
+	outbox.clear();
+	flushed=0;
+	inbox.clear();
+	consumed=0;
+	partial.offset=0;
+	partial.msgs.clear();
+
+	// nowhere to go back to
+	if(target==""){
+		link=Link::OFFLINE;
+		return;
+	}
+
+	log_error("lost connection! attempting to reconnect");
+
+	// whatever was on its way went with the connection, see retry_transfers()
+	upload.sending=false;
+	upload.stalled=false;
+	forget_receipts();
+
+	reconnecting=true;
+	attempts=0;
+	attempt_failed();
+}
+
+// start over with the server, as if connecting for the first time
+void ChatService::reintroduce(){
+	// reconnect to the server
+	auto unit=new ChatWorkUnitConnect(target,name,callback.connect);
+	add_work(unit);
+	// resubscribe, if necessary
+	if(chatname!=""){
+		auto unit2=new ChatWorkUnitSubscribe(chatname,[](bool,std::vector<Message>){},callback.message,true);
+		add_work(unit2);
+	}
+	// then anything that was on its way to or from disk
+	retry_transfers();
 }
 
 // connect the client to server
+// the socket is left to connect on its own, see io()
 void ChatService::process_connect(const ChatWorkUnitConnect &unit){
 	callback.connect=unit.callback;
 
 	// store this for later
 	target=unit.target;
+	name=unit.myname;
 
-	// connect to server
-	if(tcp.target(unit.target,CHAT_PORT)){
-		time_t current=time(NULL);
-		bool success=false;
-		// 5 second timeout
-		while(time(NULL)-current<5&&!success){
-			success=tcp.connect();
-			std::this_thread::sleep_for(std::chrono::milliseconds(5));
-		}
-
-		if(success){
-			// introduce myself
-			connected.store(true);
-			name=unit.myname;
-			clientcmd_introduce();
-		}
-		else{
-			unit.callback(false,{});
-			tcp.close();
-		}
-	}
-	else{
+	// whatever was left of an earlier connection
+	connected.store(false);
+	outbox.clear();
+	flushed=0;
+	inbox.clear();
+	consumed=0;
+	partial.offset=0;
+	partial.msgs.clear();
+	reconnecting=false;
+
+	if(!tcp.target(unit.target,CHAT_PORT)){
+		link=Link::OFFLINE;
 		unit.callback(false,{});
 		tcp.close();
+		return;
 	}
+
+	deadline=std::chrono::steady_clock::now()+std::chrono::seconds(CONNECT_SECONDS);
+	attempt();
 }
 
 // refresh the chat list for the user
 void ChatService::process_list_chats(const ChatWorkUnitListChats &unit){
 	callback.chatlist=unit.callback;
-	clientcmd_list_chats();
+	if(unit.created)
+		callback.chat_created=unit.created;
+	clientcmd_list_chats(chats_version);
 }
 
 // ask the server to create new chat
@@ -304,24 +553,225 @@ void ChatService::process_newchat(const ChatWorkUnitNewChat &unit){
 void ChatService::process_subscribe(const ChatWorkUnitSubscribe &unit){
 	callback.subscribe=unit.callback;
 	callback.message=unit.msg_callback;
-	clientcmd_subscribe(unit.name,db.get_latest_msg(unit.name));
+	clientcmd_subscribe(unit.name,db.get_latest_msg(servername,unit.name));
 	chatname=unit.name; // store chatname for later
+	subscribing=true;
 }
 
 // send a message
+// files and images wait their turn to go as an upload, see start_upload()
 void ChatService::process_send_message(const ChatWorkUnitMessage &unit){
-	callback.receipt=unit.callback;
-	callback.percent=unit.percent;
+	if(unit.type!=MessageType::TEXT){
+		uploads.emplace_back(new ChatWorkUnitMessage(unit));
+		if(uploads.size()==1)
+			start_upload();
+
+		return;
+	}
+
+	callback.receipts.push(unit.callback);
 
 	Message msg(0,unit.type,0,unit.text,name,unit.raw,unit.raw_size);
-	clientcmd_message(msg);
+	clientcmd_message(msg,unit.thumbnail);
 }
 
-// request a file from the server
+// send the slice of the upload at the front of <uploads> that <unit> is for, then queue the next
+// slices of an upload that has since been given up on, or started over, are let go
+void ChatService::process_slice(const ChatWorkUnitSlice &unit){
+	if(!upload.sending||uploads.empty()||uploads.front()->transfer!=unit.transfer||upload.sent!=unit.offset)
+		return;
+
+	const ChatWorkUnitMessage &front=*uploads.front();
+	const unsigned length=std::min<unsigned long long>(upload.size-upload.sent,TRANSFER_SLICE_BYTES);
+
+	std::unique_ptr<char[]> buffer;
+	const void *data=front.raw+upload.sent;
+	if(!front.path.empty()){
+		buffer.reset(new char[length]);
+		data=buffer.get();
+
+		// the file shrank after it was measured, the server lets go of what it has once the next upload is announced
+		if(!upload.file.read(buffer.get(),length)){
+			finish_upload(false,"The file changed while it was being sent");
+			return;
+		}
+	}
+
+	clientcmd_upload_data(front.transfer,upload.sent,data,length);
+	upload.sent+=length;
+
+	if(front.percent!=NULL)
+		front.percent->store(upload.size>0?((double)upload.sent/upload.size)*100:100);
+
+	// no more of the file is read than the socket is ready for, the next slice waits until it has taken most of this one
+	flush();
+
+	// the last one is followed by the server's UPLOAD_RECEIPT
+	if(upload.sent<upload.size){
+		if(pending()<TRANSFER_SLICE_BYTES)
+			add_work(new ChatWorkUnitSlice(front.transfer,upload.sent));
+		else
+			upload.stalled=true;
+	}
+	else{
+		upload.sending=false;
+		upload.file.close();
+	}
+}
+
+// announce the upload at the front of <uploads>, the server answers with how much of it it has already (see servercmd_upload())
+// a retry (see retry_transfers()) keeps the transfer id, so the server can pick up where the last try got to
+void ChatService::start_upload(){
+	ChatWorkUnitMessage &unit=*uploads.front();
+	if(unit.transfer.empty())
+		unit.transfer=new_transfer();
+
+	upload.sending=false;
+	upload.stalled=false;
+	upload.sent=0;
+	upload.file.close();
+
+	// measured every time it's sent, a file that changed in between has a different hash and starts over
+	if(unit.path.empty()){
+		upload.size=unit.raw_size;
+		upload.hash=SHA256::hex(unit.raw,unit.raw_size);
+	}
+	else if(!ChatService::digest(unit.path,upload.hash,upload.size)){
+		finish_upload(false,"Couldn't read \""+unit.path+"\"");
+		return;
+	}
+
+	// don't bother the server with something it would refuse anyway
+	if(upload.size>(unit.type==MessageType::IMAGE?MAX_IMAGE_BYTES:MAX_FILE_BYTES)){
+		finish_upload(false,"\""+unit.text+"\" is too big to send");
+		return;
+	}
+
+	clientcmd_upload(unit,upload.size,upload.hash);
+}
+
+// the upload at the front of <uploads> is done with one way or another, tell the user and start on the next
+void ChatService::finish_upload(bool worked,const std::string &err){
+	const std::unique_ptr<ChatWorkUnitMessage> unit=std::move(uploads.front());
+	uploads.pop_front();
+
+	upload.sending=false;
+	upload.stalled=false;
+	upload.file.close();
+
+	// content sent from memory was handed over with the unit
+	delete[] unit->raw;
+
+	if(!worked&&unit->percent!=NULL)
+		unit->percent->store(-1);
+	if(unit->callback)
+		unit->callback(worked,err);
+
+	if(!uploads.empty())
+		start_upload();
+}
+
+// the connection went before transfers were done, send them again to pick up where they left off
+// called once the session is back (or has been started over), the work queue sends them after whatever it needs first
+void ChatService::retry_transfers(){
+	// the server has the front upload spooled, and hasn't heard of the rest
+	for(std::unique_ptr<ChatWorkUnitMessage> &unit:uploads)
+		add_work(unit.release());
+	uploads.clear();
+	upload.file.close();
+
+	// what made it of a download to disk is in its .part file, the others have had part of theirs handed over already
+	if(incoming.unit){
+		std::unique_ptr<ChatWorkUnitGetFile> unit=std::move(incoming.unit);
+		incoming.part.close();
+		incoming.buffer=std::vector<unsigned char>();
+
+		if(!unit->path.empty())
+			add_work(unit.release());
+		else
+			fail_download(*unit);
+	}
+
+	// the server never got to these
+	while(!downloads.empty()){
+		add_work(downloads.front().release());
+		downloads.pop();
+	}
+}
+
+// text messages that went with the connection won't get a receipt, the server may or may not have had them
+void ChatService::forget_receipts(){
+	while(!callback.receipts.empty()){
+		const std::function<void(bool,const std::string&)> fn=std::move(callback.receipts.front());
+		callback.receipts.pop();
+
+		if(fn)
+			fn(false,"The connection was lost before the server answered, the message may not have gone through.");
+	}
+}
+
+// 128 random bits, as hex, to name an upload by
+std::string ChatService::new_transfer(){
+	char buffer[33];
+	std::snprintf(buffer,sizeof(buffer),"%08x%08x%08x%08x",(unsigned)rng(),(unsigned)rng(),(unsigned)rng(),(unsigned)rng());
+
+	return buffer;
+}
+
+// sha-256 and size of the file at <path>, false if it can't all be read
+bool ChatService::digest(const std::string &path,std::string &hash,unsigned long long &size){
+	std::ifstream in(path,std::ifstream::binary);
+	std::unique_ptr<char[]> buffer(new char[TRANSFER_SLICE_BYTES]);
+
+	SHA256 sha;
+	size=0;
+	while(in){
+		in.read(buffer.get(),TRANSFER_SLICE_BYTES);
+		sha.update(buffer.get(),in.gcount());
+		size+=in.gcount();
+	}
+
+	hash=sha.hex();
+	return in.eof();
+}
+
+// request a file from the server, it sends them in the order they were asked for
 void ChatService::process_get_file(const ChatWorkUnitGetFile &unit){
-	callback.file=unit.callback;
-	callback.percent=unit.percent;
-	clientcmd_get_file(unit.id);
+	// downloads to disk go to <path>.part first, and pick up from however much of it is there
+	std::streamoff have=0;
+	if(!unit.path.empty()){
+		std::ifstream part(unit.path+".part",std::ifstream::binary|std::ifstream::ate);
+		have=part?(std::streamoff)part.tellg():0;
+	}
+
+	downloads.emplace(new ChatWorkUnitGetFile(unit));
+	clientcmd_get_file(unit.id,have>0?have:0);
+}
+
+// search the subscribed chat
+void ChatService::process_search(const ChatWorkUnitSearch &unit){
+	callback.search=unit.callback;
+	clientcmd_search(unit.query,unit.offset,unit.count);
+}
+
+// older messages of the subscribed chat, the server isn't involved
+void ChatService::process_history(const ChatWorkUnitHistory &unit){
+	if(chatname==""){
+		unit.callback({});
+		return;
+	}
+
+	unit.callback(db.get_msgs(servername,chatname,unit.count,unit.before));
+}
+
+// a thumbnail left out of the history, the server isn't involved either
+void ChatService::process_thumbnail(const ChatWorkUnitThumbnail &unit){
+	if(chatname==""){
+		unit.callback(unit.id,{});
+		return;
+	}
+
+	unit.callback(unit.id,db.get_raw(servername,unit.id,chatname));
 }
 
 // tell the server user's name
@@ -333,11 +783,17 @@ void ChatService::clientcmd_introduce(){
 	send_string(name);
 }
 
-// ask the server for list of chats
+// ask the server for list of chats created since directory version <since>
 // implements ClientCommand::LIST_CHATS
-void ChatService::clientcmd_list_chats(){
+void ChatService::clientcmd_list_chats(unsigned long long since){
 	ClientCommand type=ClientCommand::LIST_CHATS;
 	send(&type,sizeof(type));
+
+	// the server will send the whole list if this is the wrong server
+	send_string(servername);
+
+	std::uint64_t version=since;
+	send(&version,sizeof(version));
 }
 
 // tell the server to make a new chat
@@ -363,9 +819,32 @@ void ChatService::clientcmd_subscribe(const std::string &chatname,unsigned long
 	send(&max,sizeof(max));
 }
 
+// ask for the messages after <after> through <through> in the subscribed chat, to fill a gap
+// implements ClientCommand::GET_RANGE
+void ChatService::clientcmd_get_range(unsigned long long after,unsigned long long through){
+	ClientCommand type=ClientCommand::GET_RANGE;
+	send(&type,sizeof(type));
+
+	std::uint64_t a=after;
+	send(&a,sizeof(a));
+	std::uint64_t t=through;
+	send(&t,sizeof(t));
+
+	resyncing=true;
+}
+
+// ask for the session this client had before it lost the connection
+// implements ClientCommand::RESUME
+void ChatService::clientcmd_resume(){
+	ClientCommand type=ClientCommand::RESUME;
+	send(&type,sizeof(type));
+
+	send_string(token);
+}
+
 // send a message
 // implements ClientCommand::MESSAGE
-void ChatService::clientcmd_message(const Message &msg){
+void ChatService::clientcmd_message(const Message &msg,const std::vector<unsigned char> &thumbnail){
 	ClientCommand type=ClientCommand::MESSAGE;
 	send(&type,sizeof(type));
 
@@ -375,17 +854,82 @@ void ChatService::clientcmd_message(const Message &msg){
 	// raw size
 	send(&msg.raw_size,sizeof(msg.raw_size));
 	if(msg.raw_size>0){
-		send(msg.raw,msg.raw_size,callback.percent);
+		send(msg.raw,msg.raw_size);
+	}
+
+	// images are followed by their thumbnail
+	if(msg.type==MessageType::IMAGE){
+		std::uint64_t thumbnail_size=thumbnail.size();
+		send(&thumbnail_size,sizeof(thumbnail_size));
+		if(thumbnail_size>0)
+			send(thumbnail.data(),thumbnail_size);
+	}
+}
+
+// announce an upload of the <size> bytes with sha-256 <hash> that <unit> is for
+// implements ClientCommand::UPLOAD
+void ChatService::clientcmd_upload(const ChatWorkUnitMessage &unit,unsigned long long size,const std::string &hash){
+	ClientCommand type=ClientCommand::UPLOAD;
+	send(&type,sizeof(type));
+
+	send_string(unit.transfer);
+	send(&unit.type,sizeof(unit.type));
+	send_string(unit.text);
+
+	std::uint64_t raw_size=size;
+	send(&raw_size,sizeof(raw_size));
+
+	send_string(hash);
+
+	// images come with their thumbnail
+	if(unit.type==MessageType::IMAGE){
+		std::uint64_t thumbnail_size=unit.thumbnail.size();
+		send(&thumbnail_size,sizeof(thumbnail_size));
+		if(thumbnail_size>0)
+			send(unit.thumbnail.data(),thumbnail_size);
 	}
 }
 
-// request a file from the server
+// send the <length> bytes of upload <transfer> that start at <offset>
+// implements ClientCommand::UPLOAD_DATA
+void ChatService::clientcmd_upload_data(const std::string &transfer,unsigned long long offset,const void *data,unsigned length){
+	ClientCommand type=ClientCommand::UPLOAD_DATA;
+	send(&type,sizeof(type));
+
+	send_string(transfer);
+
+	std::uint64_t from=offset;
+	send(&from,sizeof(from));
+
+	std::uint32_t size=length;
+	send(&size,sizeof(size));
+	send(data,length);
+}
+
+// request a file from the server, <offset> is how much of it is here already
 // implements ClientCommand::GET_FILE
-void ChatService::clientcmd_get_file(unsigned long long id){
+void ChatService::clientcmd_get_file(unsigned long long id,unsigned long long offset){
 	ClientCommand type=ClientCommand::GET_FILE;
 	send(&type, sizeof(type));
 
 	send(&id, sizeof(id));
+
+	std::uint64_t from=offset;
+	send(&from, sizeof(from));
+}
+
+// search the subscribed chat
+// implements ClientCommand::SEARCH
+void ChatService::clientcmd_search(const std::string &query,unsigned long long offset,unsigned count){
+	ClientCommand type=ClientCommand::SEARCH;
+	send(&type,sizeof(type));
+
+	send_string(query);
+
+	std::uint64_t skip=offset;
+	send(&skip,sizeof(skip));
+	std::uint32_t page=count;
+	send(&page,sizeof(page));
 }
 
 // send a heartbeat
@@ -398,7 +942,11 @@ void ChatService::clientcmd_heartbeat(){
 // receive the validated name back from the server
 // implements ServerCommand::INTRODUCE
 void ChatService::servercmd_introduce(){
-	name=get_string();
+	const std::string validated=get_string();
+	const std::string session=get_string();
+
+	name=validated;
+	token=session;
 
 	callback.connect(true, name);
 }
@@ -407,15 +955,21 @@ void ChatService::servercmd_introduce(){
 // implements ServerCommand::LIST_CHATS
 void ChatService::servercmd_list_chats(){
 	// get the server's name
-	servername=get_string();
-	db.set_servername(servername);
+	const std::string server=get_string();
+
+	// see if the server sent the whole list, or just the new stuff
+	std::uint8_t full;
+	recv(&full,sizeof(full));
+
+	// recv the directory version
+	std::uint64_t version;
+	recv(&version,sizeof(version));
 
 	// recv the number of chats
 	std::uint64_t count;
 	recv(&count,sizeof(count));
 
-	std::vector<Chat> list;
-
+	std::vector<Chat> listed;
 	for(unsigned i=0;i<count;++i){
 		decltype(Chat::id) id;
 		recv(&id,sizeof(id));
@@ -424,10 +978,23 @@ void ChatService::servercmd_list_chats(){
 		const std::string &creator=get_string();
 		const std::string &description=get_string();
 
-		list.push_back({id,name,creator,description});
+		listed.push_back({id,name,creator,description});
+	}
+
+	servername=server;
+
+	if(full)
+		chats.clear();
+	else{
+		// forget chats that were announced since the last list, the server has sent them again
+		const unsigned long long since=chats_version;
+		chats.erase(std::remove_if(chats.begin(),chats.end(),[since](const Chat &chat){ return chat.id>since; }),chats.end());
 	}
 
-	callback.chatlist(list);
+	chats.insert(chats.end(),listed.begin(),listed.end());
+	chats_version=version;
+
+	callback.chatlist(chats);
 }
 
 // recv receipt of previously created new chat
@@ -446,63 +1013,152 @@ void ChatService::servercmd_subscribe(){
 	std::uint8_t worked;
 	recv(&worked,sizeof(worked));
 	if(!worked){
+		subscribing=false;
 		callback.subscribe(false,{});
 		return;
 	}
 
-	std::vector<Message> msgs;
+	std::vector<Message> msgs=recv_messages();
+	subscribing=false;
 
-	// get the number of messages
-	std::uint64_t count;
-	recv(&count,sizeof(count));
+	// give the client messages that were already in this chat
+	callback.subscribe(true,db.get_msgs(servername,chatname,HISTORY_MESSAGES));
 
-	for(unsigned long long i=0;i<count;++i){
-		// id
-		decltype(Message::id) id;
-		recv(&id,sizeof(id));
+	db.newmsgs(servername,msgs,chatname);
+	for(const Message &msg:msgs)
+		callback.message(msg);
 
-		// type
-		MessageType type;
-		recv(&type,sizeof(type));
+	// whatever was held or asked for belonged to the last subscription
+	last_id=db.get_latest_msg(servername,chatname);
+	held.clear();
+	resyncing=false;
+}
 
-		// recv unix time
-		std::int32_t unixtime;
-		recv(&unixtime, sizeof(unixtime));
+// recv a message from the server
+// implements ServerCommand::MESSAGE
+void ChatService::servercmd_message(){
+	Message message=recv_message();
 
-		const std::string &msg=get_string();
-		const std::string &sender=get_string();
+	// the reply to a subscribe brings everything up to date, so this is either from the old chat or repeated in it
+	if(subscribing||message.id<=last_id)
+		return;
 
-		// raw size
-		decltype(Message::raw_size) raw_size;
-		recv(&raw_size,sizeof(raw_size));
+	if(message.id!=last_id+1){
+		// missed something, most likely the server dropped it because this client fell behind
+		held.emplace(message.id,std::move(message));
+		if(!resyncing)
+			clientcmd_get_range(last_id,held.begin()->first-1);
+		return;
+	}
 
-		unsigned char *raw=NULL;
-		if(raw_size>0){
-			// raw
-			raw=new unsigned char[raw_size];
-			recv(raw,raw_size);
-		}
+	deliver(message);
+	release_held();
+}
 
-		msgs.push_back({id,type,unixtime,msg,sender,raw,raw_size});
-	}
+// messages asked for with GET_RANGE
+// implements ServerCommand::RANGE
+void ChatService::servercmd_range(){
+	std::uint64_t through;
+	recv(&through,sizeof(through));
 
-	// give the client messages that were already in this chat
-	callback.subscribe(true,db.get_msgs(chatname));
+	std::vector<Message> msgs=recv_messages();
+
+	// asked for before a resubscribe, which already brought this chat up to date
+	if(subscribing||!resyncing)
+		return;
 
+	resyncing=false;
+
+	// the server sends them in order, drop whatever arrived some other way meanwhile
+	msgs.erase(msgs.begin(),std::upper_bound(msgs.begin(),msgs.end(),last_id,[](unsigned long long id,const Message &msg){
+		return id<msg.id;
+	}));
+
+	db.newmsgs(servername,msgs,chatname);
 	for(const Message &msg:msgs){
-		db.newmsg(msg,chatname);
 		callback.message(msg);
+		last_id=msg.id;
 	}
+
+	// anything the server didn't send up to <through> has gone for good (retention), don't wait on it
+	if(through>last_id)
+		last_id=through;
+
+	release_held();
 }
 
-// recv a message from the server
-// implements ServerCommand::MESSAGE
-void ChatService::servercmd_message(){
+// see if the server still had this client's session
+// implements ServerCommand::RESUME
+void ChatService::servercmd_resume(){
+	std::uint8_t worked;
+	recv(&worked,sizeof(worked));
+	if(!worked){
+		log("session expired, introducing again");
+		token.clear();
+		reintroduce();
+		return;
+	}
+
+	const std::string validated=get_string();
+	const std::string session=get_string();
+
+	// newest message the server sent before the connection went, some of which may not have made it
+	std::uint64_t sent;
+	recv(&sent,sizeof(sent));
+
+	name=validated;
+	token=session;
+
+	// whatever was asked for on the old connection is never coming back
+	resyncing=false;
+	retry_transfers();
+
+	// the reply to a subscribe went with the connection, ask again
+	if(subscribing){
+		add_work(new ChatWorkUnitSubscribe(chatname,callback.subscribe,callback.message,true));
+		return;
+	}
+
+	if(chatname=="")
+		return;
+
+	if(sent>last_id)
+		clientcmd_get_range(last_id,sent);
+	else
+		release_held();
+}
+
+// store and show a message that is next in line
+void ChatService::deliver(const Message &message){
+	// store it in the db
+	db.newmsg(servername,message,chatname);
+
+	// tell the user
+	callback.message(message);
+
+	last_id=message.id;
+}
+
+// deliver the held messages that are now in order, and ask for the next gap if there is one
+void ChatService::release_held(){
+	while(!held.empty()&&held.begin()->first<=last_id+1){
+		if(held.begin()->first==last_id+1)
+			deliver(held.begin()->second);
+
+		held.erase(held.begin());
+	}
+
+	if(!held.empty()&&!resyncing)
+		clientcmd_get_range(last_id,held.begin()->first-1);
+}
+
+// recv a single message, in the format MESSAGE, SUBSCRIBE and RANGE all use
+Message ChatService::recv_message(){
 	// id
 	decltype(Message::id) id;
 	recv(&id,sizeof(id));
 
-	// msg tpe
+	// msg type
 	MessageType type;
 	recv(&type,sizeof(type));
 
@@ -517,19 +1173,40 @@ void ChatService::servercmd_message(){
 	decltype(Message::raw_size) raw_size;
 	recv(&raw_size,sizeof(raw_size));
 
+	// nothing is allocated for it until it's all here
+	if(inbox.size()-consumed<raw_size)
+		throw IncompleteException();
+
 	unsigned char *raw=NULL;
 	if(raw_size>0){
 		raw=new unsigned char[raw_size];
 		recv(raw,raw_size);
 	}
 
-	Message message(id,type,unixtime,msg,sender,raw,raw_size);
+	return Message(id,type,unixtime,msg,sender,raw,raw_size);
+}
 
-	// store it in the db
-	db.newmsg(message,chatname);
+// recv a count, then that many messages
+// a backlog of many megabytes takes many passes to come in, so the messages are kept in <partial> as they're read,
+// and the next pass skips straight past them instead of reading the whole command again each time
+std::vector<Message> ChatService::recv_messages(){
+	if(partial.offset==0){
+		recv(&partial.count,sizeof(partial.count));
+		partial.offset=consumed-command;
+	}
+	else
+		consumed=command+partial.offset;
 
-	// tell the user
-	callback.message(message);
+	while(partial.msgs.size()<partial.count){
+		partial.msgs.push_back(recv_message());
+		partial.offset=consumed-command;
+	}
+
+	std::vector<Message> msgs;
+	msgs.swap(partial.msgs);
+	partial.offset=0;
+
+	return msgs;
 }
 
 // determine if server accepted previously sent message
@@ -543,25 +1220,299 @@ void ChatService::servercmd_message_receipt(){
 		err=get_string();
 	}
 
-	callback.receipt(worked==1, err);
-	callback.receipt=nullptr;
+	// the messages it was for went with a lost connection, see forget_receipts()
+	if(callback.receipts.empty())
+		return;
+
+	const std::function<void(bool,const std::string&)> fn=std::move(callback.receipts.front());
+	callback.receipts.pop();
+
+	if(fn)
+		fn(worked==1, err);
+}
+
+// server has some of the upload already, its slices pick up from there
+// implements ServerCommand::UPLOAD
+void ChatService::servercmd_upload(){
+	const std::string transfer=get_string();
+	std::uint64_t offset;
+	recv(&offset,sizeof(offset));
+
+	if(uploads.empty()||uploads.front()->transfer!=transfer){
+		log_error("the server asked for the rest of an upload that isn't being sent");
+		return;
+	}
+
+	const ChatWorkUnitMessage &front=*uploads.front();
+	if(offset>upload.size){
+		finish_upload(false,"The server has more of the upload than there is to send");
+		return;
+	}
+
+	// it has to be the same file the server was told about
+	if(!front.path.empty()){
+		upload.file.open(front.path,std::ifstream::binary|std::ifstream::ate);
+		if(!upload.file||(unsigned long long)upload.file.tellg()!=upload.size){
+			finish_upload(false,"The file changed while it was being sent");
+			return;
+		}
+
+		upload.file.seekg(offset);
+	}
+
+	// the slices go out from the bulk lane of the work queue, between whatever else comes along
+	upload.sent=offset;
+	upload.sending=true;
+	upload.stalled=false;
+	add_work(new ChatWorkUnitSlice(front.transfer,offset));
+}
+
+// server is done with an upload, one way or another
+// implements ServerCommand::UPLOAD_RECEIPT
+void ChatService::servercmd_upload_receipt(){
+	const std::string transfer=get_string();
+
+	std::uint8_t worked;
+	recv(&worked, sizeof(worked));
+
+	std::string err;
+	if(worked==0)
+		err=get_string();
+
+	// it may have been given up on already
+	if(uploads.empty()||uploads.front()->transfer!=transfer)
+		return;
+
+	finish_upload(worked==1,err);
 }
 
-// server is sending file
+// server is about to send a file, in FILE_DATA slices
 // implements ServerCommand::SEND_FILE
 void ChatService::servercmd_send_file(){
 	std::uint64_t size;
 	recv(&size, sizeof(size));
 
-	std::unique_ptr<unsigned char[]> buffer(new unsigned char[size]);
-	recv(buffer.get(), size, callback.percent);
+	// sha-256 of all of it, to check against
+	const std::string hash=get_string();
+
+	// where the slices start, only downloads to disk ask for anything but the start
+	std::uint64_t offset;
+	recv(&offset, sizeof(offset));
 
-	// handle errors
-	if(size==0||size>INT_MAX){
-		callback.file(NULL, 0);
+	incoming.unit.reset();
+	if(downloads.empty())
+		log_error("the server sent a file that wasn't asked for");
+	else{
+		incoming.unit=std::move(downloads.front());
+		downloads.pop();
+	}
+
+	incoming.size=size;
+	incoming.hash=hash;
+	incoming.offset=offset;
+	incoming.got=offset;
+	incoming.sha=SHA256();
+	incoming.buffer.clear();
+
+	// a size of 0 means the server couldn't get it
+	incoming.good=size>0;
+
+	if(!incoming.unit)
 		return;
+
+	const ChatWorkUnitGetFile &unit=*incoming.unit;
+	if(!unit.path.empty()){
+		const std::string part=unit.path+".part";
+
+		// what's in the .part file already counts towards the hash, the rest is added as it arrives
+		if(offset>0){
+			std::ifstream in(part,std::ifstream::binary);
+			std::unique_ptr<char[]> buffer(new char[TRANSFER_SLICE_BYTES]);
+			for(unsigned long long have=0;have<offset&&in;){
+				in.read(buffer.get(),std::min<unsigned long long>(offset-have,TRANSFER_SLICE_BYTES));
+				incoming.sha.update(buffer.get(),in.gcount());
+				have+=in.gcount();
+			}
+		}
+
+		incoming.part.open(part,std::ofstream::binary|(offset>0?std::ofstream::app:std::ofstream::trunc));
+	}
+	else if(!unit.sink){
+		// it's handed over all at once, and the size of it as an int
+		incoming.good=incoming.good&&size<=INT_MAX&&offset==0;
+		if(incoming.good)
+			incoming.buffer.reserve(size);
+	}
+
+	if(incoming.got>=incoming.size)
+		finish_download();
+}
+
+// the next slice of the file from SEND_FILE
+// what goes to a sink or the .part file goes as it arrives, so big files are never all in memory
+// implements ServerCommand::FILE_DATA
+void ChatService::servercmd_file_data(){
+	std::uint32_t length;
+	recv(&length, sizeof(length));
+
+	if(length>TRANSFER_SLICE_BYTES||(incoming.unit&&incoming.got+length>incoming.size)){
+		log_error("the server sent more of a file than there is");
+		tcp.close();
+		throw NetworkException();
+	}
+
+	std::unique_ptr<unsigned char[]> slice(new unsigned char[length]);
+	recv(slice.get(), length);
+
+	// what's left of a file nobody is waiting on any more
+	if(!incoming.unit)
+		return;
+
+	const ChatWorkUnitGetFile &unit=*incoming.unit;
+	incoming.sha.update(slice.get(), length);
+
+	// once the sink gives up the rest still comes, it just goes nowhere
+	if(!unit.path.empty())
+		incoming.part.write((const char*)slice.get(), length);
+	else if(unit.sink)
+		incoming.good=incoming.good&&unit.sink(slice.get(), length);
+	else if(incoming.good)
+		incoming.buffer.insert(incoming.buffer.end(), slice.get(), slice.get()+length);
+
+	incoming.got+=length;
+	if(unit.percent!=NULL)
+		unit.percent->store(((double)incoming.got/incoming.size)*100);
+
+	if(incoming.got==incoming.size)
+		finish_download();
+}
+
+// all of the file from SEND_FILE is here, check it against its hash and hand it over
+void ChatService::finish_download(){
+	const std::unique_ptr<ChatWorkUnitGetFile> unit=std::move(incoming.unit);
+	std::vector<unsigned char> buffer;
+	std::swap(buffer, incoming.buffer);
+
+	const bool matched=incoming.sha.hex()==incoming.hash;
+
+	if(unit->path.empty()){
+		const bool good=incoming.good&&matched;
+		if(!good){
+			fail_download(*unit);
+			return;
+		}
+
+		if(unit->sink)
+			unit->done(true);
+		else
+			unit->callback(buffer.data(), (int)buffer.size());
+
+		return;
+	}
+
+	const std::string part=unit->path+".part";
+	incoming.part.close();
+
+	bool good=incoming.good&&!incoming.part.fail()&&matched;
+
+	// whatever was in the .part file already wasn't the start of this one, once more from scratch
+	if(!good&&incoming.good&&incoming.offset>0){
+		std::remove(part.c_str());
+		add_work(new ChatWorkUnitGetFile(*unit));
+		return;
+	}
+
+	if(good){
+		std::remove(unit->path.c_str());
+		good=std::rename(part.c_str(),unit->path.c_str())==0;
+	}
+
+	if(!good){
+		std::remove(part.c_str());
+		if(unit->percent!=NULL)
+			unit->percent->store(-1);
+	}
+
+	unit->done(good);
+}
+
+// a download that isn't going to make it, and can't pick up where it left off
+void ChatService::fail_download(const ChatWorkUnitGetFile &unit){
+	if(unit.percent!=NULL)
+		unit.percent->store(-1);
+
+	if(unit.sink)
+		unit.done(false);
+	else
+		unit.callback(NULL, 0);
+}
+
+// recv a newly created chat from the server
+// implements ServerCommand::CHAT_CREATED
+void ChatService::servercmd_chat_created(){
+	// directory version, not needed
+	std::uint64_t version;
+	recv(&version,sizeof(version));
+
+	decltype(Chat::id) id;
+	recv(&id,sizeof(id));
+
+	const std::string &name=get_string();
+	const std::string &creator=get_string();
+	const std::string &description=get_string();
+
+	const Chat chat(id,name,creator,description);
+
+	// only fold it into the chat list if there is a chat list to fold it into
+	if(servername!=""){
+		bool known=false;
+		for(const Chat &c:chats){
+			if(c.id==chat.id){
+				known=true;
+				break;
+			}
+		}
+
+		// <chats_version> is left alone, chats created while disconnected may still be missing
+		if(!known)
+			chats.push_back(chat);
+	}
+
+	if(callback.chat_created)
+		callback.chat_created(chat);
+}
+
+// recv a page of search results
+// implements ServerCommand::SEARCH_RESULTS
+void ChatService::servercmd_search_results(){
+	std::uint8_t worked;
+	recv(&worked,sizeof(worked));
+
+	if(worked==0){
+		const std::string &err=get_string();
+		callback.search(false,err,{});
+		return;
+	}
+
+	std::uint64_t count;
+	recv(&count,sizeof(count));
+
+	std::vector<Message> results;
+	for(unsigned long long i=0;i<count;++i){
+		decltype(Message::id) id;
+		recv(&id,sizeof(id));
+
+		MessageType type;
+		recv(&type,sizeof(type));
+
+		std::int32_t unixtime;
+		recv(&unixtime,sizeof(unixtime));
+
+		const std::string &snippet=get_string();
+		const std::string &sender=get_string();
+
+		results.push_back({id,type,unixtime,snippet,sender,NULL,0});
 	}
 
-	// notify the user
-	callback.file(buffer.get(), (int)size);
+	callback.search(true,{},results);
 }
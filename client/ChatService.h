@@ -1,14 +1,35 @@
 #ifndef CHATSERVICE_H
 #define CHATSERVICE_H
 
-#include <thread>
 #include <atomic>
 #include <mutex>
 #include <queue>
+#include <deque>
+#include <map>
+#include <random>
+#include <fstream>
+#include <memory>
+#include <chrono>
 
 #include "network.h"
 #include "ChatWorkUnit.h"
+#include "ChatLoop.h"
 #include "Database.h"
+#include "Backoff.h"
+#include "sha256.h"
+
+// how long a connect keeps trying before it gives up, and the rest between tries
+#define CONNECT_SECONDS 5
+#define CONNECT_RETRY_MILLIS 5
+
+// how long each attempt to reconnect waits for the server to answer
+#define RECONNECT_ATTEMPT_SECONDS 2
+
+// stored messages handed over with a subscribe, and the default page size of ChatClient::history()
+#define HISTORY_MESSAGES 100
+
+// most read from one connection each time around ChatLoop, so a big download doesn't hold up the other connections
+#define RECV_BUDGET_BYTES (256*1024)
 
 class NetworkException:public std::exception{
 public:
@@ -17,45 +38,91 @@ public:
 	}
 };
 
-class ShutdownException:public std::exception{
+// the rest of a server command hasn't arrived yet, whatever was read of it is put back
+class IncompleteException:public std::exception{
 public:
 	virtual const char *what()const noexcept{
-		return "need to shut down";
+		return "the rest of the command hasn't arrived";
 	}
 };
 
+// one connection to one server, looked after by a ChatLoop along with any others
+// nothing here blocks: what's sent waits in <outbox> for the socket to take it,
+// and server commands are handled once all of one is in <inbox>
 class ChatService{
 public:
-	explicit ChatService(const std::string&);
+	explicit ChatService(ChatLoop&);
+	ChatService(const ChatService&)=delete;
 	~ChatService();
+	ChatService &operator=(const ChatService&)=delete;
 	void add_work(const ChatWorkUnit*);
-	void operator()();
-	void send(const void*,int,std::atomic<int>* = NULL);
-	void recv(void*,int,std::atomic<int>* = NULL);
+	void send(const void*,int);
+	void recv(void*,int);
 	void send_string(const std::string&);
 	std::string get_string();
 	bool is_connected()const;
+	void set_backoff(const Backoff&);
 
 private:
-	void loop();
+	friend class ChatLoop;
+
+	// where the connection is at
+	enum class Link{
+		OFFLINE, // not connected, and not trying to be
+		CONNECTING, // waiting on the socket to connect, until <deadline>
+		WAITING, // waiting until <next> to try connecting again
+		UP // connected
+	};
+
+	// called by ChatLoop, on the loop thread
+	bool work();
+	void watch(net::poller&);
+	void io(const net::poller&);
+	int due()const;
+
+	void process(const ChatWorkUnit&);
+	void flush();
+	void receive();
+	unsigned long long pending()const;
 	void recv_server_cmd();
 	void heartbeat();
-	void reconnect();
-	const ChatWorkUnit *get_work();
+	int heartbeat_due()const;
+	void attempt();
+	void established();
+	void attempt_failed();
+	void lost();
+	void reintroduce();
 	void process_connect(const ChatWorkUnitConnect&);
 	void process_list_chats(const ChatWorkUnitListChats&);
 	void process_newchat(const ChatWorkUnitNewChat&);
 	void process_subscribe(const ChatWorkUnitSubscribe&);
 	void process_send_message(const ChatWorkUnitMessage&);
+	void process_slice(const ChatWorkUnitSlice&);
+	void start_upload();
+	void finish_upload(bool,const std::string&);
 	void process_get_file(const ChatWorkUnitGetFile&);
+	void process_search(const ChatWorkUnitSearch&);
+	void process_history(const ChatWorkUnitHistory&);
+	void process_thumbnail(const ChatWorkUnitThumbnail&);
+	void finish_download();
+	void fail_download(const ChatWorkUnitGetFile&);
+	void retry_transfers();
+	void forget_receipts();
+	std::string new_transfer();
+	static bool digest(const std::string&,std::string&,unsigned long long&);
 
 	// net commands implementing ClientCommand::*
 	void clientcmd_introduce();
-	void clientcmd_list_chats();
+	void clientcmd_list_chats(unsigned long long);
 	void clientcmd_new_chat(const std::string&,const std::string&);
 	void clientcmd_subscribe(const std::string&,unsigned long long);
-	void clientcmd_message(const Message&);
-	void clientcmd_get_file(unsigned long long);
+	void clientcmd_message(const Message&,const std::vector<unsigned char>&);
+	void clientcmd_upload(const ChatWorkUnitMessage&,unsigned long long,const std::string&);
+	void clientcmd_upload_data(const std::string&,unsigned long long,const void*,unsigned);
+	void clientcmd_get_file(unsigned long long,unsigned long long);
+	void clientcmd_search(const std::string&,unsigned long long,unsigned);
+	void clientcmd_get_range(unsigned long long,unsigned long long);
+	void clientcmd_resume();
 	void clientcmd_heartbeat();
 	// net commands implementing ServerCommand::*
 	void servercmd_introduce();
@@ -65,6 +132,17 @@ private:
 	void servercmd_message();
 	void servercmd_message_receipt();
 	void servercmd_send_file();
+	void servercmd_file_data();
+	void servercmd_chat_created();
+	void servercmd_search_results();
+	void servercmd_range();
+	void servercmd_resume();
+	void servercmd_upload();
+	void servercmd_upload_receipt();
+	Message recv_message();
+	std::vector<Message> recv_messages();
+	void deliver(const Message&);
+	void release_held();
 
 	// registered callbacks
 	struct{
@@ -72,31 +150,81 @@ private:
 		std::function<void(bool,const std::string&)> connect;
 		// called on chat list receipt
 		std::function<void(std::vector<Chat>)> chatlist;
+		// called when the server announces a new chat
+		std::function<void(Chat)> chat_created;
 		// called on successful new chat
 		std::function<void(bool)> newchat;
 		// called on successful subscribe
 		std::function<void(bool,std::vector<Message>)> subscribe;
 		// called when message received
 		std::function<void(Message)> message;
-		// called when server sends message receipt
-		std::function<void(bool,const std::string&)> receipt;
-		// called when file is received from server
-		std::function<void(const unsigned char*,int)> file;
-		// percentage tracker
-		std::atomic<int> *percent;
+		// called when server sends message receipt, in the order the text messages went out
+		std::queue<std::function<void(bool,const std::string&)>> receipts;
+		// called when search results are received
+		std::function<void(bool,const std::string&,std::vector<Message>)> search;
 	}callback;
 
-	Database db;
+	ChatLoop &loop;
+	Database &db; // shared with every other connection on <loop>
 	net::tcp tcp;
+	Link link;
+	bool reconnecting; // <link> is finding its way back after losing the server, rather than connecting for a CONNECT
+	unsigned attempts; // to reconnect, since the server was lost
+	std::chrono::steady_clock::time_point deadline; // when a connect (or a reconnect attempt) gives up
+	std::chrono::steady_clock::time_point next; // when to try connecting again
+	int polled; // index of <tcp> in the poller ChatLoop last waited on, -1 if it wasn't
+	std::vector<unsigned char> outbox; // sent, but not taken by the socket yet
+	size_t flushed; // how much of <outbox> the socket has taken
+	std::vector<unsigned char> inbox; // received, starting with a command that's been handled up to <consumed>
+	size_t consumed;
+	size_t command; // where in <inbox> the command being handled starts
+	// messages from a SUBSCRIBE or RANGE that was only partly there the last time it was read, see recv_messages()
+	struct{
+		size_t offset; // how far into its command they go, 0 if there aren't any
+		std::uint64_t count; // how many the command has
+		std::vector<Message> msgs;
+	}partial;
 	std::string target; // network address of server
 	std::string servername; // name of current server that this is connected to
 	std::string name; // user's name
+	std::string token; // lets this client RESUME its session on the server after losing the connection
 	std::string chatname; // subscribed chat
-	std::atomic<bool> working; // service thread currently running
 	std::atomic<bool> connected; // currently connected to server
+	std::vector<Chat> chats; // the server's chat list, as of <chats_version>
+	unsigned long long chats_version; // version of the server's chat directory that <chats> reflects
+	unsigned long long last_id; // every message in <chatname> up to and including this one has been delivered
+	bool subscribing; // a subscribe is in flight, anything that arrives before its reply isn't for <chatname>
+	bool resyncing; // a GET_RANGE is in flight
+	std::map<unsigned long long,Message> held; // messages that arrived after a gap, waiting for it to be filled
 	ChatWorkQueue work_queue;
+	// files and images that haven't had their receipt, sent again if the connection goes before they do
+	// the server takes one upload at a time, the rest wait behind the front one
+	std::deque<std::unique_ptr<ChatWorkUnitMessage>> uploads;
+	struct{
+		unsigned long long size; // of the front of <uploads> when it was announced
+		std::string hash; // and its sha-256
+		unsigned long long sent; // where its next slice starts
+		bool sending; // the server has said where to start, and the slices are going out
+		bool stalled; // the next slice waits for the socket to take most of the last one, see io()
+		std::ifstream file; // open while its slices are going out, for uploads from disk
+	}upload;
+	std::queue<std::unique_ptr<ChatWorkUnitGetFile>> downloads; // asked for, the server sends them in this order
+	// the download the server's FILE_DATA slices are for
+	struct{
+		std::unique_ptr<ChatWorkUnitGetFile> unit; // NULL if they're for nothing (it's been given up on)
+		unsigned long long size;
+		std::string hash; // sha-256 of all of it, to check against
+		unsigned long long offset; // where the slices started, downloads to disk may already have the part before
+		unsigned long long got;
+		bool good; // nothing has gone wrong yet
+		SHA256 sha; // of what has come in, and what was in the .part file before it
+		std::vector<unsigned char> buffer; // all of it, for downloads that are handed over at once
+		std::ofstream part; // or the .part file, for downloads to disk
+	}incoming;
 	time_t last_heartbeat;
-	std::thread handle;
+	Backoff backoff; // waits between attempts to reconnect
+	std::mutex backoff_lock; // guards <backoff>, which the user may change from another thread
+	std::mt19937 rng; // for the jitter in <backoff>, seeded differently in every client
 };
 
 #endif // CHATSERVICE_H
@@ -3,11 +3,13 @@
 
 #include <functional>
 #include <string>
+#include <vector>
 #include <queue>
+#include <array>
 #include <mutex>
-#include <condition_variable>
 
 #include "../chat.h"
+#include "network.h"
 
 enum class WorkUnitType:std::uint8_t{
 	CONNECT, // connect to a server
@@ -15,12 +17,45 @@ enum class WorkUnitType:std::uint8_t{
 	NEW_CHAT, // have the server make a new chat
 	SUBSCRIBE, // subscribe to a chat
 	MESSAGE, // send a message
-	GET_FILE // requesting a file from the server
+	GET_FILE, // requesting a file from the server
+	SEARCH, // searching the subscribed chat
+	HISTORY, // older messages of the subscribed chat, from the local database
+	THUMBNAIL, // an image's thumbnail, from the local database
+	SLICE // the next slice of an upload, ChatService queues these itself
+};
+
+// ChatWorkQueue hands out everything in one lane before anything in the next
+enum class WorkLane:std::uint8_t{
+	CONTROL, // connecting, the chat list, subscribing, everything else depends on these
+	INTERACTIVE, // text messages, searches, history, the user is sitting there waiting on them
+	BULK // files and images going either way, a slice at a time so the other lanes get in between
 };
 
 struct ChatWorkUnit{
 	ChatWorkUnit(WorkUnitType t):type(t){}
 	virtual ~ChatWorkUnit(){};
+
+	// which lane of ChatWorkQueue it waits in
+	virtual WorkLane lane()const{
+		switch(type){
+		case WorkUnitType::CONNECT:
+		case WorkUnitType::LIST_CHATS:
+		case WorkUnitType::NEW_CHAT:
+		case WorkUnitType::SUBSCRIBE:
+			return WorkLane::CONTROL;
+		case WorkUnitType::GET_FILE:
+		case WorkUnitType::SLICE:
+			return WorkLane::BULK;
+		default:
+			return WorkLane::INTERACTIVE;
+		}
+	}
+
+	// whether ChatWorkQueue keeps it in order with the other lanes, see ChatWorkUnitSubscribe
+	virtual bool barrier()const{
+		return false;
+	}
+
 	const WorkUnitType type;
 };
 
@@ -38,13 +73,16 @@ struct ChatWorkUnitConnect:ChatWorkUnit{
 	const std::function<void(bool,const std::string&)> callback;
 };
 
+// for refreshing the chat list
 struct ChatWorkUnitListChats:ChatWorkUnit{
-	ChatWorkUnitListChats(std::function<void(std::vector<Chat>)> fn)
+	ChatWorkUnitListChats(std::function<void(std::vector<Chat>)> fn,std::function<void(Chat)> c)
 	:ChatWorkUnit(WorkUnitType::LIST_CHATS)
 	,callback(fn)
+	,created(c)
 	{}
 
 	const std::function<void(std::vector<Chat>)> callback;
+	const std::function<void(Chat)> created;
 };
 
 // for creating a new chat
@@ -63,39 +101,71 @@ struct ChatWorkUnitNewChat:ChatWorkUnit{
 
 // for subscribing to a chat
 struct ChatWorkUnitSubscribe:ChatWorkUnit{
-	ChatWorkUnitSubscribe(const std::string &n,std::function<void(bool,std::vector<Message>)> c,std::function<void(Message)> m)
+	ChatWorkUnitSubscribe(const std::string &n,std::function<void(bool,std::vector<Message>)> c,std::function<void(Message)> m,bool a = false)
 	:ChatWorkUnit(WorkUnitType::SUBSCRIBE)
 	,name(n)
+	,again(a)
 	,callback(c)
 	,msg_callback(m)
 	{}
 
+	// messages, searches and transfers go to whatever chat is subscribed when they get to the server,
+	// so nothing queued before a new subscription may be overtaken by it, and nothing queued after may overtake it
+	// subscribing <again>, after the connection went, is what everything still queued was meant for, so it goes first
+	virtual bool barrier()const{
+		return !again;
+	}
+
 	const std::string name;
+	const bool again;
 	const std::function<void(bool,std::vector<Message>)> callback;
 	const std::function<void(Message)> msg_callback;
 };
 
 // for sending a message
 struct ChatWorkUnitMessage:ChatWorkUnit{
-	ChatWorkUnitMessage(MessageType t,const std::string &m,unsigned char *r,unsigned long long rs, std::atomic<int> *pcnt, std::function<void(bool,const std::string&)> fn)
+	ChatWorkUnitMessage(MessageType t,const std::string &m,unsigned char *r,unsigned long long rs, std::atomic<int> *pcnt, std::function<void(bool,const std::string&)> fn, const std::vector<unsigned char> &th = {})
 	:ChatWorkUnit(WorkUnitType::MESSAGE)
 	,type(t)
 	,text(m)
 	,raw(r)
 	,raw_size(rs)
+	,thumbnail(th)
+	,percent(pcnt)
+	,callback(fn)
+	{}
+
+	// content read from the file at <p> as it's sent, rather than held in memory
+	ChatWorkUnitMessage(MessageType t,const std::string &m,const std::string &p, std::atomic<int> *pcnt, std::function<void(bool,const std::string&)> fn, const std::vector<unsigned char> &th = {})
+	:ChatWorkUnit(WorkUnitType::MESSAGE)
+	,type(t)
+	,text(m)
+	,raw(NULL)
+	,raw_size(0)
+	,path(p)
+	,thumbnail(th)
 	,percent(pcnt)
 	,callback(fn)
 	{}
 
+	// files and images go as an upload, a slice at a time, which the server can pick up where it left off if the connection goes
+	virtual WorkLane lane()const{
+		return type==MessageType::TEXT?WorkLane::INTERACTIVE:WorkLane::BULK;
+	}
+
 	const MessageType type;
 	const std::string text;
-	unsigned char *const raw;
+	unsigned char *const raw; // ChatService owns it once it's queued
 	const unsigned long long raw_size;
+	const std::string path; // files and images only, instead of <raw>
+	std::string transfer; // what the server knows the upload as, picked the first time it's sent
+	const std::vector<unsigned char> thumbnail; // images only
 	std::atomic<int> *const percent;
 	std::function<void(bool,const std::string&)> callback;
 };
 
 // for getting a file
+// either all at once through <callback>, a piece at a time through <sink> as it arrives, or to the file at <path>, then <done>
 struct ChatWorkUnitGetFile:ChatWorkUnit{
 	ChatWorkUnitGetFile(unsigned long long i, std::atomic<int> *pcnt, std::function<void(const unsigned char*,int)> fn)
 	:ChatWorkUnit(WorkUnitType::GET_FILE)
@@ -104,57 +174,162 @@ struct ChatWorkUnitGetFile:ChatWorkUnit{
 	,callback(fn)
 	{}
 
+	ChatWorkUnitGetFile(unsigned long long i, std::atomic<int> *pcnt, std::function<bool(const unsigned char*,int)> s, std::function<void(bool)> d)
+	:ChatWorkUnit(WorkUnitType::GET_FILE)
+	,id(i)
+	,percent(pcnt)
+	,sink(s)
+	,done(d)
+	{}
+
+	ChatWorkUnitGetFile(unsigned long long i, const std::string &p, std::atomic<int> *pcnt, std::function<void(bool)> d)
+	:ChatWorkUnit(WorkUnitType::GET_FILE)
+	,id(i)
+	,path(p)
+	,percent(pcnt)
+	,done(d)
+	{}
+
 	const unsigned long long id;
+	const std::string path; // can pick up where it left off if the connection goes, see ChatClient::get_file()
 	std::atomic<int> *const percent;
 	std::function<void(const unsigned char*,int)> callback;
+	std::function<bool(const unsigned char*,int)> sink;
+	std::function<void(bool)> done;
+};
+
+// for searching the subscribed chat
+struct ChatWorkUnitSearch:ChatWorkUnit{
+	ChatWorkUnitSearch(const std::string &q, unsigned long long o, unsigned c, std::function<void(bool,const std::string&,std::vector<Message>)> fn)
+	:ChatWorkUnit(WorkUnitType::SEARCH)
+	,query(q)
+	,offset(o)
+	,count(c)
+	,callback(fn)
+	{}
+
+	const std::string query;
+	const unsigned long long offset;
+	const unsigned count;
+	const std::function<void(bool,const std::string&,std::vector<Message>)> callback;
+};
+
+// for paging back through the subscribed chat
+struct ChatWorkUnitHistory:ChatWorkUnit{
+	ChatWorkUnitHistory(unsigned long long b, unsigned c, std::function<void(std::vector<Message>)> fn)
+	:ChatWorkUnit(WorkUnitType::HISTORY)
+	,before(b)
+	,count(c)
+	,callback(fn)
+	{}
+
+	const unsigned long long before;
+	const unsigned count;
+	const std::function<void(std::vector<Message>)> callback;
+};
+
+// for getting a thumbnail that was left out of a page of history
+struct ChatWorkUnitThumbnail:ChatWorkUnit{
+	ChatWorkUnitThumbnail(unsigned long long i, std::function<void(unsigned long long,std::vector<unsigned char>)> fn)
+	:ChatWorkUnit(WorkUnitType::THUMBNAIL)
+	,id(i)
+	,callback(fn)
+	{}
+
+	const unsigned long long id;
+	const std::function<void(unsigned long long,std::vector<unsigned char>)> callback;
+};
+
+// for sending the slice of upload <transfer> that starts at <offset>
+// each one queues the next, so whatever arrives in the other lanes in the meantime goes first
+struct ChatWorkUnitSlice:ChatWorkUnit{
+	ChatWorkUnitSlice(const std::string &t, unsigned long long o)
+	:ChatWorkUnit(WorkUnitType::SLICE)
+	,transfer(t)
+	,offset(o)
+	{}
+
+	const std::string transfer;
+	const unsigned long long offset;
 };
 
+// first in first out within a lane, see WorkLane, and in order across lanes around a barrier, see ChatWorkUnit::barrier()
+// every connection has one, they all notify the same wakeup, the one ChatLoop sleeps on
 class ChatWorkQueue{
 public:
+	explicit ChatWorkQueue(net::wakeup &w)
+		: wake(w)
+		, pushed(0)
+	{}
+
+	ChatWorkQueue(const ChatWorkQueue&) = delete;
+
 	~ChatWorkQueue(){
 		std::lock_guard<std::mutex> lock(mutex);
-		while(work.size() > 0){
-			const ChatWorkUnit *const unit = work.front();
-			work.pop();
-			delete unit;
+		for(std::queue<std::pair<unsigned long long, const ChatWorkUnit*>> &work : lanes){
+			while(work.size() > 0){
+				const ChatWorkUnit *const unit = work.front().second;
+				work.pop();
+				delete unit;
+			}
 		}
 	}
 
+	ChatWorkQueue &operator=(const ChatWorkQueue&) = delete;
+
+	// whoever waits on <wake> clears it before looking for work, so none is missed
 	void push(const ChatWorkUnit *unit){
-		{
-			std::lock_guard<std::mutex> lock(mutex);
-			work.push(unit);
-		}
+		std::lock_guard<std::mutex> lock(mutex);
+		const unsigned long long sequence = pushed++;
+		if(unit->barrier())
+			barriers.push(sequence);
 
-		cvar.notify_one();
+		lanes[static_cast<int>(unit->lane())].push({sequence, unit});
+		wake.notify();
 	}
 
-	const ChatWorkUnit *pop_wait(int millis){
-		auto predicate = [this]{
-			return work.size() != 0;
-		};
+	// the oldest unit in the most urgent lane that has any, NULL if there's nothing to do
+	// while a barrier is queued, that's only from what was queued before it, and then the barrier itself
+	const ChatWorkUnit *pop(){
+		std::lock_guard<std::mutex> lock(mutex);
+		const unsigned long long limit = barriers.size() > 0 ? barriers.front() : pushed;
 
-		std::chrono::duration<int, std::ratio<1, 1000>> timeout(millis);
+		for(std::queue<std::pair<unsigned long long, const ChatWorkUnit*>> &work : lanes){
+			if(work.size() > 0 && work.front().first < limit){
+				const ChatWorkUnit *unit = work.front().second;
+				work.pop();
+				return unit;
+			}
+		}
 
-		std::unique_lock<std::mutex> lock(mutex);
-		if(cvar.wait_for(lock, timeout, predicate)){
-			const ChatWorkUnit *unit = work.front();
-			work.pop();
-			return unit;
+		// everything before the barrier is out, so it's at the front of its lane
+		for(std::queue<std::pair<unsigned long long, const ChatWorkUnit*>> &work : lanes){
+			if(work.size() > 0 && work.front().first == limit){
+				const ChatWorkUnit *unit = work.front().second;
+				work.pop();
+				barriers.pop();
+				return unit;
+			}
 		}
-		else
-			return NULL;
+
+		return NULL;
 	}
 
 	int count(){
 		std::lock_guard<std::mutex> lock(mutex);
-		return work.size();
+		int total = 0;
+		for(const std::queue<std::pair<unsigned long long, const ChatWorkUnit*>> &work : lanes)
+			total += work.size();
+
+		return total;
 	}
 
 private:
-	std::condition_variable cvar;
+	net::wakeup &wake;
 	std::mutex mutex;
-	std::queue<const ChatWorkUnit*> work;
+	std::array<std::queue<std::pair<unsigned long long, const ChatWorkUnit*>>, 3> lanes; // indexed by WorkLane, each unit with the order it was pushed in
+	std::queue<unsigned long long> barriers; // where the barriers still queued are in that order
+	unsigned long long pushed; // how many units have been pushed, the next one's place in the order
 };
 
 #endif // CHATWORKUNIT_H
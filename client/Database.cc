@@ -1,5 +1,8 @@
 #include <fstream>
 #include <stdexcept>
+#include <algorithm>
+#include <thread>
+#include <chrono>
 
 #include "../chat.h"
 #include "log.h"
@@ -10,6 +13,9 @@ Database::Database(const std::string &dbpath){
 
 	db.open(dbpath);
 
+	// lets maintain() give space back a little at a time, only takes effect on a new file
+	db.execute("pragma auto_vacuum=incremental;");
+
 	if(create){
 		db.begin();
 
@@ -45,81 +51,119 @@ Database::Database(const std::string &dbpath){
 
 		db.commit();
 	}
+
+	// databases made before there were indexes get them here
+	db.execute("create index if not exists messages_chat on messages (servername, chatname, id);");
+	db.execute("create index if not exists messages_raw on messages (unixtime) where raw is not null;");
+	db.execute("create index if not exists chats_name on chats (servername, chatname);");
+
+	// maintenance writes from another connection, this way neither waits long on the other
+	{
+		lite3::statement wal(db, "pragma journal_mode=wal;");
+		wal.execute();
+	}
+	db.busy_timeout(5000);
+
+	background.open(dbpath);
+	background.busy_timeout(5000);
 }
 
-void Database::set_servername(const std::string &name){
-	servername=name;
+void Database::newmsg(const std::string &servername, const Message &msg, const std::string &chatname){
+	if(servername=="")
+		throw std::runtime_error(DB_ERRMSG("server name not set!"));
+
+	insert(servername, msg, chatname);
 }
 
-void Database::newmsg(const Message &msg, const std::string &chatname){
+// store a whole page of messages (a subscribe backlog, a resync) at once
+// one transaction instead of one per message, which would sync the disk every time
+void Database::newmsgs(const std::string &servername, const std::vector<Message> &msgs, const std::string &chatname){
 	if(servername=="")
 		throw std::runtime_error(DB_ERRMSG("server name not set!"));
 
-	const std::string insert =
-	"insert into messages values"
-	"(?,?,?,?,?,?,?,?);";
-	lite3::statement statement(db, insert);
+	if(msgs.size()==0)
+		return;
 
-	statement.bind(1, servername);
-	statement.bind(2, chatname);
-	statement.bind(3, static_cast<int>(msg.id));
-	statement.bind(4, static_cast<int>(msg.type));
-	statement.bind(5, static_cast<int>(msg.unixtime));
-	statement.bind(6, msg.msg);
-	statement.bind(7, msg.sender);
-	statement.bind(8, msg.raw, msg.raw_size);
+	db.begin();
 
-	statement.execute();
+	try
+	{
+		for(const Message &msg:msgs)
+			insert(servername, msg, chatname);
+	}
+	catch(const lite3::exception &e)
+	{
+		db.rollback();
+		throw;
+	}
+
+	db.commit();
 }
 
-// get messages in the chat
+// get the newest <count> messages in the chat older than message id <before>, oldest first
+// they come without their raw component (the thumbnail, for images), get_raw() has that
 // return empty list if chat doesn't exist
-std::vector<Message> Database::get_msgs(const std::string &chatname){
+std::vector<Message> Database::get_msgs(const std::string &servername, const std::string &chatname, unsigned count, unsigned long long before){
 	if(servername=="")
 		throw std::runtime_error(DB_ERRMSG("server name is not set!"));
 
-	// first, log the current chat name and server name into table "chats" if it doesn't already exist
-	log_chat(chatname);
-	// now allow the database to regulate its own size
-	regulate();
+	// log the current chat name and server name into table "chats" if it doesn't already exist
+	// so maintain() knows it is still in use
+	log_chat(servername, chatname);
 
 	const std::string query =
-	"select * from messages "
-	"where servername=? and chatname=?;";
+	"select id,type,unixtime,message,name from messages "
+	"where servername=? and chatname=? and id<? order by id desc limit ?;";
 	lite3::statement statement(db, query);
 
 	statement.bind(1, servername);
 	statement.bind(2, chatname);
+	statement.bind(3, (std::int64_t)std::min<unsigned long long>(before, INT64_MAX));
+	statement.bind(4, (std::int64_t)count);
 
 	std::vector<Message> msgs;
 
 	while(statement.execute()){
-		// get the raw component
-		const int raw_size = statement.blob_size(7);
-		const unsigned char *const r = (unsigned char*)statement.blob(7);
-		unsigned char *raw = NULL;
-		// have to copy it from sqlite's memory
-		if(r != NULL){
-			raw = new unsigned char[raw_size];
-			memcpy(raw, r, raw_size);
-		}
-
 		msgs.push_back({
-			(unsigned long long)statement.integer(2),
-			static_cast<MessageType>(statement.integer(3)),
-			statement.integer(4),
-			statement.str(5),
-			statement.str(6),
-			raw,
-			(decltype(Message::raw_size))raw_size
+			(unsigned long long)statement.integer(0),
+			static_cast<MessageType>(statement.integer(1)),
+			statement.integer(2),
+			statement.str(3),
+			statement.str(4),
+			NULL,
+			0
 		});
 	}
 
+	std::reverse(msgs.begin(), msgs.end());
 	return msgs;
 }
 
+// get the raw component of message <id> in the chat, empty if it doesn't have one
+std::vector<unsigned char> Database::get_raw(const std::string &servername, unsigned long long id, const std::string &chatname){
+	if(servername=="")
+		throw std::runtime_error(DB_ERRMSG("server name is not set!"));
+
+	const std::string query =
+	"select raw from messages where servername=? and chatname=? and id=?;";
+	lite3::statement statement(db, query);
+
+	statement.bind(1, servername);
+	statement.bind(2, chatname);
+	statement.bind(3, (std::int64_t)id);
+
+	std::vector<unsigned char> raw;
+	if(statement.execute()){
+		const unsigned char *const r = (unsigned char*)statement.blob(0);
+		if(r != NULL)
+			raw.assign(r, r + statement.blob_size(0));
+	}
+
+	return raw;
+}
+
 // get the id of the latest message received in chat <chatname>, return 0 if no <chatname>
-int Database::get_latest_msg(const std::string &chatname){
+int Database::get_latest_msg(const std::string &servername, const std::string &chatname){
 	if(servername=="")
 		throw std::runtime_error(DB_ERRMSG("servername not set!"));
 
@@ -138,7 +182,7 @@ int Database::get_latest_msg(const std::string &chatname){
 
 // insert <chatname> into the chats table if it doesn't already exist,
 // and update its last_login timestamp if it does
-void Database::log_chat(const std::string &chatname)
+void Database::log_chat(const std::string &servername, const std::string &chatname)
 {
 	const std::string query =
 	"select * from chats where chatname=? and servername=?;";
@@ -179,61 +223,216 @@ void Database::log_chat(const std::string &chatname)
 	}
 }
 
-// determine which chats haven't been logged into in a while
-// using (Database::stale(...))
-void Database::regulate()
-{
-	const std::string query =
-	"select * from chats;";
-	lite3::statement statement(db, query);
-
-	while(statement.execute())
+// keep the cache in check: forget chats that haven't been opened in CHAT_STALE_SECONDS,
+// and drop the oldest thumbnails past RAW_CACHE_BYTES, then give the space back to the file system
+// everything is done in small batches with rests in between, the worker thread only ever waits on one batch
+// stops early once <running> is cleared
+void Database::maintain(const std::atomic<bool> &running){
+	std::vector<std::pair<std::string, std::string>> stale;
 	{
-		const std::string chatname = statement.str(0);
-		const std::string server = statement.str(1);
-		const int unixtime = statement.integer(2);
+		const std::string query =
+		"select chatname,servername from chats where last_login<?;";
+		lite3::statement statement(background, query);
 
-		if(Database::stale(unixtime))
-			remove(chatname, server);
+		statement.bind(1, (std::int64_t)(time(NULL) - CHAT_STALE_SECONDS));
+
+		while(statement.execute())
+			stale.push_back({statement.str(0), statement.str(1)});
 	}
+
+	for(const auto &chat : stale){
+		if(!running.load())
+			return;
+
+		forget(chat.first, chat.second, running);
+	}
+
+	if(running.load())
+		trim_raw(running);
+
+	if(running.load())
+		vacuum(running);
 }
 
 // remove all messages from chatname and servername, and the entry from the chats table
-void Database::remove(const std::string &chatname, const std::string &server)
+void Database::forget(const std::string &chatname, const std::string &server, const std::atomic<bool> &running)
 {
 	log("deleting all messages from chatname: \"" + chatname + "\", servername: \"" + server + "\"");
-	// first remove all the appropriate messages
+
 	const std::string sql =
-	"delete from messages where chatname=? and servername=?;";
-	lite3::statement s1(db, sql);
+	"delete from messages where rowid in "
+	"(select rowid from messages where servername=? and chatname=? limit ?);";
+	lite3::statement statement(background, sql);
+
+	statement.bind(1, server);
+	statement.bind(2, chatname);
+	statement.bind(3, MAINTENANCE_BATCH);
+
+	do
+	{
+		statement.reset();
+		statement.execute();
 
-	s1.bind(1, chatname);
-	s1.bind(2, server);
+		Database::pause();
+	}while(background.changes() > 0 && running.load());
 
-	s1.execute();
+	if(!running.load())
+		return;
 
-	// remove the entry from the chats table
+	// unless it was opened again in the meantime
 	const std::string sql2 =
-	"delete from chats where chatname=? and servername=?";
-	lite3::statement s2(db, sql2);
+	"delete from chats where chatname=? and servername=? and last_login<?";
+	lite3::statement s2(background, sql2);
 
 	s2.bind(1, chatname);
 	s2.bind(2, server);
+	s2.bind(3, (std::int64_t)(time(NULL) - CHAT_STALE_SECONDS));
 
 	s2.execute();
 }
 
+// drop the oldest thumbnails until the rest fit in RAW_CACHE_BYTES
+// they're the only thing in the cache that takes up real space, and the server still has them
+void Database::trim_raw(const std::atomic<bool> &running)
+{
+	long long total;
+	{
+		lite3::statement statement(background, "select coalesce(sum(length(raw)),0) from messages where raw is not null;");
+		statement.execute();
+		total = statement.long_integer(0);
+	}
+
+	if(total <= RAW_CACHE_BYTES)
+		return;
+
+	log("dropping " + std::to_string(total - RAW_CACHE_BYTES) + " bytes of cached thumbnails");
+
+	lite3::statement oldest(background, "select rowid,length(raw) from messages where raw is not null order by unixtime limit ?;");
+	lite3::statement drop(background, "update messages set raw=null where rowid=?;");
+
+	oldest.bind(1, MAINTENANCE_BATCH);
+
+	while(total > RAW_CACHE_BYTES && running.load())
+	{
+		std::vector<std::int64_t> rows;
+
+		oldest.reset();
+		while(total > RAW_CACHE_BYTES && oldest.execute())
+		{
+			rows.push_back(oldest.long_integer(0));
+			total -= oldest.long_integer(1);
+		}
+		oldest.reset();
+
+		if(rows.size() == 0)
+			break;
+
+		background.begin();
+		try
+		{
+			for(const std::int64_t row : rows)
+			{
+				drop.reset();
+				drop.bind(1, row);
+				drop.execute();
+			}
+		}
+		catch(const lite3::exception &e)
+		{
+			background.rollback();
+			throw;
+		}
+		background.commit();
+
+		Database::pause();
+	}
+}
+
+// give the free pages back to the file system, a step at a time
+void Database::vacuum(const std::atomic<bool> &running)
+{
+	int mode;
+	{
+		lite3::statement statement(background, "pragma auto_vacuum;");
+		statement.execute();
+		mode = statement.integer(0);
+	}
+
+	if(mode == 2) // incremental
+	{
+		while(running.load())
+		{
+			{
+				lite3::statement free(background, "pragma freelist_count;");
+				free.execute();
+				if(free.integer(0) == 0)
+					break;
+			}
+
+			lite3::statement step(background, "pragma incremental_vacuum(" + std::to_string(VACUUM_STEP_PAGES) + ");");
+			while(step.execute());
+
+			Database::pause();
+		}
+
+		return;
+	}
+
+	long long free_pages, pages;
+	{
+		lite3::statement free(background, "pragma freelist_count;");
+		free.execute();
+		free_pages = free.long_integer(0);
+
+		lite3::statement count(background, "pragma page_count;");
+		count.execute();
+		pages = count.long_integer(0);
+	}
+
+	if(free_pages == 0 || free_pages * COMPACT_FREE_RATIO < pages)
+		return;
+
+	// older databases were made without incremental vacuum, it can only be turned on by a full vacuum
+	// this one time, the worker thread waits for it
+	log("compacting the message cache, " + std::to_string(free_pages) + " free pages");
+	background.execute("pragma auto_vacuum=incremental;");
+	background.execute("vacuum;");
+}
+
+// add <msg> to the messages table
+void Database::insert(const std::string &servername, const Message &msg, const std::string &chatname)
+{
+	if(!inserter)
+	{
+		const std::string insert =
+		"insert into messages values"
+		"(?,?,?,?,?,?,?,?);";
+		inserter.reset(new lite3::statement(db, insert));
+	}
+
+	lite3::statement &statement = *inserter;
+	statement.reset();
+
+	statement.bind(1, servername);
+	statement.bind(2, chatname);
+	statement.bind(3, static_cast<int>(msg.id));
+	statement.bind(4, static_cast<int>(msg.type));
+	statement.bind(5, static_cast<int>(msg.unixtime));
+	statement.bind(6, msg.msg);
+	statement.bind(7, msg.sender);
+	statement.bind(8, msg.raw, msg.raw_size);
+
+	statement.execute();
+}
+
 // see if file exists
 bool Database::file_exists(const std::string &dbpath){
 	std::ifstream ifs(dbpath);
 	return !!ifs;
 }
 
-bool Database::stale(int unixtime)
+// rest between maintenance steps
+void Database::pause()
 {
-	const int now = time(NULL);
-
-	const int stale_seconds = 2592000; // seconds in a month
-
-	return now - unixtime > stale_seconds;
+	std::this_thread::sleep_for(std::chrono::milliseconds(MAINTENANCE_PAUSE_MS));
 }
@@ -4,11 +4,26 @@
 #include <string>
 #include <exception>
 #include <vector>
+#include <memory>
+#include <climits>
+#include <atomic>
 
+#include "../chat.h"
 #include "lite3.hpp"
 
 #define DB_ERRMSG(x) (std::string(__FILE__)+":"+std::to_string(__LINE__)+" "+x)
 
+// what maintain() keeps
+#define CHAT_STALE_SECONDS 2592000 // chats that haven't been opened in a month are forgotten
+#define RAW_CACHE_BYTES (64*1024*1024) // thumbnails kept, the oldest are dropped past this (the server still has them)
+
+#define MAINTENANCE_BATCH 500 // rows changed per transaction
+#define MAINTENANCE_PAUSE_MS 20 // rest between batches and vacuum steps
+#define VACUUM_STEP_PAGES 256 // pages freed per incremental vacuum step
+#define COMPACT_FREE_RATIO 4 // databases without incremental vacuum are compacted once 1/N of their pages are free
+
+// every server's messages go in the one file, each call says which server it's about
+// one thread at a time, apart from maintain()
 class Database{
 public:
 	explicit Database(const std::string&);
@@ -16,22 +31,27 @@ public:
 
 	Database &operator=(const Database&)=delete;
 
-	void set_servername(const std::string&);
-	void newmsg(const Message&,const std::string&);
-	std::vector<Message> get_msgs(const std::string&);
-	int get_latest_msg(const std::string&);
+	void newmsg(const std::string&,const Message&,const std::string&);
+	void newmsgs(const std::string&,const std::vector<Message>&,const std::string&);
+	std::vector<Message> get_msgs(const std::string&,const std::string&,unsigned,unsigned long long = ULLONG_MAX);
+	std::vector<unsigned char> get_raw(const std::string&,unsigned long long,const std::string&);
+	int get_latest_msg(const std::string&,const std::string&);
+	void maintain(const std::atomic<bool>&);
 
 private:
-	void log_chat(const std::string&);
-	void regulate();
-	void remove(const std::string&, const std::string&);
+	void log_chat(const std::string&,const std::string&);
+	void insert(const std::string&,const Message&,const std::string&);
+	void forget(const std::string&, const std::string&, const std::atomic<bool>&);
+	void trim_raw(const std::atomic<bool>&);
+	void vacuum(const std::atomic<bool>&);
 
 	static std::string escape_table_name(const std::string&);
 	static bool file_exists(const std::string&);
-	static bool stale(int);
+	static void pause();
 
-	std::string servername;
 	lite3::connection db;
+	lite3::connection background; // only maintain() uses this one, from its own thread
+	std::unique_ptr<lite3::statement> inserter; // prepared once, reused by every insert
 };
 
 #endif // DATABASE_H
@@ -0,0 +1,342 @@
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+
+#include "Cli.h"
+
+Cli::Cli(ChatClient &c,int seconds):client(c),timeout(seconds),incoming(std::make_shared<Tail>()){
+}
+
+// run the command in <words>, the first of which is its name
+// returns false if it didn't work, or wasn't a command
+bool Cli::run(const std::vector<std::string> &words){
+	if(words.empty())
+		return true;
+
+	const std::string &command=words[0];
+	const size_t args=words.size()-1;
+
+	// everything after the first <from> words, as one string
+	auto rest=[&words](size_t from){
+		std::string text;
+		for(size_t i=from;i<words.size();++i)
+			text+=(i>from?" ":"")+words[i];
+
+		return text;
+	};
+
+	try{
+		if(command=="connect"&&args==2)
+			return connect(words[1],words[2]);
+		if(command=="chats"&&args==0)
+			return chats();
+		if(command=="create"&&args>=1)
+			return create(words[1],rest(2));
+		if(command=="join"&&args==1)
+			return join(words[1]);
+		if(command=="say"&&args>=1)
+			return say(rest(1));
+		if(command=="image"&&(args==1||args==2))
+			return image(words[1],args==2?words[2]:"");
+		if(command=="file"&&args==1)
+			return file(words[1]);
+		if(command=="fetch"&&args==2)
+			return fetch(std::stoull(words[1]),words[2]);
+		if(command=="search"&&args>=1)
+			return search(rest(1));
+		if(command=="history"&&(args==1||args==2))
+			return history(std::stoul(words[1]),args==2?std::stoull(words[2]):ULLONG_MAX);
+		if(command=="tail"&&args<=2)
+			return tail(args>=1?std::stoi(words[1]):0,args==2?std::stoull(words[2]):0);
+		if(command=="status"&&args==0)
+			return status();
+	}catch(const std::logic_error &e){
+		// std::stoi and friends, on something that isn't a number
+	}
+
+	emit(event("error").add("error","bad command \""+rest(0)+"\""));
+	return false;
+}
+
+// the start of a line of output, the time is in milliseconds since the epoch
+Json Cli::event(const std::string &name){
+	const long long now=std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	return Json().add("event",name).add("ms",now);
+}
+
+// write <json> as a line of its own, callbacks from the client's thread don't get mixed in with it
+void Cli::emit(const Json &json){
+	static std::mutex mutex;
+	std::lock_guard<std::mutex> lock(mutex);
+
+	std::cout<<json.str()<<std::endl;
+}
+
+// connect to the server at <address> as <name>, and get its chat list, which the rest of the commands need
+bool Cli::connect(const std::string &address,const std::string &name){
+	auto pending=std::make_shared<Pending>();
+	client.connect(address,name,[pending](bool ok,const std::string &validated){
+		pending->finish(ok,Json().add("name",validated));
+	});
+
+	if(wait(*pending)&&pending->ok){
+		auto list=std::make_shared<Pending>();
+		client.list_chats([list](std::vector<Chat> chats){
+			list->finish(true,Json().add("chats",(int)chats.size()));
+		},[](Chat chat){
+			created(chat);
+		});
+
+		const bool listed=wait(*list);
+
+		std::lock_guard<std::mutex> lock(pending->mutex);
+		if(!listed){
+			pending->ok=false;
+			pending->result.add("error","timed out getting the chat list");
+		}
+		pending->result.merge(list->result);
+	}
+
+	return report("connect",*pending);
+}
+
+// the server's chat list
+bool Cli::chats(){
+	auto pending=std::make_shared<Pending>();
+	client.list_chats([pending](std::vector<Chat> chats){
+		std::vector<Json> list;
+		for(const Chat &chat:chats)
+			list.push_back(describe(chat));
+
+		pending->finish(true,Json().add("chats",list));
+	},[](Chat chat){
+		created(chat);
+	});
+
+	wait(*pending);
+	return report("chats",*pending);
+}
+
+// have the server make a new chat
+bool Cli::create(const std::string &name,const std::string &description){
+	auto pending=std::make_shared<Pending>();
+	client.newchat(name,description,[pending,name](bool ok){
+		pending->finish(ok,Json().add("chat",name));
+	});
+
+	wait(*pending);
+	return report("create",*pending);
+}
+
+// subscribe to chat <name>, messages are written out as they arrive from then on
+// the result has the messages already stored for it, what's new since comes after as it would anyway
+bool Cli::join(const std::string &name){
+	auto pending=std::make_shared<Pending>();
+	client.subscribe(name,[pending,name](bool ok,std::vector<Message> stored){
+		std::vector<Json> history;
+		for(const Message &msg:stored)
+			history.push_back(describe(msg));
+
+		pending->finish(ok,Json().add("chat",name).add("history",history));
+	},[incoming=incoming,name](Message msg){
+		message(*incoming,name,msg);
+	});
+
+	wait(*pending);
+	return report("join",*pending);
+}
+
+// post a text message to the joined chat
+bool Cli::say(const std::string &text){
+	auto pending=std::make_shared<Pending>();
+	client.send(text,[pending](bool ok,const std::string &err){
+		pending->finish(ok,Json().add("error",err));
+	});
+
+	wait(*pending);
+	return report("say",*pending);
+}
+
+// post the image at <path>, with the image at <thumbnail> (if there is one) as its thumbnail
+// without one it has to be small enough to be its own, see MAX_THUMBNAIL_BYTES
+bool Cli::image(const std::string &path,const std::string &thumbnail){
+	std::vector<unsigned char> thumb;
+	if(!thumbnail.empty()){
+		std::ifstream in(thumbnail,std::ifstream::binary);
+		thumb.assign(std::istreambuf_iterator<char>(in),std::istreambuf_iterator<char>());
+
+		if(!in.eof()||thumb.empty()){
+			emit(event("image").add("ok",false).add("path",path).add("error","Couldn't read \""+thumbnail+"\""));
+			return false;
+		}
+	}
+
+	auto pending=std::make_shared<Pending>();
+	client.send_image(filename(path),path,thumb,pending->percent,[pending,path](bool ok,const std::string &err){
+		pending->finish(ok,Json().add("path",path).add("error",err));
+	});
+
+	wait(*pending);
+	return report("image",*pending);
+}
+
+// post the file at <path>
+bool Cli::file(const std::string &path){
+	auto pending=std::make_shared<Pending>();
+	client.send_file(filename(path),path,pending->percent,[pending,path](bool ok,const std::string &err){
+		pending->finish(ok,Json().add("path",path).add("error",err));
+	});
+
+	wait(*pending);
+	return report("file",*pending);
+}
+
+// download the file or image of message <id> to <path>
+bool Cli::fetch(unsigned long long id,const std::string &path){
+	auto pending=std::make_shared<Pending>();
+	client.get_file(id,path,pending->percent,[pending,id,path](bool ok){
+		pending->finish(ok,Json().add("id",id).add("path",path));
+	});
+
+	wait(*pending);
+	return report("fetch",*pending);
+}
+
+// the best matches for <query> in the joined chat
+bool Cli::search(const std::string &query){
+	auto pending=std::make_shared<Pending>();
+	client.search(query,0,MAX_SEARCH_RESULTS,[pending](bool ok,const std::string &err,std::vector<Message> found){
+		std::vector<Json> results;
+		for(const Message &msg:found)
+			results.push_back(describe(msg));
+
+		pending->finish(ok,Json().add("error",err).add("results",results));
+	});
+
+	wait(*pending);
+	return report("search",*pending);
+}
+
+// the <count> stored messages of the joined chat before message id <before>
+bool Cli::history(unsigned count,unsigned long long before){
+	auto pending=std::make_shared<Pending>();
+	client.history(before,count,[pending](std::vector<Message> stored){
+		std::vector<Json> messages;
+		for(const Message &msg:stored)
+			messages.push_back(describe(msg));
+
+		pending->finish(true,Json().add("messages",messages));
+	});
+
+	wait(*pending);
+	return report("history",*pending);
+}
+
+// let messages come in for <seconds>, or until <count> of them have, whichever is first (0 for no limit)
+bool Cli::tail(int seconds,unsigned long long count){
+	std::unique_lock<std::mutex> lock(incoming->mutex);
+	const unsigned long long start=incoming->received;
+	const auto enough=[this,start,count]{
+		return count>0&&incoming->received-start>=count;
+	};
+
+	if(seconds>0)
+		incoming->arrived.wait_for(lock,std::chrono::seconds(seconds),enough);
+	else
+		incoming->arrived.wait(lock,enough);
+
+	const unsigned long long got=incoming->received-start;
+	lock.unlock();
+
+	emit(event("tail").add("ok",true).add("messages",got));
+	return true;
+}
+
+// whether the client is connected right now
+bool Cli::status(){
+	emit(event("status").add("ok",true).add("connected",client.connected()));
+	return true;
+}
+
+// wait for <pending>, false if it takes longer than <timeout>
+bool Cli::wait(Pending &pending){
+	std::unique_lock<std::mutex> lock(pending.mutex);
+	if(timeout>0)
+		return pending.cvar.wait_for(lock,std::chrono::seconds(timeout),[&pending]{ return pending.done; });
+
+	pending.cvar.wait(lock,[&pending]{ return pending.done; });
+	return true;
+}
+
+// write out how <command> went, once it's done or has been given up on
+bool Cli::report(const std::string &command,Pending &pending){
+	std::lock_guard<std::mutex> lock(pending.mutex);
+
+	Json line=event(command);
+	if(!pending.done)
+		line.add("ok",false).add("error","timed out");
+	else
+		line.add("ok",pending.ok).merge(pending.result);
+
+	emit(line);
+	return pending.done&&pending.ok;
+}
+
+// the server announced a new chat
+void Cli::created(const Chat &chat){
+	emit(event("chat_created").merge(describe(chat)));
+}
+
+// a message came in for chat <chat>
+void Cli::message(Tail &tail,const std::string &chat,const Message &msg){
+	emit(event("message").add("chat",chat).merge(describe(msg)));
+
+	{
+		std::lock_guard<std::mutex> lock(tail.mutex);
+		++tail.received;
+	}
+	tail.arrived.notify_all();
+}
+
+Json Cli::describe(const Message &msg){
+	const char *type="text";
+	if(msg.type==MessageType::IMAGE)
+		type="image";
+	else if(msg.type==MessageType::FILE)
+		type="file";
+
+	Json json;
+	json.add("id",msg.id).add("type",type).add("time",msg.unixtime).add("sender",msg.sender).add("text",msg.msg);
+
+	// images come with their thumbnail, most of the time
+	if(msg.type==MessageType::IMAGE)
+		json.add("thumbnail",msg.raw_size);
+
+	return json;
+}
+
+Json Cli::describe(const Chat &chat){
+	return Json().add("id",(long long)chat.id).add("name",chat.name).add("creator",chat.creator).add("description",chat.description);
+}
+
+// what the server shows <path> as
+std::string Cli::filename(const std::string &path){
+	const size_t slash=path.find_last_of("/\\");
+	return slash==std::string::npos?path:path.substr(slash+1);
+}
+
+// the first result counts, a reintroduce calls the connect callback again
+void Cli::Pending::finish(bool worked,const Json &json){
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if(done)
+			return;
+
+		done=true;
+		ok=worked;
+		result=json;
+	}
+	cvar.notify_all();
+}
@@ -0,0 +1,73 @@
+#ifndef CLI_H
+#define CLI_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "../ChatClient.h"
+#include "Json.h"
+
+// drives a ChatClient with commands, one at a time, each waiting on the server's answer
+// everything that happens is written to stdout as a line of json, see usage() in main.cc
+class Cli{
+public:
+	Cli(ChatClient&,int);
+	Cli(const Cli&)=delete;
+	Cli &operator=(const Cli&)=delete;
+	bool run(const std::vector<std::string>&);
+
+	static Json event(const std::string&);
+	static void emit(const Json&);
+
+private:
+	// a command waiting on its callback, which may come after the command has given up on it
+	struct Pending{
+		void finish(bool,const Json& = Json());
+
+		std::mutex mutex;
+		std::condition_variable cvar;
+		bool done=false;
+		bool ok=false;
+		Json result;
+		std::atomic<int> percent{0}; // transfers keep a pointer to it until they're through
+	};
+
+	// messages that came in, for tail()
+	// the client's callbacks share it, they can outlive the Cli while the client shuts down
+	struct Tail{
+		std::mutex mutex;
+		std::condition_variable arrived;
+		unsigned long long received=0; // guarded by <mutex>
+	};
+
+	bool connect(const std::string&,const std::string&);
+	bool chats();
+	bool create(const std::string&,const std::string&);
+	bool join(const std::string&);
+	bool say(const std::string&);
+	bool image(const std::string&,const std::string&);
+	bool file(const std::string&);
+	bool fetch(unsigned long long,const std::string&);
+	bool search(const std::string&);
+	bool history(unsigned,unsigned long long);
+	bool tail(int,unsigned long long);
+	bool status();
+	bool wait(Pending&);
+	bool report(const std::string&,Pending&);
+
+	static void created(const Chat&);
+	static void message(Tail&,const std::string&,const Message&);
+	static Json describe(const Message&);
+	static Json describe(const Chat&);
+	static std::string filename(const std::string&);
+
+	ChatClient &client;
+	const int timeout; // seconds a command waits on the server, 0 for as long as it takes
+	const std::shared_ptr<Tail> incoming;
+};
+
+#endif // CLI_H
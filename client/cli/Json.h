@@ -0,0 +1,107 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <string>
+#include <vector>
+#include <cstdio>
+
+// just enough json to write an object, built up a field at a time
+class Json{
+public:
+	Json &add(const std::string &key,const std::string &value){
+		return raw(key,quote(value));
+	}
+
+	Json &add(const std::string &key,const char *value){
+		return raw(key,quote(value));
+	}
+
+	Json &add(const std::string &key,bool value){
+		return raw(key,value?"true":"false");
+	}
+
+	Json &add(const std::string &key,int value){
+		return raw(key,std::to_string(value));
+	}
+
+	Json &add(const std::string &key,long long value){
+		return raw(key,std::to_string(value));
+	}
+
+	Json &add(const std::string &key,unsigned long long value){
+		return raw(key,std::to_string(value));
+	}
+
+	Json &add(const std::string &key,const std::vector<Json> &values){
+		std::string array="[";
+		for(const Json &value:values){
+			if(array.size()>1)
+				array+=",";
+			array+=value.str();
+		}
+
+		return raw(key,array+"]");
+	}
+
+	// the fields of <other> as well
+	Json &merge(const Json &other){
+		if(!other.body.empty()){
+			if(!body.empty())
+				body+=",";
+			body+=other.body;
+		}
+
+		return *this;
+	}
+
+	std::string str()const{
+		return "{"+body+"}";
+	}
+
+	// <value> as a json string, the bytes of utf-8 go through as they are
+	static std::string quote(const std::string &value){
+		std::string quoted="\"";
+		for(const char c:value){
+			switch(c){
+			case '"':
+				quoted+="\\\"";
+				break;
+			case '\\':
+				quoted+="\\\\";
+				break;
+			case '\n':
+				quoted+="\\n";
+				break;
+			case '\r':
+				quoted+="\\r";
+				break;
+			case '\t':
+				quoted+="\\t";
+				break;
+			default:
+				if((unsigned char)c<0x20){
+					char escaped[7];
+					std::snprintf(escaped,sizeof(escaped),"\\u%04x",(unsigned)c);
+					quoted+=escaped;
+				}
+				else
+					quoted+=c;
+			}
+		}
+
+		return quoted+"\"";
+	}
+
+private:
+	Json &raw(const std::string &key,const std::string &value){
+		if(!body.empty())
+			body+=",";
+		body+=quote(key)+":"+value;
+
+		return *this;
+	}
+
+	std::string body;
+};
+
+#endif // JSON_H
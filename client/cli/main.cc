@@ -0,0 +1,135 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Cli.h"
+
+static void usage(){
+	std::cout<<"usage: chat-cli [--option value ...] [command [argument ...]]"<<std::endl;
+	std::cout<<"runs the command given, or the ones on stdin (one per line, \"quoted\" arguments may have spaces) until quit"<<std::endl;
+	std::cout<<"everything that happens is written to stdout as a line of json, an \"event\" and when (\"ms\" since the epoch)"<<std::endl;
+	std::cout<<"options:"<<std::endl;
+	std::cout<<"  --server ADDRESS (127.0.0.1) --name NAME (chat-cli) connect here first"<<std::endl;
+	std::cout<<"  --chat NAME                  then join this chat"<<std::endl;
+	std::cout<<"  --db PATH (chat-cli.db)      local message cache"<<std::endl;
+	std::cout<<"  --timeout SECONDS (60)       longest a command waits on the server, 0 for no limit"<<std::endl;
+	std::cout<<"commands:"<<std::endl;
+	std::cout<<"  connect ADDRESS NAME         connect to another server"<<std::endl;
+	std::cout<<"  chats                        the server's chats"<<std::endl;
+	std::cout<<"  create NAME [DESCRIPTION]    make a new chat"<<std::endl;
+	std::cout<<"  join NAME                    subscribe to a chat, its messages are written out as \"message\" events from then on"<<std::endl;
+	std::cout<<"  say TEXT                     post a text message"<<std::endl;
+	std::cout<<"  image PATH [THUMBNAIL]       post an image, without a THUMBNAIL one over 64KB goes out with none"<<std::endl;
+	std::cout<<"  file PATH                    post a file"<<std::endl;
+	std::cout<<"  fetch ID PATH                download the file or image of message ID"<<std::endl;
+	std::cout<<"  search QUERY                 search the joined chat"<<std::endl;
+	std::cout<<"  history COUNT [BEFORE]       stored messages of the joined chat, before message id BEFORE"<<std::endl;
+	std::cout<<"  tail [SECONDS] [COUNT]       wait for messages, for SECONDS or until COUNT have come in (0 or none for no limit)"<<std::endl;
+	std::cout<<"  status                       whether it's connected"<<std::endl;
+	std::cout<<"  quit"<<std::endl;
+}
+
+// split <line> at spaces, except in "double quotes", which can have \" and \\ in them
+static std::vector<std::string> split(const std::string &line){
+	std::vector<std::string> words;
+	std::string word;
+	bool quoted=false;
+	bool started=false;
+
+	for(size_t i=0;i<line.size();++i){
+		const char c=line[i];
+
+		if(quoted){
+			if(c=='\\'&&i+1<line.size()&&(line[i+1]=='"'||line[i+1]=='\\'))
+				word+=line[++i];
+			else if(c=='"')
+				quoted=false;
+			else
+				word+=c;
+		}
+		else if(c=='"'){
+			quoted=true;
+			started=true;
+		}
+		else if(c==' '||c=='\t'||c=='\r'){
+			if(started)
+				words.push_back(word);
+			word.clear();
+			started=false;
+		}
+		else{
+			word+=c;
+			started=true;
+		}
+	}
+
+	if(started)
+		words.push_back(word);
+
+	return words;
+}
+
+int main(int argc,char **argv){
+	std::string server="127.0.0.1";
+	std::string name="chat-cli";
+	std::string chat;
+	std::string db="chat-cli.db";
+	int timeout=60;
+
+	int i=1;
+	try{
+		for(;i<argc&&std::string(argv[i]).rfind("--",0)==0;i+=2){
+			const std::string option=argv[i];
+			if(i+1>=argc){
+				usage();
+				return 1;
+			}
+
+			const std::string value=argv[i+1];
+			if(option=="--server")
+				server=value;
+			else if(option=="--name")
+				name=value;
+			else if(option=="--chat")
+				chat=value;
+			else if(option=="--db")
+				db=value;
+			else if(option=="--timeout")
+				timeout=std::stoi(value);
+			else{
+				usage();
+				return 1;
+			}
+		}
+	}catch(const std::logic_error &e){
+		usage();
+		return 1;
+	}
+
+	ChatClient client(db);
+	Cli cli(client,timeout);
+
+	if(!cli.run({"connect",server,name}))
+		return 1;
+	if(!chat.empty()&&!cli.run({"join",chat}))
+		return 1;
+
+	// just the one
+	if(i<argc)
+		return cli.run(std::vector<std::string>(argv+i,argv+argc))?0:1;
+
+	// a script, which keeps going past commands that fail
+	bool good=true;
+	std::string line;
+	while(std::getline(std::cin,line)){
+		const std::vector<std::string> words=split(line);
+		if(words.empty()||words[0][0]=='#')
+			continue;
+		if(words[0]=="quit")
+			break;
+
+		good=cli.run(words)&&good;
+	}
+
+	return good?0:1;
+}
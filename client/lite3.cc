@@ -58,6 +58,18 @@ void lite3::connection::open(const std::string &filepath)
 	}
 }
 
+// wait up to <millis> milliseconds for other connections to release their locks
+void lite3::connection::busy_timeout(int millis)
+{
+	sqlite3_busy_timeout(conn, millis);
+}
+
+// rows changed by the most recent insert, update or delete
+int lite3::connection::changes()
+{
+	return sqlite3_changes(conn);
+}
+
 void lite3::connection::close()
 {
 	if(conn != NULL)
@@ -142,6 +154,12 @@ bool lite3::statement::execute()
 	return result == SQLITE_ROW;
 }
 
+// get the statement ready to be executed again, bindings are kept
+void lite3::statement::reset()
+{
+	sqlite3_reset(stmt);
+}
+
 void lite3::statement::bind(int column, const void *blob, int size)
 {
 	if(sqlite3_bind_blob(stmt, column, blob, size, SQLITE_TRANSIENT) != SQLITE_OK)
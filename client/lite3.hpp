@@ -57,6 +57,8 @@ namespace lite3{
 		connection& operator=(connection&&);
 
 		void open(const std::string&);
+		void busy_timeout(int);
+		int changes();
 		void execute(const std::string&);
 		void close();
 		void begin();
@@ -79,6 +81,7 @@ namespace lite3{
 		statement &operator=(statement&&) = delete;
 
 		bool execute();
+		void reset();
 
 		void bind(int, const void*, int);
 		void bind(int, double);
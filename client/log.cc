@@ -3,14 +3,15 @@
 
 #include "log.h"
 
+// stderr, stdout is left to the front end (chat-cli writes its json there)
 static std::mutex out_lock;
 
 void log(const std::string &line){
 	std::lock_guard<std::mutex> lock(out_lock);
-	std::cout<<line<<std::endl;
+	std::cerr<<line<<std::endl;
 }
 
 void log_error(const std::string &line){
 	std::lock_guard<std::mutex> lock(out_lock);
-	std::cout<<"\033[33;1merror:\033[0m "<<line<<std::endl;
+	std::cerr<<"\033[33;1merror:\033[0m "<<line<<std::endl;
 }
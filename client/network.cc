@@ -9,6 +9,11 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <ifaddrs.h>
+#include <poll.h>
+#endif
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <cstdint>
 #endif
 
 #include <stdlib.h>
@@ -411,7 +416,12 @@ int net::tcp::send_nonblock(const void *buffer,unsigned size){
 
 	set_blocking(false);
 
+#ifdef MSG_NOSIGNAL
+	// writing to a server that went away would otherwise kill the whole program with SIGPIPE, instead of letting it reconnect
+	int sent=::send(sock,(const char*)buffer,size,MSG_NOSIGNAL);
+#else
 	int sent=::send(sock,(const char*)buffer,size,0);
+#endif // MSG_NOSIGNAL
 	if(sent==-1){
 #ifdef _WIN32
 		if(WSAGetLastError()==WSAEWOULDBLOCK){
@@ -562,6 +572,149 @@ bool net::tcp::writable(){
 	return FD_ISSET(sock, &set) != 0;
 }
 
+// forget everything add()ed, to start on the next wait()
+void net::poller::clear(){
+	fds.clear();
+}
+
+// watch <socket> for <interest>, some combination of READABLE and WRITABLE
+// returns the index to pass events(), -1 if it isn't open
+int net::poller::add(const tcp &socket,int interest){
+	if(socket.sock==-1)
+		return -1;
+
+	fds.push_back({});
+	fds.back().fd=socket.sock;
+	fds.back().events=((interest&READABLE)?POLLIN:0)|((interest&WRITABLE)?POLLOUT:0);
+	fds.back().revents=0;
+
+	return fds.size()-1;
+}
+
+// watch <wake> for notify()
+int net::poller::add(const wakeup &wake){
+	fds.push_back({});
+	fds.back().fd=wake.readable;
+	fds.back().events=POLLIN;
+	fds.back().revents=0;
+
+	return fds.size()-1;
+}
+
+// sleep until something added has happened, or <millis> is up (-1 waits forever)
+void net::poller::wait(int millis){
+#ifdef _WIN32
+	// WSAPoll won't wait on nothing
+	if(fds.empty()){
+		Sleep(millis<0?INFINITE:millis);
+		return;
+	}
+	const int result=WSAPoll(fds.data(),fds.size(),millis);
+#else
+	const int result=::poll(fds.data(),fds.size(),millis);
+#endif // _WIN32
+
+	// nothing happened to any of them
+	if(result<=0){
+		for(auto &fd:fds)
+			fd.revents=0;
+	}
+}
+
+// what happened to the socket at <index> during the last wait(), a notified wakeup is READABLE
+// an error or hang up counts as everything it was watched for, the next send or recv finds out which
+int net::poller::events(int index)const{
+	if(index<0||index>=(int)fds.size())
+		return 0;
+
+	const auto &fd=fds[index];
+	int events=0;
+	if(fd.revents&(POLLERR|POLLHUP|POLLNVAL))
+		events|=((fd.events&POLLIN)?READABLE:0)|((fd.events&POLLOUT)?WRITABLE:0);
+	if(fd.revents&POLLIN)
+		events|=READABLE;
+	if(fd.revents&POLLOUT)
+		events|=WRITABLE;
+
+	return events;
+}
+
+net::wakeup::wakeup(){
+#if defined(_WIN32)
+	readable=socket(AF_INET,SOCK_DGRAM,IPPROTO_UDP);
+
+	sockaddr_in addr;
+	memset(&addr,0,sizeof(addr));
+	addr.sin_family=AF_INET;
+	addr.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+	addr.sin_port=0;
+
+	// bind to any free port, then talk to it
+	int len=sizeof(addr);
+	::bind(readable,(sockaddr*)&addr,sizeof(addr));
+	getsockname(readable,(sockaddr*)&addr,&len);
+	::connect(readable,(sockaddr*)&addr,sizeof(addr));
+
+	u_long nonblock=1;
+	ioctlsocket(readable,FIONBIO,&nonblock);
+
+	writable=readable;
+#elif defined(__linux__)
+	readable=writable=eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC);
+#else
+	int fds[2]={-1,-1};
+	if(pipe(fds)==0){
+		fcntl(fds[0],F_SETFL,fcntl(fds[0],F_GETFL,0)|O_NONBLOCK);
+		fcntl(fds[1],F_SETFL,fcntl(fds[1],F_GETFL,0)|O_NONBLOCK);
+	}
+
+	readable=fds[0];
+	writable=fds[1];
+#endif
+}
+
+net::wakeup::~wakeup(){
+#ifdef _WIN32
+	::closesocket(readable);
+#else
+	::close(readable);
+	if(writable!=readable)
+		::close(writable);
+#endif // _WIN32
+}
+
+// wake up whoever is (or next will be) waiting on this
+void net::wakeup::notify(){
+#if defined(_WIN32)
+	const char c=0;
+	::send(writable,&c,1,0);
+#elif defined(__linux__)
+	const std::uint64_t one=1;
+	const ssize_t written=::write(writable,&one,sizeof(one));
+	(void)written;
+#else
+	const char c=0;
+	const ssize_t written=::write(writable,&c,1);
+	(void)written;
+#endif
+}
+
+// stop waking anyone up, until the next notify()
+void net::wakeup::clear(){
+#if defined(__linux__)
+	std::uint64_t count;
+	const ssize_t got=::read(readable,&count,sizeof(count));
+	(void)got;
+#else
+	char buffer[64];
+#ifdef _WIN32
+	while(::recv(readable,buffer,sizeof(buffer),0)>0);
+#else
+	while(::read(readable,buffer,sizeof(buffer))>0);
+#endif // _WIN32
+#endif
+}
+
 /* ------------------------------------------- */
 /* ------------------------------------------- */
 /* ------------------------------------------- */
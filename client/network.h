@@ -2,10 +2,11 @@
 #define NETWORK_H
 
 #include <string>
+#include <vector>
 #include <string.h>
 #ifdef _WIN32
 #undef _WIN32_WINNT
-#define _WIN32_WINNT 0x0501
+#define _WIN32_WINNT 0x0600 // WSAPoll
 #include <winsock2.h>
 #include <Ws2tcpip.h>
 #include <sys/types.h>
@@ -13,6 +14,7 @@
 #else
 #include <netinet/in.h>
 #include <netdb.h>
+#include <poll.h>
 #endif // WIN32
 
 namespace net{
@@ -27,6 +29,28 @@ namespace net{
 	const int CONNRESET = ECONNRESET;
 #endif // _WIN32
 
+	// what poller::events() saw happen
+	const int READABLE = 1;
+	const int WRITABLE = 2;
+
+// lets one thread interrupt another that is blocked in poller::wait()
+// an eventfd on linux, a pipe on other unixes, and a udp socket talking to itself on windows, which can only poll sockets
+class wakeup{
+public:
+	wakeup();
+	wakeup(const wakeup&)=delete;
+	~wakeup();
+	wakeup &operator=(const wakeup&)=delete;
+	void notify();
+	void clear();
+
+private:
+	friend class poller;
+
+	int readable; // polls readable from notify() until clear()
+	int writable;
+};
+
 // tcp
 class tcp_server{
 public:
@@ -69,6 +93,8 @@ public:
 	int release();
 
 private:
+	friend class poller;
+
 	void set_blocking(bool);
 	void init();
 	bool writable();
@@ -79,6 +105,24 @@ private:
 	bool blocking;
 };
 
+// poll any number of sockets at once, so one thread can look after many connections
+// add() everything of interest, wait(), then ask events() about each index add() handed out
+class poller{
+public:
+	void clear();
+	int add(const tcp&,int);
+	int add(const wakeup&);
+	void wait(int);
+	int events(int)const;
+
+private:
+#ifdef _WIN32
+	std::vector<WSAPOLLFD> fds;
+#else
+	std::vector<pollfd> fds;
+#endif // _WIN32
+};
+
 // udp
 struct udp_id{
 	udp_id():initialized(false),len(sizeof(sockaddr_storage)){
@@ -0,0 +1,26 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// sha-256 digest, feed it with update() then ask for the hex()
+class SHA256{
+public:
+	SHA256();
+	void update(const void*, size_t);
+	std::string hex();
+
+	static std::string hex(const void*, size_t);
+
+private:
+	void transform(const unsigned char*);
+
+	std::uint32_t state[8];
+	unsigned char block[64];
+	size_t block_len;
+	std::uint64_t total_len;
+};
+
+#endif // SHA256_H
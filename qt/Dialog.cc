@@ -64,7 +64,7 @@ DialogSession::DialogSession(QWidget *parent, const std::vector<Chat> &cl):QDial
 	vlayout->addWidget(list);
 	vlayout->addLayout(hlayout);
 
-	QPushButton *ok = new QPushButton("Subscribe");
+	ok = new QPushButton("Subscribe");
 	QPushButton *add = new QPushButton("New Session");
 	QPushButton *cancel = new QPushButton("Cancel");
 	if(chat_list.size()==0)
@@ -82,6 +82,22 @@ std::tuple<bool, std::string, std::string> DialogSession::get()const{
 	return {newchat, n, desc};
 }
 
+// someone else created a chat while the dialog was open
+void DialogSession::add_chat(const Chat &chat){
+	for(const Chat &c:chat_list){
+		if(c.id==chat.id)
+			return;
+	}
+
+	chat_list.push_back(chat);
+
+	auto item=new QListWidgetItem(chat.name.c_str());
+	item->setToolTip(chat.description.c_str());
+	list->addItem(item);
+
+	ok->setEnabled(true);
+}
+
 void DialogSession::add_session(){
 	add = new DialogNewSession(this);
 	QObject::connect(add, &QDialog::accepted, this, &DialogSession::accept_session);
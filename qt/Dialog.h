@@ -5,6 +5,7 @@
 #include <QLineEdit>
 #include <QTextEdit>
 #include <QListWidget>
+#include <QPushButton>
 
 #include <tuple>
 #include <vector>
@@ -34,6 +35,7 @@ class DialogSession:public QDialog{
 public:
 	DialogSession(QWidget*, const std::vector<Chat>&);
 	std::tuple<bool, std::string, std::string> get()const;
+	void add_chat(const Chat&);
 
 private:
 	void add_session();
@@ -41,7 +43,8 @@ private:
 
 	std::string name,desc;
 	QListWidget *list;
-	const std::vector<Chat> chat_list;
+	QPushButton *ok;
+	std::vector<Chat> chat_list;
 	bool newchat;
 	DialogNewSession *add;
 };
@@ -10,20 +10,46 @@
 
 #include "MessageThread.h"
 
-MessageThread::MessageThread(std::function<void(const QPixmap*, const std::string&)> img_fn, std::function<void(unsigned long long, const std::string&)> file_fn){
+// <thumbnail_fn> is asked for thumbnails that didn't come with their message, <older_fn> for the messages before the oldest one shown
+MessageThread::MessageThread(std::function<void(unsigned long long, const std::string&)> img_fn, std::function<void(unsigned long long, const std::string&)> file_fn, std::function<void(unsigned long long)> thumbnail_fn, std::function<void(unsigned long long)> older_fn):from_bottom(-1){
 	setSizePolicy(QSizePolicy::Policy::Expanding,QSizePolicy::Policy::Expanding);
 	setWidgetResizable(true);
 	setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOn);
 
-	area=new MessageArea(this, img_fn, file_fn);
+	area=new MessageArea(this, img_fn, file_fn, thumbnail_fn, older_fn);
 	area->setSizePolicy(QSizePolicy::Expanding,QSizePolicy::Expanding);
 	setWidget(area);
+
+	// scrolled all the way up, go get more
+	QObject::connect(verticalScrollBar(), &QScrollBar::valueChanged, [this](int value){
+		if(value==verticalScrollBar()->minimum())
+			area->top();
+	});
+
+	// older messages went in above, stay on what was being looked at
+	QObject::connect(verticalScrollBar(), &QScrollBar::rangeChanged, [this](int, int max){
+		if(from_bottom!=-1){
+			verticalScrollBar()->setValue(max-from_bottom);
+			from_bottom=-1;
+		}
+	});
 }
 
 void MessageThread::add(const Message &m){
 	area->add(m);
 }
 
+void MessageThread::prepend(const std::vector<Message> &m){
+	if(m.size()>0)
+		from_bottom=verticalScrollBar()->maximum()-verticalScrollBar()->value();
+
+	area->prepend(m);
+}
+
+void MessageThread::thumbnail(unsigned long long id, const std::vector<unsigned char> &raw){
+	area->thumbnail(id, raw);
+}
+
 void MessageThread::bottom(){
 	verticalScrollBar()->setValue(verticalScrollBar()->maximum());
 }
@@ -32,11 +58,53 @@ void MessageThread::name(const std::string &name){
 	area->name(name);
 }
 
-MessageArea::MessageArea(MessageThread *p, std::function<void(const QPixmap*, const std::string&)> img_fn, std::function<void(unsigned long long, const std::string&)> file_fn):parent(p),img_clicked_fn(img_fn),file_clicked_fn(file_fn){
+MessageArea::MessageArea(MessageThread *p, std::function<void(unsigned long long, const std::string&)> img_fn, std::function<void(unsigned long long, const std::string&)> file_fn, std::function<void(unsigned long long)> thumb_fn, std::function<void(unsigned long long)> old_fn):parent(p),img_clicked_fn(img_fn),file_clicked_fn(file_fn),thumbnail_fn(thumb_fn),older_fn(old_fn){
 	scroll_to_bottom = true;
+	loading_older = false;
+	oldest = false;
 }
 
 void MessageArea::add(const Message &m){
+	cache(m);
+
+	msgs.push_back(m);
+	scroll_to_bottom=true;
+	update();
+}
+
+// the page of messages before msgs.front(), oldest first
+void MessageArea::prepend(const std::vector<Message> &m){
+	loading_older=false;
+	if(m.size()==0){
+		oldest=true;
+		return;
+	}
+
+	for(const Message &msg:m)
+		cache(msg);
+
+	msgs.insert(msgs.begin(), m.begin(), m.end());
+	update();
+}
+
+void MessageArea::thumbnail(unsigned long long id, const std::vector<unsigned char> &raw){
+	ImageCache *img=MessageArea::get_image(id, img_cache);
+	if(img){
+		img->load(raw);
+		update();
+	}
+}
+
+// the user has scrolled to the top
+void MessageArea::top(){
+	if(loading_older||oldest||msgs.size()==0)
+		return;
+
+	loading_older=true;
+	older_fn(msgs.front().id);
+}
+
+void MessageArea::cache(const Message &m){
 	if(m.type==MessageType::IMAGE){
 		img_cache.push_back({m.msg,m.raw,m.raw_size,m.id});
 	}
@@ -47,10 +115,6 @@ void MessageArea::add(const Message &m){
 
 		btn_cache.push_back({m.id, m.msg, callback, this});
 	}
-
-	msgs.push_back(m);
-	scroll_to_bottom=true;
-	update();
 }
 
 void MessageArea::name(const std::string &n){
@@ -63,11 +127,11 @@ void MessageArea::mouseReleaseEvent(QMouseEvent *event){
 
 	for(const ImageCache &img:img_cache){
 		if(x>img.x&&x<img.x+100&&y>img.y&&y<img.y+100)
-			img_clicked_fn(&img.map, img.name);
+			img_clicked_fn(img.id, img.name);
 	}
 }
 
-void MessageArea::paintEvent(QPaintEvent*){
+void MessageArea::paintEvent(QPaintEvent *event){
 	const int X_ME=45;
 	const int X_THEM=5;
 
@@ -111,7 +175,16 @@ void MessageArea::paintEvent(QPaintEvent*){
 			if(img){
 				const int xpos=x+(boxwidth/2)-50;
 				const int ypos=y+10;
-				painter.drawPixmap(QRect(xpos,ypos,100,100), img->map, img->map.rect());
+				// it's on screen, time to get the thumbnail if it didn't come with the message
+				if(!img->loaded&&!img->requested&&event->rect().intersects(QRect(xpos,ypos,100,100))){
+					img->requested=true;
+					thumbnail_fn(img->id);
+				}
+				// no thumbnail, but it can still be clicked on to get the full image
+				if(img->valid)
+					painter.drawPixmap(QRect(xpos,ypos,100,100), img->map, img->map.rect());
+				else
+					painter.drawText(QRect(xpos,ypos,100,100), Qt::AlignCenter, "[ view image ]");
 				img->x=xpos;
 				img->y=ypos;
 			}
@@ -276,7 +349,7 @@ int MessageArea::line_count(const std::string &text){
 
 ImageCache *MessageArea::get_image(unsigned long long id, std::vector<ImageCache> &cache){
 	for(ImageCache &item:cache)
-		if(item.id==id&&item.valid)
+		if(item.id==id)
 			return &item;
 
 	return NULL;
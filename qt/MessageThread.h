@@ -14,10 +14,20 @@ struct ImageCache{
 	,x(0)
 	,y(0)
 	{
-		valid=map.loadFromData(raw, size);
+		valid=size>0&&map.loadFromData(raw, size); // <raw> is the thumbnail
+		loaded=size>0;
+		requested=false;
+	}
+
+	// thumbnails of messages from the local history come later, when they're first on screen
+	void load(const std::vector<unsigned char> &raw){
+		valid=raw.size()>0&&map.loadFromData(raw.data(), raw.size());
+		loaded=true;
 	}
 
 	bool valid;
+	bool loaded; // <map> has been given the thumbnail, if there is one
+	bool requested; // the thumbnail has been asked for
 	std::string name;
 	QPixmap map;
 	const unsigned long long id; // message id
@@ -44,9 +54,12 @@ class MessageThread;
 
 class MessageArea:public QWidget{
 public:
-	MessageArea(MessageThread*, std::function<void(const QPixmap*, const std::string&)>, std::function<void(long long unsigned, const std::string&)>);
+	MessageArea(MessageThread*, std::function<void(unsigned long long, const std::string&)>, std::function<void(long long unsigned, const std::string&)>, std::function<void(unsigned long long)>, std::function<void(unsigned long long)>);
 	void add(const Message&);
+	void prepend(const std::vector<Message>&);
+	void thumbnail(unsigned long long, const std::vector<unsigned char>&);
 	void name(const std::string&);
+	void top();
 
 protected:
 	void paintEvent(QPaintEvent*);
@@ -60,26 +73,34 @@ private:
 	static int line_count(const std::string&);
 	static ImageCache *get_image(unsigned long long, std::vector<ImageCache>&);
 	static ButtonCache *get_btn(unsigned long long, std::vector<ButtonCache>&);
+	void cache(const Message&);
 
 	MessageThread *const parent;
-	std::function<void(const QPixmap*,const std::string&)> img_clicked_fn;
+	std::function<void(unsigned long long,const std::string&)> img_clicked_fn; // message id, image name
 	std::function<void(long long unsigned,const std::string&)> file_clicked_fn;
+	std::function<void(unsigned long long)> thumbnail_fn; // message id
+	std::function<void(unsigned long long)> older_fn; // id of the oldest message shown
 	std::vector<ImageCache> img_cache;
 	std::vector<ButtonCache> btn_cache;
 	std::vector<Message> msgs;
 	std::string myname;
 	bool scroll_to_bottom;
+	bool loading_older; // asked for the page before msgs.front()
+	bool oldest; // there's nothing before msgs.front()
 };
 
 class MessageThread:public QScrollArea{
 public:
-	MessageThread(std::function<void(const QPixmap*, const std::string&)>, std::function<void(unsigned long long,const std::string&)>);
+	MessageThread(std::function<void(unsigned long long, const std::string&)>, std::function<void(unsigned long long,const std::string&)>, std::function<void(unsigned long long)>, std::function<void(unsigned long long)>);
 	void add(const Message&);
+	void prepend(const std::vector<Message>&);
+	void thumbnail(unsigned long long, const std::vector<unsigned char>&);
 	void name(const std::string&);
 	void bottom();
 
 private:
 	MessageArea *area;
+	int from_bottom; // where to keep the view while older messages are added above it, -1 if they aren't
 };
 
 #endif // MESSAGETHREAD_H
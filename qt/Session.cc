@@ -4,10 +4,12 @@
 #include <QVBoxLayout>
 #include <QPushButton>
 #include <QFileDialog>
+#include <QImage>
+#include <QImageReader>
+#include <QBuffer>
 
 #include <vector>
 #include <iostream>
-#include <fstream>
 
 #include "Session.h"
 
@@ -34,15 +36,20 @@ Session::Session(const std::string &name, const std::string &addr, const std::st
 		}
 	};
 
-	auto img_click = [this](const QPixmap *map, const std::string &name){
-		DialogImage view(this,map,name);
-		view.exec();
+	auto img_click = [this](const unsigned long long id, const std::string &name){
+		get_image(id, name);
 	};
 	auto file_click = [this](const unsigned long long id, const std::string &filename){
 		get_file(id, filename);
 	};
+	auto thumb = [this](const unsigned long long id){
+		get_thumbnail(id);
+	};
+	auto older = [this](const unsigned long long before){
+		get_older(before);
+	};
 
-	display=new MessageThread(img_click, file_click);
+	display=new MessageThread(img_click, file_click, thumb, older);
 	inputbox=new TextBox(inputbox_action);
 	inputbox->setMaximumHeight(100);
 	inputbox->setReadOnly(true);
@@ -94,11 +101,23 @@ void Session::customEvent(QEvent *e){
 		break;
 	case Update::Type::GET_FILE:
 		file_received(event);
+		break;
+	case Update::Type::GET_IMAGE:
+		image_received(event);
 		delete[] event->raw;
 		break;
 	case Update::Type::MESSAGE_RECEIPT:
 		receipt_received(event);
 		break;
+	case Update::Type::CHAT_CREATED:
+		chat_created(event);
+		break;
+	case Update::Type::HISTORY:
+		history_received(event);
+		break;
+	case Update::Type::THUMBNAIL:
+		thumbnail_received(event);
+		break;
 	}
 }
 
@@ -128,7 +147,14 @@ void Session::list_chats(){
 		QCoreApplication::postEvent(this, event);
 	};
 
-	client.list_chats(callback);
+	auto created=[this](Chat chat){
+		Update *event = new Update(Update::Type::CHAT_CREATED);
+		event->chat_list.push_back(chat);
+
+		QCoreApplication::postEvent(this, event);
+	};
+
+	client.list_chats(callback, created);
 }
 
 // allow the user to make a new chat
@@ -165,9 +191,32 @@ void Session::subscribe(const std::string &chat){
 	client.subscribe(chat, callback, msgcallback);
 }
 
-// request a file from the server
+// request a file from the server, it's written to wherever the user wants it as it arrives
 void Session::get_file(unsigned long long id, const std::string &filename){
-	Update *event = new Update(Update::Type::GET_FILE);
+	QFileDialog save(this, (std::string("Save ")+"\""+filename+"\"").c_str());
+	save.setAcceptMode(QFileDialog::AcceptSave);
+	save.selectFile(Session::remove_size_tag(filename).c_str());
+	if(!save.exec())
+		return;
+
+	const std::string path=save.selectedFiles().at(0).toStdString();
+
+	auto callback=[this, path](bool success){
+		Update *event = new Update(Update::Type::GET_FILE);
+		event->success=success;
+		event->filename=path;
+
+		QCoreApplication::postEvent(this, event);
+	};
+
+	client.get_file(id, path, percent, callback);
+	DialogProgress dlg(this, filename, percent, true);
+	dlg.exec();
+}
+
+// request the full size version of an image from the server, only its thumbnail comes with the message
+void Session::get_image(unsigned long long id, const std::string &filename){
+	Update *event = new Update(Update::Type::GET_IMAGE);
 
 	auto callback=[this, event, filename](const unsigned char *data, int size){
 		unsigned char *raw=new unsigned char[size];
@@ -185,6 +234,31 @@ void Session::get_file(unsigned long long id, const std::string &filename){
 	dlg.exec();
 }
 
+// get the thumbnail of an image from the local history, they're left out to save memory until they're on screen
+void Session::get_thumbnail(unsigned long long id){
+	auto callback=[this](unsigned long long msgid, std::vector<unsigned char> raw){
+		Update *event = new Update(Update::Type::THUMBNAIL);
+		event->id=msgid;
+		event->thumbnail=std::move(raw);
+
+		QCoreApplication::postEvent(this, event);
+	};
+
+	client.get_thumbnail(id, callback);
+}
+
+// get the page of the local history before message id <before>
+void Session::get_older(unsigned long long before){
+	auto callback=[this](std::vector<Message> msg_list){
+		Update *event = new Update(Update::Type::HISTORY);
+		event->msg_list=msg_list;
+
+		QCoreApplication::postEvent(this, event);
+	};
+
+	client.history(before, HISTORY_MESSAGES, callback);
+}
+
 // event handler for successful connection to the server
 void Session::connected(const Update *event){
 	if(username!=event->name&&event->success){
@@ -251,6 +325,25 @@ void Session::new_chat_receipt(const Update *event){
 	list_chats();
 }
 
+// event handler for a chat created by someone else
+void Session::chat_created(const Update *event){
+	// only matters if the user is still choosing a chat
+	if(chooser && chooser->isVisible()){
+		for(const Chat &chat:event->chat_list)
+			chooser->add_chat(chat);
+	}
+}
+
+// event handler for a page of older messages
+void Session::history_received(const Update *event){
+	display->prepend(event->msg_list);
+}
+
+// event handler for a thumbnail from the local history
+void Session::thumbnail_received(const Update *event){
+	display->thumbnail(event->id, event->thumbnail);
+}
+
 // event handler for new message
 void Session::message(const Update *event){
 	display_message(event->msg);
@@ -266,22 +359,31 @@ void Session::receipt_received(const Update *event){
 	}
 }
 
-// event handler for file received
+// event handler for file received, it's already where the user asked for it
 void Session::file_received(const Update *event){
-	QFileDialog save(this, (std::string("Save ")+"\""+event->filename+"\"").c_str());
-	save.setAcceptMode(QFileDialog::AcceptSave);
-	save.selectFile(Session::remove_size_tag(event->filename).c_str());
-	if(save.exec()){
-		std::string fname=save.selectedFiles().at(0).toStdString();
-		if(!Session::write_file(fname, event->raw, event->raw_size)){
-			QMessageBox box(this);
-			box.setWindowTitle("Error");
-			box.setText((std::string("Could not write to ")+fname+".").c_str());
-			box.exec();
-		}
+	if(!event->success){
+		QMessageBox box(this);
+		box.setWindowTitle("Error");
+		box.setText((std::string("Could not download to ")+event->filename+".").c_str());
+		box.exec();
 	}
 }
 
+// event handler for full size image received
+void Session::image_received(const Update *event){
+	QPixmap map;
+	if(!map.loadFromData(event->raw, event->raw_size)){
+		QMessageBox box(this);
+		box.setWindowTitle("Error");
+		box.setText((std::string("Could not load ")+event->filename+".").c_str());
+		box.exec();
+		return;
+	}
+
+	DialogImage view(this,&map,event->filename);
+	view.exec();
+}
+
 void Session::display_message(const Message &msg){
 	display->add(msg);
 }
@@ -327,20 +429,12 @@ void Session::slotImage(){
 	select.setFileMode(QFileDialog::ExistingFile);
 	select.setNameFilter("Images (*.jpg *.jpeg *.png)");
 	if(select.exec()){
-		QStringList list=select.selectedFiles();
-		int size=0;
-		unsigned char *buffer=read_file(list.at(0).toStdString(), size);
-		if(buffer==NULL){
-			QMessageBox box(this);
-			box.setWindowTitle("Error");
-			box.setText((std::string("Couldn't read from ")+list.at(0).toStdString()).c_str());
-			box.exec();
-			return;
-		}
+		// the image goes out straight from disk, the receipt says so if it can't be read
+		const std::string filename=select.selectedFiles().at(0).toStdString();
 
 		disable_interface();
-		client.send_image(Session::truncate(list.at(0).toStdString()), buffer, size, percent, receipt);
-		DialogProgress dlg(this, Session::truncate(list.at(0).toStdString()), percent, false);
+		client.send_image(Session::truncate(filename), filename, Session::thumbnail(filename), percent, receipt);
+		DialogProgress dlg(this, Session::truncate(filename), percent, false);
 		dlg.exec();
 	}
 }
@@ -350,50 +444,40 @@ void Session::slotFile(){
 	select.setFileMode(QFileDialog::ExistingFile);
 	if(select.exec()){
 		const std::string filename=select.selectedFiles().at(0).toStdString();
-		int size=0;
-		unsigned char *buffer=read_file(filename, size);
-		if(buffer==NULL){
-			QMessageBox box(this);
-			box.setWindowTitle("Error");
-			box.setText((std::string("Couldn't read from ")+filename).c_str());
-			box.exec();
-			return;
-		}
 
 		disable_interface();
-		client.send_file(Session::truncate(filename), buffer, size, percent, receipt);
+		client.send_file(Session::truncate(filename), filename, percent, receipt);
 		DialogProgress dlg(this, Session::truncate(filename), percent, false);
 		dlg.exec();
 	}
 }
 
-unsigned char *Session::read_file(const std::string &name, int &size){
-	std::ifstream in(name, std::ios::binary|std::ios::ate);
-	if(!in)
-		return NULL;
-
-	size=in.tellg();
-	in.seekg(0);
-	auto buffer=new unsigned char[size];
+// shrink the image at <path> down to what MessageArea draws, to go along with it
+// the reader scales as it decodes where the format allows, so a big image is never held at full size
+// empty if it can't be shrunk, the server makes do without
+std::vector<unsigned char> Session::thumbnail(const std::string &path){
+	QImageReader reader(QString::fromStdString(path));
+	const QSize size=reader.size();
+	if(size.isValid()&&(size.width()>THUMBNAIL_PIXELS||size.height()>THUMBNAIL_PIXELS))
+		reader.setScaledSize(size.scaled(THUMBNAIL_PIXELS, THUMBNAIL_PIXELS, Qt::KeepAspectRatio));
 
-	in.read((char*)buffer, size);
+	QImage image;
+	if(!reader.read(&image))
+		return {};
 
-	if(in.gcount()!=size){
-		delete[] buffer;
-		return NULL;
-	}
-
-	return buffer;
-}
+	if(image.width()>THUMBNAIL_PIXELS||image.height()>THUMBNAIL_PIXELS)
+		image=image.scaled(THUMBNAIL_PIXELS, THUMBNAIL_PIXELS, Qt::KeepAspectRatio, Qt::SmoothTransformation);
 
-bool Session::write_file(const std::string &name, unsigned char *raw, int size){
-	std::ofstream out(name, std::ofstream::binary);
-	if(!out)
-		return false;
+	QByteArray bytes;
+	QBuffer buffer(&bytes);
+	buffer.open(QIODevice::WriteOnly);
+	if(!image.save(&buffer, image.hasAlphaChannel()?"PNG":"JPG"))
+		return {};
 
-	out.write((char*)raw,size);
+	if(bytes.size()>MAX_THUMBNAIL_BYTES)
+		return {};
 
-	return true;
+	return {bytes.begin(), bytes.end()};
 }
 
 // truncate the filepath to just the filename
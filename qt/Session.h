@@ -21,7 +21,11 @@ public:
 		SUBSCRIBE,
 		MESSAGE,
 		MESSAGE_RECEIPT,
-		GET_FILE
+		GET_FILE,
+		GET_IMAGE,
+		CHAT_CREATED,
+		HISTORY,
+		THUMBNAIL
 	};
 
 	Update(Type t):QEvent(new_event()),eventtype(t),success(false){}
@@ -34,6 +38,8 @@ public:
 	unsigned long long raw_size;
 	Message msg;
 	unsigned char *raw;
+	std::vector<unsigned char> thumbnail;
+	unsigned long long id;
 	std::string filename;
 	std::string errmsg;
 	std::string name;
@@ -67,6 +73,9 @@ private:
 	void new_chat(const std::string&,const std::string&);
 	void subscribe(const std::string&);
 	void get_file(unsigned long long, const std::string &);
+	void get_image(unsigned long long, const std::string &);
+	void get_thumbnail(unsigned long long);
+	void get_older(unsigned long long);
 	void connected(const Update*);
 	void listed(const Update*);
 	void subscribed(const Update*);
@@ -74,6 +83,10 @@ private:
 	void message(const Update*);
 	void receipt_received(const Update*);
 	void file_received(const Update*);
+	void image_received(const Update*);
+	void chat_created(const Update*);
+	void history_received(const Update*);
+	void thumbnail_received(const Update*);
 	void display_message(const Message&);
 	void disable_interface();
 	void enable_interface();
@@ -82,9 +95,8 @@ private:
 	void slotImage();
 	void slotFile();
 	std::function<void(bool,const std::string&)> receipt;
-	static unsigned char *read_file(const std::string&,int&);
-	static bool write_file(const std::string&,unsigned char*, int);
 	static std::string truncate(const std::string&);
+	static std::vector<unsigned char> thumbnail(const std::string&);
 
 	MessageThread *display;
 	QTextEdit *inputbox;
@@ -1,33 +1,55 @@
 #include <functional>
 #include <cstdint>
+#include <random>
+#include <algorithm>
 
 #include "Client.h"
 #include "../chat.h"
 #include "log.h"
+#include "os.h"
+#include "sha256.h"
 
 Client::Client(Server &p,int sockfd):
 	parent(p),
 	tcp(sockfd),
 	disconnected(false),
 	out_queue_len(0),
+	out_queue_bytes(0),
+	dropped(0),
 	last_sent_heartbeat(0),
 	last_received_heartbeat(time(NULL)),
 	name("anonymous"),
+	introduced(false),
+	waiting(false),
+	disconnected_at(0),
+	last_sent(0),
 	thread(std::ref(*this)) // start a separate event thread for this client (operator())
 {}
 
 // entry point for the client thread
 void Client::operator()(){
+	bool lost=false;
 	try{
 		loop();
 	}catch(const NetworkException &e){
-		// ignore
+		lost=true;
 	}catch(const ShutdownException &e){
 		log("kicking " + name);
 	}catch(const ClientKickException &e){
 		log_error(e.what());
 	}
 
+	disconnected_at=time(NULL);
+
+	// most disconnects are a blip, keep the name, subscription and out queue for when the client comes back
+	// the server releases the name if it doesn't come back in time, see Server::accept()
+	if(lost&&introduced){
+		waiting.store(true);
+		parent.park(*this);
+	}
+	else if(introduced)
+		parent.release_name(name);
+
 	disconnected.store(true);
 }
 
@@ -40,11 +62,55 @@ const std::string &Client::get_name()const{
 	return name;
 }
 
+// secret the session can be resumed with
+const std::string &Client::get_token()const{
+	return token;
+}
+
 // has this client been disconnected (called from server thread)
 bool Client::dead()const{
 	return disconnected.load();
 }
 
+// is the session waiting for the client to RESUME it (called from server thread)
+bool Client::parked()const{
+	return dead()&&waiting.load();
+}
+
+// has a parked session waited long enough
+bool Client::expired(time_t now)const{
+	return now-disconnected_at>RESUME_SECONDS||now<disconnected_at;
+}
+
+
+// take over the session of parked client <old>, which gives up its name, subscription and out queue
+// called with the server lock held, so nothing is being fanned out to either
+void Client::adopt(Client &old){
+	name=std::move(old.name);
+	introduced=true;
+	subscribed=old.subscribed;
+	last_sent=old.last_sent;
+
+	std::lock_guard<std::mutex> lock(out_queue_lock);
+	std::lock_guard<std::mutex> old_lock(old.out_queue_lock);
+
+	std::swap(out_queue,old.out_queue);
+	std::swap(out_chats,old.out_chats);
+	out_queue_bytes=old.out_queue_bytes;
+	dropped=old.dropped;
+	out_queue_len.store(old.out_queue_len.load());
+
+	old.introduced=false;
+	old.token.clear();
+	old.waiting.store(false);
+}
+
+// give up waiting for the client to RESUME, the caller takes care of the name
+void Client::unpark(){
+	token.clear();
+	waiting.store(false);
+}
+
 // is a client subscribed to <chat>
 bool Client::is_subscribed(const Chat &chat){
 	return chat==subscribed;
@@ -56,10 +122,26 @@ void Client::kick(const std::string &reason)const{
 }
 
 // add a message to the out queue
+// if the client isn't keeping up, the oldest are let go, see OUT_QUEUE_MESSAGES
 void Client::addmsg(const Message &msg){
 	std::lock_guard<std::mutex> lock(out_queue_lock);
 
 	out_queue.push(msg);
+	out_queue_bytes+=msg.msg.size()+msg.raw_size;
+	++out_queue_len;
+
+	while(out_queue.size()>OUT_QUEUE_MESSAGES||(out_queue_bytes>OUT_QUEUE_BYTES&&out_queue.size()>1)){
+		out_queue_bytes-=out_queue.front().msg.size()+out_queue.front().raw_size;
+		out_queue.pop();
+		++dropped;
+	}
+}
+
+// add a new chat notification to the out queue
+void Client::addchat(const Chat &chat,unsigned long long version){
+	std::lock_guard<std::mutex> lock(out_queue_lock);
+
+	out_chats.push({chat,version});
 	++out_queue_len;
 }
 
@@ -67,14 +149,17 @@ void Client::addmsg(const Message &msg){
 void Client::send(const void *data,unsigned size){
 	unsigned sent=0;
 	while(sent!=size){
-		sent+=tcp.send_nonblock((char*)data+sent,size-sent);
+		const int n=tcp.send_nonblock((char*)data+sent,size-sent);
+		sent+=n;
 
 		if(!parent.running())
 			throw ShutdownException();
 		else if(tcp.error())
 			throw NetworkException();
 
-		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		// only wait when nothing moved, or every slice of a file pays for it a few times over
+		if(n==0)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
 	}
 }
 
@@ -82,14 +167,17 @@ void Client::send(const void *data,unsigned size){
 void Client::recv(void *data,unsigned size){
 	unsigned got=0;
 	while(got!=size){
-		got+=tcp.recv_nonblock((char*)data+got,size-got);
+		const int n=tcp.recv_nonblock((char*)data+got,size-got);
+		got+=n;
 
 		if(!parent.running())
 			throw ShutdownException();
 		else if(tcp.error())
 			throw NetworkException();
 
-		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		// only wait when nothing moved, or every slice of a file pays for it a few times over
+		if(n==0)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
 	}
 }
 
@@ -107,33 +195,105 @@ void Client::loop(){
 		// empty the out queue
 		dispatch();
 
+		// a slice of whatever file the client is waiting on
+		send_file_slice();
+
 		// check if the remote client has timed out
 		check_timeout();
 	}
 }
 
 // empty the out queue
+// the queues are taken as they are and sent without the lock, so a slow client never holds up the server
 void Client::dispatch(){
 	if(out_queue_len.load()<1)
 		return;
 
+	std::queue<Message> messages;
+	std::queue<std::pair<Chat,unsigned long long>> chats;
+	unsigned long long lost;
+	{
+		std::lock_guard<std::mutex> lock(out_queue_lock);
+
+		std::swap(messages,out_queue);
+		std::swap(chats,out_chats);
+		out_queue_bytes=0;
+		out_queue_len.store(0);
+
+		lost=dropped;
+		dropped=0;
+	}
+
+	if(lost>0)
+		log(name+" fell behind, dropped "+std::to_string(lost)+" messages for them to ask for again");
+
+	// each is let go of once it's out, if the connection goes the rest stay for a RESUME
+	try{
+		while(chats.size()>0){
+			const auto &[chat,version]=chats.front();
+
+			// dispatch
+			servercmd_chat_created(chat,version);
+
+			chats.pop();
+		}
+
+		while(messages.size()>0){
+			const Message &msg=messages.front();
+
+			// dispatch
+			servercmd_message(msg);
+
+			messages.pop();
+		}
+	}catch(...){
+		requeue(messages,chats);
+		throw;
+	}
+}
+
+// put what dispatch() didn't get out (the one it was partway through too) back in front of the out queue
+// what was fanned out in the meantime stays after it, and is all <out_queue_bytes> counts so far
+void Client::requeue(std::queue<Message> &messages,std::queue<std::pair<Chat,unsigned long long>> &chats){
 	std::lock_guard<std::mutex> lock(out_queue_lock);
-	while(out_queue.size()>0){
-		const Message &msg=out_queue.front();
 
-		// dispatch
-		servercmd_message(msg);
+	std::queue<Message> newer_messages;
+	std::queue<std::pair<Chat,unsigned long long>> newer_chats;
+	std::swap(newer_messages,out_queue);
+	std::swap(newer_chats,out_chats);
 
-		out_queue.pop();
+	while(!messages.empty()){
+		out_queue_bytes+=messages.front().msg.size()+messages.front().raw_size;
+		out_queue.push(std::move(messages.front()));
+		messages.pop();
+	}
+	while(!newer_messages.empty()){
+		out_queue.push(std::move(newer_messages.front()));
+		newer_messages.pop();
+	}
+
+	while(!chats.empty()){
+		out_chats.push(std::move(chats.front()));
+		chats.pop();
+	}
+	while(!newer_chats.empty()){
+		out_chats.push(std::move(newer_chats.front()));
+		newer_chats.pop();
 	}
 
-	out_queue_len.store(0);
+	out_queue_len.store(out_queue.size()+out_chats.size());
 }
 
 // recv commands from the client
 void Client::recv_command(){
-	if(!tcp.poll_recv(350))
+	// don't hang around if there's a file going out
+	if(!tcp.poll_recv(files.empty()?350:0)){
+		// remote client hung up
+		if(tcp.error())
+			throw NetworkException();
+
 		return;
+	}
 
 	ClientCommand type;
 	recv(&type,sizeof(type));
@@ -157,6 +317,21 @@ void Client::recv_command(){
 	case ClientCommand::GET_FILE:
 		clientcmd_get_file();
 		break;
+	case ClientCommand::SEARCH:
+		clientcmd_search();
+		break;
+	case ClientCommand::GET_RANGE:
+		clientcmd_get_range();
+		break;
+	case ClientCommand::RESUME:
+		clientcmd_resume();
+		break;
+	case ClientCommand::UPLOAD:
+		clientcmd_upload();
+		break;
+	case ClientCommand::UPLOAD_DATA:
+		clientcmd_upload_data();
+		break;
 	case ClientCommand::HEARTBEAT:
 		last_received_heartbeat = time(NULL);
 		break;
@@ -180,6 +355,37 @@ void Client::heartbeat(){
 	}
 }
 
+// send the next slice of the file at the front of <files>, announcing it first if it's just got there
+void Client::send_file_slice(){
+	if(files.empty())
+		return;
+
+	Outgoing &file=files.front();
+	if(!file.announced){
+		// an empty file tells the client it isn't there
+		if(file.chat!=0){
+			try{
+				file.data=parent.get_file(file.id,file.chat,file.hash);
+			}catch(const std::exception &e){
+				log_error(name+" asked for a file that can't be had: "+e.what());
+			}
+		}
+
+		// whatever the client has isn't this, it starts over
+		if(file.sent>file.data.size())
+			file.sent=0;
+
+		servercmd_send_file(file);
+		file.announced=true;
+	}
+
+	if(file.sent<file.data.size())
+		servercmd_file_data(file);
+
+	if(file.sent==file.data.size())
+		files.pop();
+}
+
 void Client::check_timeout(){
 	const time_t current = time(NULL);
 
@@ -232,16 +438,63 @@ void Client::send_string(const std::string &str){
 // recv clients name
 // implements ClientCommand::INTRODUCE
 void Client::clientcmd_introduce(){
-	name=get_string();
+	const std::string requested=get_string();
+
+	// give up the old name if the client is introducing itself again
+	if(introduced)
+		parent.release_name(name);
 
 	// validate name
-	name=parent.validate_name(*this);
+	parent.evict(requested);
+	name=parent.claim_name(requested);
+	introduced=true;
+	token=new_token();
 
 	servercmd_introduce();
 }
 
+// client lost its connection, and wants the session it had back
+// implements ClientCommand::RESUME
+void Client::clientcmd_resume(){
+	const std::string old=get_string();
+
+	if(introduced)
+		kick("tried to resume a session after introducing itself");
+
+	if(!parent.resume(old,*this)){
+		servercmd_resume(false);
+		return;
+	}
+
+	// a token is only good once
+	token=new_token();
+	log(name+" resumed their session");
+
+	servercmd_resume(true);
+}
+
+// 128 random bits, as hex
+std::string Client::new_token(){
+	static std::mutex mutex;
+	static std::mt19937_64 generator(std::random_device{}());
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	char buffer[33];
+	std::snprintf(buffer,sizeof(buffer),"%016llx%016llx",(unsigned long long)generator(),(unsigned long long)generator());
+
+	return buffer;
+}
+
+// is <str> <length> lowercase hex digits
+bool Client::is_hex(const std::string &str,size_t length){
+	return str.length()==length&&std::all_of(str.begin(),str.end(),[](char c){
+		return (c>='0'&&c<='9')||(c>='a'&&c<='f');
+	});
+}
+
 // format the bytes as KB or MB
-std::string Client::format(int bytes){
+std::string Client::format(unsigned long long bytes){
 	const char BUFFER_SIZE=30;
 	char buffer[BUFFER_SIZE];
 
@@ -270,10 +523,27 @@ std::string Client::strip_new_lines(const std::string &str){
 // lists the chats
 // implements ClientCommand::LIST_CHATS
 void Client::clientcmd_list_chats(){
-	std::vector<Chat> chats=parent.get_chats();
+	// the server name and directory version the client last saw
+	const std::string known_server=get_string();
+	std::uint64_t since;
+	recv(&since,sizeof(since));
+
+	// the client's chat list is from a different server (or a different life of this one), it needs the whole thing
+	const bool full=known_server!=parent.get_name();
+	if(full)
+		since=0;
+
+	unsigned long long version;
+	std::vector<Chat> chats=parent.get_chats_since(since,version);
+
+	// client claims to have seen a version that doesn't exist yet
+	if(!full&&since>version){
+		servercmd_list_chats(true,version,parent.get_chats_since(0,version));
+		return;
+	}
 
 	// execute ServerCommand::LIST_CHATS
-	servercmd_list_chats(chats);
+	servercmd_list_chats(full,version,chats);
 }
 
 // server allows client to create new chats
@@ -304,6 +574,7 @@ void Client::clientcmd_subscribe(){
 	// recv the max message id in that chat
 	std::uint64_t max;
 	recv(&max,sizeof(max));
+	last_sent=max;
 
 	// execute ServerCommand::SUBSCRIBE
 	servercmd_subscribe(success,max);
@@ -339,48 +610,237 @@ void Client::clientcmd_message(){
 		recv(raw,raw_size);
 	}
 
+	// images come with a thumbnail
+	std::vector<unsigned char> thumbnail;
+	if(type==MessageType::IMAGE&&!recv_thumbnail(thumbnail)){
+		delete[] raw;
+		kick("thumbnail too large");
+	}
+
 	// make sure raw size isn't too big
-	if(type==MessageType::IMAGE){
-		if(raw_size>MAX_IMAGE_BYTES){
-			delete[] raw;
-			servercmd_message_receipt(false, "Images larger than "+Client::format(MAX_IMAGE_BYTES)+" are not allowed.");
-			return;
-		}
+	const std::string refused=Client::refusal(type,raw_size);
+	if(refused!=""){
+		delete[] raw;
+		servercmd_message_receipt(false,refused);
+		return;
+	}
 
-		message+=" ("+Client::format(raw_size)+")";
+	std::string err;
+	const bool posted=post(subscribed,type,message,raw,raw_size,thumbnail,err);
+	servercmd_message_receipt(posted,err);
+}
+
+// client wants to send a file or image it can pick up again if the connection goes partway through
+// the content is put back together in a spool file named for the upload and its sha-256, which outlives the connection
+// implements ClientCommand::UPLOAD
+void Client::clientcmd_upload(){
+	Upload announced;
+	announced.id=get_string();
+	recv(&announced.type,sizeof(announced.type));
+	announced.message=get_string();
+	std::uint64_t size;
+	recv(&size,sizeof(size));
+	announced.size=size;
+	announced.hash=get_string();
+	announced.chat=subscribed;
+	announced.failed=false;
+
+	if(announced.type!=MessageType::FILE&&announced.type!=MessageType::IMAGE)
+		kick("illegal upload type received: "+std::to_string(static_cast<uint8_t>(announced.type)));
+	if(!Client::is_hex(announced.id,32)||!Client::is_hex(announced.hash,64))
+		kick("malformed upload id or hash");
+
+	// images come with a thumbnail
+	if(announced.type==MessageType::IMAGE&&!recv_thumbnail(announced.thumbnail))
+		kick("thumbnail too large");
+
+	// one that was announced and never followed through on is forgotten, its spool file waits to be picked up again
+	upload.reset();
+
+	const std::string refused=Client::refusal(announced.type,announced.size);
+	if(refused!=""){
+		servercmd_upload_receipt(announced.id,false,refused);
+		return;
 	}
-	else if(type==MessageType::FILE){
-		if(raw_size>MAX_FILE_BYTES){
-			delete[] raw;
-			servercmd_message_receipt(false, "Files larger than "+Client::format(MAX_FILE_BYTES)+" are not allowed.");
-			return;
-		}
 
-		message+=" ("+Client::format(raw_size)+")";
+	// it was posted already, the receipt went with the connection
+	if(os::exists(parent.spool_path(announced.id+".done"))){
+		servercmd_upload_receipt(announced.id,true,{});
+		return;
 	}
-	else{
-		if(raw_size>0){
-			delete[] raw;
-			servercmd_message_receipt(false, "The \"raw\" field is not allowed for general text messages.\nThis likely indicates a client implementation error.");
-			return;
+
+	// there's nowhere to post it
+	if(!announced.chat){
+		servercmd_upload_receipt(announced.id,false,"You are not subscribed to any chat sessions!");
+		return;
+	}
+
+	unsigned long long have=0;
+	try{
+		os::file spooled(parent.spool_path(announced.id+"."+announced.hash));
+		have=spooled.size();
+		if(have>announced.size){
+			spooled.truncate(0);
+			have=0;
 		}
+	}catch(const std::exception &e){
+		log_error(std::string("spooling an upload: ")+e.what());
+		servercmd_upload_receipt(announced.id,false,"The server couldn't take the upload.");
+		return;
 	}
 
+	if(have>0)
+		log(name+" is picking up their upload of \""+announced.message+"\" at "+Client::format(have)+" of "+Client::format(announced.size));
+
+	upload=announced;
+	servercmd_upload(announced.id,have);
+}
+
+// the next slice of an UPLOAD, the first picks up from where servercmd_upload() said the spool had got to
+// each goes to disk as it arrives, whatever makes it before the connection goes is kept
+// implements ClientCommand::UPLOAD_DATA
+void Client::clientcmd_upload_data(){
+	const std::string id=get_string();
+	std::uint64_t offset;
+	recv(&offset,sizeof(offset));
+	std::uint32_t length;
+	recv(&length,sizeof(length));
+
+	if(length>TRANSFER_SLICE_BYTES)
+		kick("upload slice too large");
+
+	std::vector<unsigned char> slice(length);
+	if(length>0)
+		recv(slice.data(),length);
+
+	if(!upload||upload->id!=id)
+		kick("sent data for an upload it didn't announce");
+	if(offset+length>upload->size)
+		kick("sent more upload data than it announced");
+
+	// the client was told, these were already on their way
+	if(upload->failed)
+		return;
+
+	const std::string path=parent.spool_path(upload->id+"."+upload->hash);
+	unsigned long long have=offset;
+	bool spooled=false;
+	try{
+		os::file spool(path);
+		have=spool.size();
+		if(have==offset){
+			spool.append(slice.data(),length);
+			spooled=true;
+		}
+	}catch(const std::exception &e){
+		log_error(std::string("spooling an upload: ")+e.what());
+	}
+
+	if(have!=offset)
+		kick("sent upload data that doesn't pick up where the spool left off");
+
+	// what made it to the spool stays there for the client to pick up from when it tries again
+	if(!spooled){
+		upload->failed=true;
+		servercmd_upload_receipt(id,false,"The server couldn't take the upload.");
+		return;
+	}
+
+	if(offset+length<upload->size)
+		return;
+
+	Upload announced=std::move(upload.value());
+	upload.reset();
+
+	// all there, make sure it's what the client meant to send
+	unsigned char *raw=announced.size>0?new unsigned char[announced.size]:NULL;
+	bool whole=false;
+	try{
+		os::file spool(path);
+		whole=spool.read(raw,announced.size,0)==announced.size;
+		spool.close();
+		os::remove(path);
+	}catch(const std::exception &e){
+		log_error(std::string("spooling an upload: ")+e.what());
+	}
+
+	if(!whole||SHA256::hex(raw,announced.size)!=announced.hash){
+		delete[] raw;
+		log_error(name+"'s upload of \""+announced.message+"\" didn't match its hash");
+		servercmd_upload_receipt(announced.id,false,"The upload was damaged on the way, try sending it again.");
+		return;
+	}
+
+	std::string err;
+	const bool posted=post(announced.chat,announced.type,announced.message,raw,announced.size,announced.thumbnail,err);
+	servercmd_upload_receipt(announced.id,posted,err);
+	if(!posted)
+		return;
+
+	// remembered for a while, in case the receipt doesn't make it and the client sends it again
+	try{
+		os::file(parent.spool_path(announced.id+".done"));
+	}catch(const std::exception &e){
+		log_error(std::string("spooling an upload: ")+e.what());
+	}
+}
+
+// recv the thumbnail that follows an image, false (and nothing read into <thumbnail>) if it's too big to take
+bool Client::recv_thumbnail(std::vector<unsigned char> &thumbnail){
+	std::uint64_t thumbnail_size;
+	recv(&thumbnail_size,sizeof(thumbnail_size));
+
+	if(thumbnail_size>MAX_THUMBNAIL_BYTES)
+		return false;
+
+	thumbnail.resize(thumbnail_size);
+	if(thumbnail_size>0)
+		recv(thumbnail.data(),thumbnail_size);
+
+	return true;
+}
+
+// why a message of <type> with <raw_size> bytes of content can't be posted, empty if it can
+std::string Client::refusal(MessageType type,unsigned long long raw_size){
+	if(type==MessageType::IMAGE&&raw_size>MAX_IMAGE_BYTES)
+		return "Images larger than "+Client::format(MAX_IMAGE_BYTES)+" are not allowed.";
+	else if(type==MessageType::FILE&&raw_size>MAX_FILE_BYTES)
+		return "Files larger than "+Client::format(MAX_FILE_BYTES)+" are not allowed.";
+	else if(type==MessageType::TEXT&&raw_size>0)
+		return "The \"raw\" field is not allowed for general text messages.\nThis likely indicates a client implementation error.";
+
+	return {};
+}
+
+// post a message to <chat>, true if it went through, otherwise <err> says why
+// takes ownership of <raw>, which has been checked with refusal() already
+bool Client::post(const std::optional<Chat> &chat,MessageType type,std::string message,unsigned char *raw,unsigned long long raw_size,std::vector<unsigned char> &thumbnail,std::string &err){
+	if(type==MessageType::IMAGE){
+		// small images can stand in for their own thumbnail
+		if(thumbnail.size()==0&&raw_size<=MAX_THUMBNAIL_BYTES)
+			thumbnail.assign(raw,raw+raw_size);
+
+		message+=" ("+Client::format(raw_size)+")";
+	}
+	else if(type==MessageType::FILE)
+		message+=" ("+Client::format(raw_size)+")";
+
 	// don't let messages of zero length through
 	if(message.length()==0){
-		servercmd_message_receipt(false, "No zero-length messages!");
+		err="No zero-length messages!";
 		delete[] raw;
-		return;
+		return false;
 	}
 
 	Message msg(0,type,time(NULL),message,name,raw,raw_size);
 
-	if(subscribed){
-		parent.new_msg(subscribed.value(),msg);
-		servercmd_message_receipt(true,{});
+	if(!chat){
+		err="You are not subscribed to any chat sessions!";
+		return false;
 	}
-	else
-		servercmd_message_receipt(false, "You are not subscribed to any chat sessions!");
+
+	parent.new_msg(chat.value(),msg,thumbnail);
+	return true;
 }
 
 // client is requesting a file
@@ -389,8 +849,94 @@ void Client::clientcmd_get_file(){
 	std::uint64_t id;
 	recv(&id, sizeof(id));
 
-	std::vector<unsigned char> buffer=parent.get_file(id, subscribed.value().id);
-	servercmd_send_file(buffer);
+	// how much of it the client has already, from a download that was cut off
+	std::uint64_t offset;
+	recv(&offset, sizeof(offset));
+
+	// it's read in and goes out a slice at a time from the loop, see send_file_slice()
+	const int chat=subscribed?(int)subscribed.value().id:0;
+	files.push({id, chat, offset, false, {}, {}});
+}
+
+// client is searching the chat they're subscribed to
+// implements ClientCommand::SEARCH
+void Client::clientcmd_search(){
+	const std::string query=get_string();
+
+	// which page of results
+	std::uint64_t offset;
+	recv(&offset,sizeof(offset));
+	std::uint32_t count;
+	recv(&count,sizeof(count));
+
+	if(!subscribed){
+		servercmd_search_results(false,"You are not subscribed to any chat sessions!",{});
+		return;
+	}
+
+	if(count>MAX_SEARCH_RESULTS)
+		count=MAX_SEARCH_RESULTS;
+
+	std::vector<Message> results;
+	try{
+		results=parent.search(subscribed.value().id,query,offset,count);
+	}catch(const std::exception &e){
+		// most likely a malformed query
+		servercmd_search_results(false,e.what(),{});
+		return;
+	}
+
+	servercmd_search_results(true,{},results);
+}
+
+// client missed some messages in the chat they're subscribed to, and wants them
+// implements ClientCommand::GET_RANGE
+void Client::clientcmd_get_range(){
+	// the last message the client has before the gap, and the last one it's missing
+	std::uint64_t after;
+	recv(&after,sizeof(after));
+	std::uint64_t through;
+	recv(&through,sizeof(through));
+
+	if(!subscribed||through<=after){
+		servercmd_range(through,{});
+		return;
+	}
+
+	const std::vector<Message> messages=parent.get_messages_range(after,through,subscribed.value().id,MAX_RANGE_MESSAGES);
+
+	// a full reply may not have reached <through>, the client will ask again from where it stops
+	if(messages.size()==MAX_RANGE_MESSAGES)
+		through=messages.back().id;
+
+	servercmd_range(through,messages);
+}
+
+// tell the client how much of its upload the spool already has, it sends the rest with UPLOAD_DATA
+// implements ServerCommand::UPLOAD
+void Client::servercmd_upload(const std::string &id,unsigned long long have){
+	ServerCommand type=ServerCommand::UPLOAD;
+	send(&type,sizeof(type));
+
+	send_string(id);
+
+	std::uint64_t offset=have;
+	send(&offset,sizeof(offset));
+}
+
+// tell the client how its upload <id> went
+// implements ServerCommand::UPLOAD_RECEIPT
+void Client::servercmd_upload_receipt(const std::string &id,bool success,const std::string &msg){
+	ServerCommand type=ServerCommand::UPLOAD_RECEIPT;
+	send(&type,sizeof(type));
+
+	send_string(id);
+
+	std::uint8_t worked=success?1:0;
+	send(&worked,sizeof(worked));
+
+	if(!success)
+		send_string(msg);
 }
 
 // send the client their (validated) name back
@@ -400,16 +946,46 @@ void Client::servercmd_introduce(){
 	send(&type, sizeof(type));
 
 	send_string(name);
+	send_string(token);
+}
+
+// tell the client if it got its session back
+// implements ServerCommand::RESUME
+void Client::servercmd_resume(bool success){
+	ServerCommand type=ServerCommand::RESUME;
+	send(&type,sizeof(type));
+
+	std::uint8_t worked=success?1:0;
+	send(&worked,sizeof(worked));
+
+	if(!success)
+		return;
+
+	send_string(name);
+	send_string(token);
+
+	// the client asks for anything after what it has and up to here with GET_RANGE, the rest is still in the out queue
+	std::uint64_t sent=last_sent;
+	send(&sent,sizeof(sent));
 }
 
 // send the client a list of chats
+// if <full> is set, the client must discard any chats it already knows about
+// otherwise <chats> are only the chats that were created since the client last asked
 // implements ServerCommand::LIST_CHATS
-void Client::servercmd_list_chats(const std::vector<Chat> &chats){
+void Client::servercmd_list_chats(bool full,unsigned long long version,const std::vector<Chat> &chats){
 	ServerCommand type=ServerCommand::LIST_CHATS;
 	send(&type,sizeof(type));
 
 	send_string(parent.get_name());
 
+	std::uint8_t replace=full?1:0;
+	send(&replace,sizeof(replace));
+
+	// send the directory version
+	std::uint64_t v=version;
+	send(&v,sizeof(v));
+
 	// send how many chats
 	std::uint64_t count=chats.size();
 	send(&count,sizeof(count));
@@ -448,37 +1024,7 @@ void Client::servercmd_subscribe(bool success,unsigned long long max){
 
 	// send all messages in the chat where message.id > max
 	// basically getting the client back up to date since they were last connected
-	std::vector<Message> since=parent.get_messages_since(max,subscribed.value().id);
-
-	// send the count
-	std::uint64_t count=since.size();
-	send(&count,sizeof(count));
-
-	// send <count> messages
-	for(const Message &msg:since){
-		// send id
-		send(&msg.id,sizeof(msg.id));
-
-		// send the message type
-		send(&msg.type,sizeof(type));
-
-		// send the unixtime
-		send(&msg.unixtime,sizeof(msg.unixtime));
-
-		// send msg
-		send_string(msg.msg);
-
-		// send sender
-		send_string(msg.sender);
-
-		// send raw
-		std::uint64_t raw_size=msg.raw_size;
-		send(&raw_size,sizeof(raw_size));
-
-		if(raw_size>0){
-			send(msg.raw,raw_size);
-		}
-	}
+	send_messages(parent.get_messages_since(max,subscribed.value().id));
 }
 
 // send the client a message
@@ -501,6 +1047,9 @@ void Client::servercmd_message(const Message &msg){
 
 	send(&msg.raw_size,sizeof(msg.raw_size));
 	send(msg.raw,msg.raw_size);
+
+	// only once it's all out, a RESUME picks up after it
+	last_sent=std::max<unsigned long long>(last_sent,msg.id);
 }
 
 // tell the client whether their sent message was successful
@@ -518,15 +1067,106 @@ void Client::servercmd_message_receipt(bool success, const std::string &msg){
 	}
 }
 
-// send a file to the client
-void Client::servercmd_send_file(const std::vector<unsigned char> &buffer){
+// send the client the messages it asked for with GET_RANGE
+// everything up to <through> that isn't in <messages> is gone, the client shouldn't ask for it again
+// implements ServerCommand::RANGE
+void Client::servercmd_range(unsigned long long through,const std::vector<Message> &messages){
+	ServerCommand type=ServerCommand::RANGE;
+	send(&type,sizeof(type));
+
+	std::uint64_t t=through;
+	send(&t,sizeof(t));
+
+	send_messages(messages);
+}
+
+// tell the client a file is coming, or the part of it after where it asked to start
+// its hash goes with it, for the client to check what it ends up with
+// implements ServerCommand::SEND_FILE
+void Client::servercmd_send_file(const Outgoing &file){
 	ServerCommand type=ServerCommand::SEND_FILE;
 	send(&type, sizeof(type));
 
-	std::uint64_t size=(std::uint64_t)buffer.size();
+	std::uint64_t size=(std::uint64_t)file.data.size();
 	send(&size, sizeof(size));
 
-	send(&buffer[0], size);
+	send_string(file.hash);
+
+	std::uint64_t from=file.sent;
+	send(&from, sizeof(from));
+}
+
+// send the next slice of <file>
+// implements ServerCommand::FILE_DATA
+void Client::servercmd_file_data(Outgoing &file){
+	ServerCommand type=ServerCommand::FILE_DATA;
+	send(&type, sizeof(type));
+
+	std::uint32_t length=std::min<unsigned long long>(file.data.size()-file.sent, TRANSFER_SLICE_BYTES);
+	send(&length, sizeof(length));
+
+	send(file.data.data()+file.sent, length);
+	file.sent+=length;
+}
+
+// send the client one page of search results, best matches first
+// each message's text is a snippet of the original, with the matching words [bracketed]
+// implements ServerCommand::SEARCH_RESULTS
+void Client::servercmd_search_results(bool success,const std::string &errmsg,const std::vector<Message> &results){
+	ServerCommand type=ServerCommand::SEARCH_RESULTS;
+	send(&type,sizeof(type));
+
+	std::uint8_t worked=success?1:0;
+	send(&worked,sizeof(worked));
+
+	if(!success){
+		send_string(errmsg);
+		return;
+	}
+
+	std::uint64_t count=results.size();
+	send(&count,sizeof(count));
+
+	for(const Message &msg:results){
+		send(&msg.id,sizeof(msg.id));
+		send(&msg.type,sizeof(msg.type));
+		send(&msg.unixtime,sizeof(msg.unixtime));
+		send_string(msg.msg);
+		send_string(msg.sender);
+	}
+}
+
+// send a count, then <messages>, the way SUBSCRIBE and RANGE replies carry them
+void Client::send_messages(const std::vector<Message> &messages){
+	std::uint64_t count=messages.size();
+	send(&count,sizeof(count));
+
+	for(const Message &msg:messages){
+		// send id
+		send(&msg.id,sizeof(msg.id));
+
+		// send the message type
+		send(&msg.type,sizeof(msg.type));
+
+		// send the unixtime
+		send(&msg.unixtime,sizeof(msg.unixtime));
+
+		// send msg
+		send_string(msg.msg);
+
+		// send sender
+		send_string(msg.sender);
+
+		// send raw
+		std::uint64_t raw_size=msg.raw_size;
+		send(&raw_size,sizeof(raw_size));
+
+		if(raw_size>0){
+			send(msg.raw,raw_size);
+		}
+
+		last_sent=std::max<unsigned long long>(last_sent,msg.id);
+	}
 }
 
 // send the client a heartbeat to see if they are disconnected
@@ -535,3 +1175,19 @@ void Client::servercmd_heartbeat(){
 	ServerCommand type=ServerCommand::HEARTBEAT;
 	send(&type,sizeof(type));
 }
+
+// tell the client about a newly created chat
+// implements ServerCommand::CHAT_CREATED
+void Client::servercmd_chat_created(const Chat &chat,unsigned long long version){
+	ServerCommand type=ServerCommand::CHAT_CREATED;
+	send(&type,sizeof(type));
+
+	// send the directory version
+	std::uint64_t v=version;
+	send(&v,sizeof(v));
+
+	send(&chat.id,sizeof(chat.id));
+	send_string(chat.name);
+	send_string(chat.creator);
+	send_string(chat.description);
+}
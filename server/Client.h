@@ -10,6 +10,11 @@
 #include <queue>
 #include <optional>
 
+// how much fan-out may wait for a client before the oldest of it is dropped
+// the client sees the gap in the message ids and asks for what it missed with GET_RANGE
+#define OUT_QUEUE_MESSAGES 1024
+#define OUT_QUEUE_BYTES (8*1024*1024)
+
 class Client;
 class Server;
 
@@ -37,6 +42,29 @@ struct ClientKickException:std::exception{
 	std::string reason;
 };
 
+// a file or image the client announced with UPLOAD, its content comes in UPLOAD_DATA slices
+struct Upload{
+	std::string id; // picked by the client, names the spool file along with <hash>
+	MessageType type;
+	std::string message;
+	unsigned long long size;
+	std::string hash; // sha-256 of the content, hex
+	std::vector<unsigned char> thumbnail;
+	std::optional<Chat> chat; // the chat that was subscribed when it was announced, it's posted there
+	bool failed; // the spool couldn't take it and the client has been told, the rest of its slices are let go
+};
+
+// a file the client asked for with GET_FILE, going out a slice at a time between everything else
+// its content is only read in once it gets to the front of the queue, so a client holds one file at a time however many it asks for
+struct Outgoing{
+	unsigned long long id; // the message it's in
+	int chat; // the chat the client was subscribed to when it asked, 0 if none
+	unsigned long long sent; // where the next slice starts, at first how much of it the client has already
+	bool announced; // its SEND_FILE has gone out
+	std::vector<unsigned char> data;
+	std::string hash;
+};
+
 class Client{
 public:
 	explicit Client(Server&,int);
@@ -45,24 +73,37 @@ public:
 	void operator()();
 	void join();
 	const std::string &get_name()const;
+	const std::string &get_token()const;
 	bool dead()const;
+	bool parked()const;
+	bool expired(time_t)const;
+	void adopt(Client&);
+	void unpark();
 	bool is_subscribed(const Chat&);
 	void kick(const std::string&)const;
 	void addmsg(const Message&);
+	void addchat(const Chat&,unsigned long long);
+	static std::string format(unsigned long long);
 
 private:
 	void send(const void*,unsigned);
 	void recv(void*,unsigned);
 	void loop();
 	void dispatch();
+	void requeue(std::queue<Message>&,std::queue<std::pair<Chat,unsigned long long>>&);
 	void recv_command();
 	void heartbeat();
 	void check_timeout();
+	void send_file_slice();
 	bool subscribe(const std::string&);
 	std::string get_string();
 	void send_string(const std::string&);
-	static std::string format(int);
+	bool recv_thumbnail(std::vector<unsigned char>&);
+	bool post(const std::optional<Chat>&,MessageType,std::string,unsigned char*,unsigned long long,std::vector<unsigned char>&,std::string&);
+	static std::string refusal(MessageType,unsigned long long);
 	static std::string strip_new_lines(const std::string&);
+	static std::string new_token();
+	static bool is_hex(const std::string&,size_t);
 
 	// net commands implementing ClientCommand::*
 	void clientcmd_introduce();
@@ -71,27 +112,50 @@ private:
 	void clientcmd_subscribe();
 	void clientcmd_message();
 	void clientcmd_get_file();
+	void clientcmd_search();
+	void clientcmd_get_range();
+	void clientcmd_resume();
+	void clientcmd_upload();
+	void clientcmd_upload_data();
 	// net commands implementing ServerCommand::*
 	void servercmd_introduce();
-	void servercmd_list_chats(const std::vector<Chat>&);
+	void servercmd_list_chats(bool,unsigned long long,const std::vector<Chat>&);
 	void servercmd_new_chat(bool);
 	void servercmd_subscribe(bool,unsigned long long);
 	void servercmd_message(const Message&);
 	void servercmd_message_receipt(bool, const std::string&);
-	void servercmd_send_file(const std::vector<unsigned char>&);
+	void servercmd_send_file(const Outgoing&);
+	void servercmd_file_data(Outgoing&);
 	void servercmd_heartbeat();
+	void servercmd_chat_created(const Chat&,unsigned long long);
+	void servercmd_search_results(bool,const std::string&,const std::vector<Message>&);
+	void servercmd_range(unsigned long long,const std::vector<Message>&);
+	void servercmd_resume(bool);
+	void servercmd_upload(const std::string&,unsigned long long);
+	void servercmd_upload_receipt(const std::string&,bool,const std::string&);
+	void send_messages(const std::vector<Message>&);
 
 	Server &parent;
 	net::tcp tcp;
 	std::atomic<bool> disconnected;
 	std::queue<Message> out_queue; // pending messages to be sent
-	std::atomic<int> out_queue_len; // lock free length of out_queue
-	std::mutex out_queue_lock; // guards access to <out_queue>
+	std::queue<std::pair<Chat,unsigned long long>> out_chats; // pending new chat notifications (and the directory version) to be sent
+	std::atomic<int> out_queue_len; // lock free length of out_queue + out_chats
+	unsigned long long out_queue_bytes; // size of the text and thumbnails in <out_queue>
+	unsigned long long dropped; // messages dropped from <out_queue> since the last dispatch
+	std::mutex out_queue_lock; // guards access to <out_queue>, <out_chats>, <out_queue_bytes> and <dropped>
 	time_t last_sent_heartbeat;
 	time_t last_received_heartbeat;
 	std::string name; // client name
-	std::thread thread;
+	bool introduced; // <name> has been claimed from the server
+	std::string token; // secret the client can RESUME this session with, empty if it can't be
+	std::atomic<bool> waiting; // dropped off the network, but the session is kept for RESUME_SECONDS
+	time_t disconnected_at;
+	unsigned long long last_sent; // id of the newest message in <subscribed> that went out to the client
 	std::optional<Chat> subscribed; // current subscribed chat
+	std::optional<Upload> upload; // announced, its UPLOAD_DATA slices are coming in
+	std::queue<Outgoing> files; // asked for with GET_FILE, the front one is going out
+	std::thread thread; // last, it starts in the constructor and uses everything above
 };
 
 #endif // CLIENT_H
@@ -1,6 +1,11 @@
 #include <fstream>
 #include <cstdlib>
 #include <optional>
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+#include <chrono>
+#include <climits>
 
 #include <time.h>
 
@@ -8,14 +13,23 @@
 #include "os.h"
 #include "log.h"
 #include "csv.h"
-
-Database::Database(const std::string &dbpath)
-	: db_path(dbpath)
+#include "sha256.h"
+#include "SqliteStore.h"
+#include "SegmentLog.h"
+
+Database::Database(const std::string &dbpath, unsigned limit, Engine e)
+	: open_limit(limit > 0 ? limit : 1)
+	, engine(e)
+	, hits(0)
+	, misses(0)
+	, db_path(dbpath)
 {
 	os::mkdir(db_path);
 
 	const std::string &master_file_path = dbpath + "/master";
 	const std::string &directory_path = db_path + "/directory";
+	const std::string &catalog_path = db_path + "/catalog";
+	blob_path = db_path + "/blobs";
 
 	// create the master file
 	if(!Database::exists(master_file_path)){
@@ -34,13 +48,68 @@ Database::Database(const std::string &dbpath)
 			throw std::runtime_error("Error, server name not 25 characters");
 	}
 
-	// create the directory file
-	if(!Database::exists(directory_path)){
-		// create the directory file
-		std::ofstream dirfile(directory_path);
+	// open the catalog, the directory of all chats
+	catalog.open(catalog_path);
+
+	const std::string create_table =
+	"create table if not exists chats (\n"
+	"id integer primary key,\n"
+	"name text not null,\n"
+	"creator text not null,\n"
+	"description text not null);";
+
+	catalog.execute(create_table);
+
+	// retention policy for individual chats, null columns fall back to the server's defaults (see Retention)
+	const std::string create_retention =
+	"create table if not exists retention (\n"
+	"chat integer primary key,\n" // chats.id
+	"max_age int,\n" // seconds
+	"max_count int,\n" // messages
+	"max_bytes int);"; // file and image content
+
+	catalog.execute(create_retention);
+
+	// when maintenance next has something to do in each chat, so dormant ones aren't opened every pass
+	// a chat without a row, or whose policy has changed since, is due right away
+	const std::string create_upkeep =
+	"create table if not exists upkeep (\n"
+	"chat integer primary key,\n" // chats.id
+	"due int,\n" // unixtime, null if only a new message can give it anything to delete
+	"max_age int not null,\n" // the policy <due> was worked out for, see Retention
+	"max_count int not null,\n"
+	"max_bytes int not null);";
+
+	catalog.execute(create_upkeep);
+
+	// open the blob store, shared by all chats
+	// identical content posted any number of times, in any number of chats, is stored once
+	blobs.open(blob_path);
+
+	// lets maintenance give space back a little at a time, only takes effect on a new file
+	blobs.execute("pragma auto_vacuum=incremental;");
+	blobs.busy_timeout(5000);
+
+	const std::string create_blobs =
+	"create table if not exists blobs (\n"
+	"hash text primary key,\n" // sha-256 of <data>, hex
+	"size int not null,\n"
+	"refs int not null,\n" // how many messages refer to it
+	"data blob not null);";
+
+	blobs.execute(create_blobs);
+
+	{
+		lite3::statement wal(blobs, "pragma journal_mode=wal;");
+		wal.execute();
 	}
+	ChatStore::limit_wal(blobs, "main");
+
+	// older servers kept the directory in a csv file
+	if(Database::exists(directory_path))
+		import_directory(directory_path);
 
-	// populate the chat list and dbs map
+	// populate the chat list
 	initialize();
 }
 
@@ -54,173 +123,639 @@ const std::vector<Chat> &Database::get_chats(){
 	return list;
 }
 
-// register a new chat to the database
-void Database::new_chat(const Chat &chat){
+// get the version of the chat directory
+// chats are never modified after they are created, and are given ids in increasing order,
+// so the highest chat id doubles as the directory version
+unsigned long long Database::get_version(){
+	return Database::highest_id(list);
+}
+
+// register a new chat to the database, return the newly registered chat
+Chat Database::new_chat(const Chat &chat){
 	const int id = Database::highest_id(list) + 1;
 	const std::string &path = (db_path + "/" + std::to_string(id));
-	lite3::connection conn(path);
 
-	// create the messages table
-	const std::string create_table =
-	"create table messages (\n"
-	"id integer primary key autoincrement,\n"
-	"type int not null,\n" // MessageType enum in chat.h
-	"unixtime int not null,\n" // unix time
-	"message text not null,\n"
-	"name varchar(511) not null,\n"
-	"raw blob);"; // reserved for file content, image content, will be null for normal messages
+	// the catalog entry is only committed once the chat database exists
+	std::unique_lock<std::mutex> catalog_guard(catalog_lock);
+	catalog.begin();
 
-	conn.execute(create_table);
+	lite3::connection conn;
+	try{
+		// register it in the catalog
+		const std::string insert =
+		"insert into chats (id,name,creator,description) values\n"
+		"(?,?,?,?);";
 
-	list.emplace_back(id, chat.name, chat.creator, chat.description);
-	dbs.emplace(id, std::move(conn));
+		lite3::statement statement(catalog, insert);
 
-	save();
-}
+		statement.bind(1, id);
+		statement.bind(2, chat.name);
+		statement.bind(3, chat.creator);
+		statement.bind(4, chat.description);
 
-// insert a new message into database
-unsigned long long Database::new_msg(const Chat &chat,const Message &msg){
-	lite3::connection &conn = get(chat.id);
+		statement.execute();
 
-	const std::string insert =
-	"insert into messages (type,unixtime,message,name,raw) values\n"
-	"(?,?,?,?,?);";
+		conn.open(path);
 
-	lite3::statement statement(conn, insert);
+		// lets maintenance give space back a little at a time, has to come before the first table
+		conn.execute("pragma auto_vacuum=incremental;");
 
-	statement.bind(1, static_cast<int>(msg.type));
-	statement.bind(2, msg.unixtime);
-	statement.bind(3, msg.msg);
-	statement.bind(4, msg.sender);
-	statement.bind(5, msg.raw, msg.raw_size);
+		if(engine == Engine::LOG)
+			SegmentLog::create(conn, path + CHAT_LOG_SUFFIX);
+		else
+			SqliteStore::create(conn);
 
-	statement.execute();
+		conn.execute("pragma user_version=" + std::to_string(CHAT_SCHEMA_VERSION) + ";");
+	}catch(const std::exception &e){
+		catalog.rollback();
+		throw;
+	}
 
-	// get id of last inserted item
-	const std::string query =
-	"select max(id) from messages;";
-	lite3::statement maxid(conn, query);
+	catalog.commit();
+	catalog_guard.unlock();
 
-	maxid.execute();
-	return maxid.integer(0);
+	// nothing to remember in a brand new chat
+	// nobody knows of it until it's in the list, so it can be set up without <open_lock>
+	const std::shared_ptr<ChatStore> store = std::make_shared<ChatStore>(path, blob_path, std::move(conn), true);
+	std::vector<std::pair<int, std::shared_ptr<ChatStore>>> closing;
+	{
+		std::lock_guard<std::mutex> lock(open_lock);
+		closing = cache(id, store);
+	}
+	close(closing);
+
+	list.emplace_back(id, chat.name, chat.creator, chat.description);
+	return list.back();
+}
+
+// insert a new message into database
+// images carry a <thumbnail>, which stands in for the image in backlogs
+unsigned long long Database::new_msg(const Chat &chat,const Message &msg,const std::vector<unsigned char> &thumbnail){
+	const std::shared_ptr<ChatStore> store = get(chat.id);
+	std::lock_guard<std::mutex> lock(store->write_lock);
+	lite3::connection &conn = store->conn;
+
+	// hash outside the transaction, it's the slow part
+	std::string hash;
+	if(msg.raw_size > 0)
+		hash = SHA256::hex(msg.raw, msg.raw_size);
+
+	std::string thumb;
+	if(thumbnail.size() > 0)
+		thumb = SHA256::hex(thumbnail.data(), thumbnail.size());
+
+	// the first message since the last maintenance pass makes the chat due again
+	if(!store->written)
+		mark_written(chat.id);
+
+	unsigned long long id;
+	// the blob store is shared with every other chat's writer, and its refcount is read before it's written
+	conn.begin_immediate();
+	try{
+		if(msg.raw_size > 0)
+			ChatStore::store_blob(conn, hash, msg.raw, msg.raw_size);
+		if(thumbnail.size() > 0)
+			ChatStore::store_blob(conn, thumb, thumbnail.data(), thumbnail.size());
+
+		id = store->messages->insert(conn, {0, msg.type, msg.unixtime, msg.msg, msg.sender, hash, msg.raw_size, thumb});
+
+		// nothing is committed that the message store didn't manage to write
+		store->messages->prepare();
+		conn.commit();
+	}catch(const std::exception &e){
+		// the message store first, sqlite may have rolled back on its own already
+		store->messages->rollback();
+		conn.rollback();
+		throw;
+	}
+	store->messages->commit();
+	store->written = true;
+
+	// keep it around for clients that are only a few messages behind
+	// files aren't part of the backlog, clients ask for them separately, and images are only there as their thumbnail
+	Message copy(id, msg.type, msg.unixtime, msg.msg, msg.sender, NULL, 0);
+	if(msg.type == MessageType::IMAGE && thumbnail.size() > 0){
+		copy.raw = new unsigned char[thumbnail.size()];
+		copy.raw_size = thumbnail.size();
+		memcpy(copy.raw, thumbnail.data(), thumbnail.size());
+	}
+
+	store->remember(std::move(copy));
+
+	return id;
 }
 
 // get all messages from chat <name> where id is bigger than <since>
 std::vector<Message> Database::get_messages_since(unsigned long long since, int chatid){
-	lite3::connection &conn = get(chatid);
+	return get_messages_range(since, ULLONG_MAX, chatid, UINT_MAX);
+}
 
-	const std::string query =
-	"select * from messages where id > ?;";
-	lite3::statement statement(conn, query);
-
-	statement.bind(1, (std::int64_t)since);
-
-	std::vector<Message> messages;
-	while(statement.execute()){
-		// blob only needs to be retrieved if the Message type is IMAGE
-		const MessageType type = (MessageType)statement.integer(1);
-
-		unsigned char *raw=NULL;
-		int raw_size=0;
-		if(type == MessageType::IMAGE){
-			// get the blob first
-			raw_size = statement.blob_size(5);
-			const unsigned char *const r = (unsigned char*)statement.blob(5);
-			if(r != NULL){
-				// must copy it from sqlite's memory
-				raw=new unsigned char[raw_size];
-				memcpy(raw, r, raw_size);
-			}
+// get up to <limit> messages from chat <chatid> with ids after <after>, up to and including <through>, oldest first
+std::vector<Message> Database::get_messages_range(unsigned long long after, unsigned long long through, int chatid, unsigned limit){
+	const std::shared_ptr<ChatStore> store = get(chatid);
+
+	// the client is only a little behind, no need to bother sqlite
+	{
+		std::lock_guard<std::mutex> lock(store->write_lock);
+
+		if(store->covers(after)){
+			++hits;
+
+			auto first = std::upper_bound(store->recent.begin(), store->recent.end(), after, [](unsigned long long id, const Message &msg){
+				return id < msg.id;
+			});
+			auto last = std::upper_bound(first, store->recent.end(), through, [](unsigned long long id, const Message &msg){
+				return id < msg.id;
+			});
+
+			if((unsigned long long)(last - first) > limit)
+				last = first + limit;
+
+			return {first, last};
 		}
+	}
+
+	++misses;
+	ReadPool::lease reader = store->readers.borrow();
+
+	return store->messages->range(*reader, after, through, limit);
+}
+
+// get a file and return it, <hash> is set to its sha-256
+std::vector<unsigned char> Database::get_file(unsigned long long id, int chatid, std::string &hash){
+	const std::shared_ptr<ChatStore> store = get(chatid);
+	ReadPool::lease reader = store->readers.borrow();
 
-		messages.push_back({
-			(decltype(Message::id))statement.integer(0),
-			type,
-			statement.integer(2),
-			statement.str(3),
-			statement.str(4),
-			raw,
-			(decltype(Message::raw_size))raw_size
-		});
+	std::vector<unsigned char> raw;
+	try{
+		raw = store->messages->file(*reader, id, hash);
+	}catch(const std::exception &e){
+		throw std::runtime_error(std::string(e.what()) + ", chatid " + std::to_string(chatid));
 	}
 
-	return messages;
+	// content that hasn't been moved to the blob store yet isn't keyed by its hash
+	if(hash == "")
+		hash = SHA256::hex(raw.data(), raw.size());
+
+	return raw;
+}
+
+// full text search of chat <chatid> for <query> (fts5 query syntax), best matches first
+// returns up to <count> results, skipping the first <offset>
+// the text of each result is a snippet around the matching words, which are [bracketed]
+std::vector<Message> Database::search(int chatid, const std::string &query, unsigned long long offset, unsigned count){
+	const std::shared_ptr<ChatStore> store = get(chatid);
+	ReadPool::lease reader = store->readers.borrow();
+
+	return store->messages->search(*reader, query, offset, count);
+}
+
+// number of backlog requests served from memory
+unsigned long long Database::cache_hits()const{
+	return hits.load();
 }
 
-// get a file and return it
-std::vector<unsigned char> Database::get_file(unsigned long long id, int chatid){
-	lite3::connection &conn = get(chatid);
+// number of backlog requests served from sqlite
+unsigned long long Database::cache_misses()const{
+	return misses.load();
+}
+
+// retention policy for chat <chatid>, anything the catalog doesn't say comes from <defaults>
+Retention Database::get_retention(int chatid, const Retention &defaults){
+	std::lock_guard<std::mutex> lock(catalog_lock);
 
 	const std::string query =
-	"select raw from messages where id=?;";
-	lite3::statement statement(conn, query);
+	"select coalesce(max_age,-1),coalesce(max_count,-1),coalesce(max_bytes,-1) from retention where chat=?;";
+	lite3::statement statement(catalog, query);
 
-	statement.bind(1, (std::int64_t)id);
+	statement.bind(1, chatid);
 
-	std::vector<unsigned char> raw;
+	Retention policy = defaults;
 	if(statement.execute()){
-		raw.resize(statement.blob_size(0));
-		const unsigned char *const r = (unsigned char*)statement.blob(0);
+		if(statement.long_integer(0) >= 0)
+			policy.max_age = statement.long_integer(0);
+		if(statement.long_integer(1) >= 0)
+			policy.max_count = statement.long_integer(1);
+		if(statement.long_integer(2) >= 0)
+			policy.max_bytes = statement.long_integer(2);
+	}
 
-		if(r != NULL)
-			memcpy(raw.data(), r, raw.size());
-		else
-			throw std::runtime_error("raw blob for file id " + std::to_string(id) + ", chatid " + std::to_string(chatid));
+	return policy;
+}
+
+// delete whatever chat <chatid> has outgrown under <policy>, and give the space back to the file system
+// everything is done in small steps with rests in between, new messages only ever wait on one step
+// stops early once <running> is cleared
+// a chat that keeps everything is left alone unless it's open, and then only if it was written to since the last time
+// one with a policy is left alone until the catalog says it's due, see Database::schedule
+Reclaimed Database::maintain(int chatid, const Retention &policy, const std::atomic<bool> &running){
+	Reclaimed reclaimed;
+
+	const bool limited = policy.max_age > 0 || policy.max_count > 0 || policy.max_bytes > 0;
+	if(limited && !due(chatid, policy))
+		return reclaimed;
+
+	const std::shared_ptr<ChatStore> store = limited ? get(chatid, false) : peek(chatid);
+	if(!store)
+		return reclaimed;
+
+	bool written;
+	unsigned long long before;
+	{
+		std::lock_guard<std::mutex> lock(store->write_lock);
+		written = store->written;
+		store->written = false;
+
+		before = ChatStore::size(store->conn) + store->messages->size();
+		store->messages->sync();
+	}
+
+	// delete from the oldest end
+	if(limited){
+		unsigned long long cutoff;
+		{
+			ReadPool::lease reader = store->readers.borrow();
+			cutoff = store->messages->cutoff(*reader, policy);
+		}
+		while(cutoff > 0 && running.load()){
+			if(delete_through(*store, cutoff, reclaimed) == 0)
+				break;
+
+			Database::pause();
+		}
+
+		// a pass cut short is still due
+		if(running.load()){
+			std::lock_guard<std::mutex> lock(store->write_lock);
+
+			if(store->written)
+				schedule(chatid, policy, time(NULL));
+			else if(policy.max_age > 0)
+				schedule(chatid, policy, store->messages->expires(store->conn, policy.max_age));
+			else
+				schedule(chatid, policy, 0);
+		}
 	}
+
+	// nothing has changed since the last pass, there's no space to give back or wal to checkpoint
+	if(!written && reclaimed.messages == 0)
+		return reclaimed;
+
+	if(running.load())
+		vacuum(store->conn, store->write_lock, running, true);
+
+	{
+		std::lock_guard<std::mutex> lock(store->write_lock);
+
+		// compacting the database moved things around in the wal, move them back in to the database
+		lite3::statement checkpoint(store->conn, "pragma wal_checkpoint(passive);");
+		checkpoint.execute();
+
+		const unsigned long long after = ChatStore::size(store->conn) + store->messages->size();
+		if(after < before)
+			reclaimed.bytes += before - after;
+	}
+
+	return reclaimed;
+}
+
+// does chat <chatid> have anything to delete under <policy>, going by what the last maintenance pass left in the catalog
+bool Database::due(int chatid, const Retention &policy){
+	std::lock_guard<std::mutex> lock(catalog_lock);
+
+	const std::string query =
+	"select coalesce(due,-1),max_age,max_count,max_bytes from upkeep where chat=?;";
+	lite3::statement statement(catalog, query);
+
+	statement.bind(1, chatid);
+
+	if(!statement.execute())
+		return true;
+
+	if((unsigned long long)statement.long_integer(1) != policy.max_age ||
+		(unsigned long long)statement.long_integer(2) != policy.max_count ||
+		(unsigned long long)statement.long_integer(3) != policy.max_bytes)
+		return true;
+
+	const long long when = statement.long_integer(0);
+	return when >= 0 && when <= time(NULL);
+}
+
+// note in the catalog that chat <chatid> has nothing to delete under <policy> until unixtime <when>
+// 0 means not until a new message is written, see Database::mark_written
+void Database::schedule(int chatid, const Retention &policy, long long when){
+	std::lock_guard<std::mutex> lock(catalog_lock);
+
+	const std::string query =
+	"insert or replace into upkeep (chat,due,max_age,max_count,max_bytes) values\n"
+	"(?,?,?,?,?);";
+	lite3::statement statement(catalog, query);
+
+	statement.bind(1, chatid);
+	if(when > 0)
+		statement.bind(2, (std::int64_t)when);
 	else
-		throw std::runtime_error("no record for message id " + std::to_string(id) + ", chatid " + std::to_string(chatid));
+		statement.bind(2, nullptr);
+	statement.bind(3, (std::int64_t)policy.max_age);
+	statement.bind(4, (std::int64_t)policy.max_count);
+	statement.bind(5, (std::int64_t)policy.max_bytes);
 
-	return raw;
+	statement.execute();
 }
 
-// read the directory file, populate the <list>, and init the sqlite3 dbs
+// chat <chatid> got a message, make it due for the next maintenance pass
+// done before the message is committed, a crash in between costs a pass that finds nothing
+void Database::mark_written(int chatid){
+	std::lock_guard<std::mutex> lock(catalog_lock);
+
+	lite3::statement statement(catalog, "update upkeep set due=0 where chat=?;");
+
+	statement.bind(1, chatid);
+	statement.execute();
+}
+
+// give back the space of the blobs that chat maintenance deleted
+Reclaimed Database::maintain_blobs(const std::atomic<bool> &running){
+	Reclaimed reclaimed;
+
+	unsigned long long before;
+	{
+		std::lock_guard<std::mutex> lock(blobs_lock);
+		before = ChatStore::size(blobs);
+	}
+
+	// every chat writes to the blob store, it's never compacted all at once
+	vacuum(blobs, blobs_lock, running, false);
+
+	{
+		std::lock_guard<std::mutex> lock(blobs_lock);
+
+		lite3::statement checkpoint(blobs, "pragma wal_checkpoint(passive);");
+		checkpoint.execute();
+
+		const unsigned long long after = ChatStore::size(blobs);
+		if(after < before)
+			reclaimed.bytes += before - after;
+	}
+
+	return reclaimed;
+}
+
+// read the catalog and populate the <list>
+// chat databases are opened on first use, see Database::get()
 void Database::initialize(){
-	bool resave = false;
-	std::ifstream in(db_path + "/directory");
+	const std::string query =
+	"select id,name,creator,description from chats order by id;";
+	lite3::statement statement(catalog, query);
 
-	while(in.good()){
-		std::string entry;
-		std::getline(in, entry);
+	while(statement.execute())
+		list.emplace_back(statement.integer(0), statement.str(1), statement.str(2), statement.str(3));
+}
 
-		if(entry.size() != 0){
-			const Chat &chat = Database::deserialize(entry);
-			if(!Database::exists(db_path + "/" + std::to_string(chat.id))){
-				resave = true;
+// move the chats from the old csv directory file into the catalog
+void Database::import_directory(const std::string &directory_path){
+	std::ifstream in(directory_path);
+
+	catalog.begin();
+	try{
+		const std::string insert =
+		"insert or ignore into chats (id,name,creator,description) values\n"
+		"(?,?,?,?);";
+
+		while(in.good()){
+			std::string entry;
+			std::getline(in, entry);
+
+			if(entry.size() == 0)
 				continue;
-			}
 
-			// initialize the sqlite3 connection
-			lite3::connection connection(db_path + "/" + std::to_string(chat.id));
+			const Chat &chat = Database::deserialize(entry);
+
+			lite3::statement statement(catalog, insert);
+
+			statement.bind(1, (int)chat.id);
+			statement.bind(2, chat.name);
+			statement.bind(3, chat.creator);
+			statement.bind(4, chat.description);
 
-			dbs.emplace(chat.id, std::move(connection));
-			list.push_back(chat);
+			statement.execute();
 		}
+	}catch(const std::exception &e){
+		catalog.rollback();
+		throw;
+	}
+	catalog.commit();
+
+	in.close();
+
+	// keep the old file around, but out of the way
+	if(std::rename(directory_path.c_str(), (directory_path + ".imported").c_str()))
+		throw std::runtime_error("Could not rename " + directory_path + " after importing it");
+
+	log("imported " + directory_path + " into the catalog");
+}
+
+// get the sqlite database for chat <id>, opening it if necessary
+// unless <touch> is set, this doesn't count as a use, so that maintenance doesn't push the busy chats out
+// opening one takes a while (wal setup, migration, recovering its log), other chats aren't held up by it
+std::shared_ptr<ChatStore> Database::get(int id, bool touch){
+	std::unique_lock<std::mutex> lock(open_lock);
+
+	// only ever one of each, wait for whoever is opening or closing it
+	unbusy.wait(lock, [this, id]{ return busy.count(id) == 0; });
+
+	auto it = dbs.find(id);
+
+	if(it != dbs.end()){
+		// most recently used goes to the front
+		if(touch)
+			open.splice(open.begin(), open, it->second);
+		return it->second->second;
 	}
 
-	if(resave)
-		save();
+	busy.insert(id);
+	lock.unlock();
+
+	std::shared_ptr<ChatStore> store;
+	try{
+		const std::string path = db_path + "/" + std::to_string(id);
+		if(!Database::exists(path))
+			throw std::runtime_error("Could not find sqlite database for chat id " + std::to_string(id));
+
+		store = std::make_shared<ChatStore>(path, blob_path, lite3::connection(path));
+	}catch(const std::exception &e){
+		lock.lock();
+		busy.erase(id);
+		lock.unlock();
+		unbusy.notify_all();
+		throw;
+	}
+
+	lock.lock();
+	busy.erase(id);
+	std::vector<std::pair<int, std::shared_ptr<ChatStore>>> closing = cache(id, store, touch);
+	lock.unlock();
+	unbusy.notify_all();
+
+	close(closing);
+	return store;
 }
 
-lite3::connection &Database::get(int id){
-	std::unordered_map<int, lite3::connection>::iterator it = dbs.find(id);
+// the database for chat <id> if it's open, without opening it or counting as a use, null if it isn't
+std::shared_ptr<ChatStore> Database::peek(int id){
+	std::lock_guard<std::mutex> lock(open_lock);
 
+	auto it = dbs.find(id);
 	if(it == dbs.end())
-		throw std::runtime_error("Could not find sqlite database for chat id " + std::to_string(id));
-	return (*it).second;
+		return nullptr;
+
+	return it->second->second;
 }
 
-// update the directory file
-void Database::save(){
-	std::string contents;
+// keep <store> open as the most recently used database, making room for it by taking out the least recently used ones
+// if <recent> isn't set it goes in as the least recently used instead, first in line to be closed
+// one that's still in use stays, or the next get() would open a second one over the same files
+// if they all are, there are more than <open_limit> open until some are let go of
+// returns the ones taken out, they're busy until the caller hands them to close() after letting go of <open_lock>
+// caller must hold <open_lock>
+std::vector<std::pair<int, std::shared_ptr<ChatStore>>> Database::cache(int id, const std::shared_ptr<ChatStore> &store, bool recent){
+	std::vector<std::pair<int, std::shared_ptr<ChatStore>>> closing;
+
+	for(auto it = open.end(); open.size() >= open_limit && it != open.begin();){
+		--it;
+
+		// nobody can get another hold of it without <open_lock>
+		if(it->second.use_count() == 1){
+			busy.insert(it->first);
+			dbs.erase(it->first);
+			closing.push_back(std::move(*it));
+			it = open.erase(it);
+		}
+	}
 
-	for(const Chat &c : list)
-		contents.append(Database::serialize(c) + "\n");
+	if(recent){
+		open.emplace_front(id, store);
+		dbs[id] = open.begin();
+	}
+	else{
+		open.emplace_back(id, store);
+		dbs[id] = std::prev(open.end());
+	}
+
+	return closing;
+}
 
-	std::ofstream out(db_path + "/directory");
-	if(!out)
-		throw std::runtime_error("Error when writing to directory file");
+// close the databases cache() took out, without holding <open_lock>, then let them be opened again
+void Database::close(std::vector<std::pair<int, std::shared_ptr<ChatStore>>> &closing){
+	for(auto &entry : closing){
+		entry.second.reset();
 
-	out << contents;
+		{
+			std::lock_guard<std::mutex> lock(open_lock);
+			busy.erase(entry.first);
+		}
+		unbusy.notify_all();
+	}
+}
+
+// delete up to MAINTENANCE_BATCH of the oldest messages in <store>, none newer than <cutoff>
+// returns how many were deleted
+unsigned long long Database::delete_through(ChatStore &store, unsigned long long cutoff, Reclaimed &reclaimed){
+	std::lock_guard<std::mutex> lock(store.write_lock);
+	lite3::connection &conn = store.conn;
+
+	std::vector<Record> doomed;
+	conn.begin_immediate();
+	try{
+		doomed = store.messages->remove(conn, cutoff, MAINTENANCE_BATCH);
+
+		for(const Record &msg : doomed){
+			if(msg.hash != "" && ChatStore::release_blob(conn, msg.hash))
+				++reclaimed.blobs;
+			if(msg.thumb != "" && ChatStore::release_blob(conn, msg.thumb))
+				++reclaimed.blobs;
+		}
+	}catch(const std::exception &e){
+		conn.rollback();
+		store.messages->rollback();
+		throw;
+	}
+	conn.commit();
+	store.messages->commit();
+
+	if(doomed.size() == 0)
+		return 0;
+
+	store.forget(doomed.back().id);
+	reclaimed.messages += doomed.size();
+
+	return doomed.size();
+}
+
+// give the free pages in <conn> back to the file system, holding <lock> only a step at a time
+// if <compact> is set, databases that can't do that a step at a time get compacted all at once, but only when it's worth it
+void Database::vacuum(lite3::connection &conn, std::mutex &lock, const std::atomic<bool> &running, bool compact){
+	int mode;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		lite3::statement statement(conn, "pragma auto_vacuum;");
+		statement.execute();
+		mode = statement.integer(0);
+	}
+
+	if(mode == 2){ // incremental
+		while(running.load()){
+			{
+				std::lock_guard<std::mutex> guard(lock);
+
+				{
+					lite3::statement free(conn, "pragma freelist_count;");
+					free.execute();
+					if(free.integer(0) == 0)
+						break;
+				}
+
+				lite3::statement step(conn, "pragma incremental_vacuum(" + std::to_string(VACUUM_STEP_PAGES) + ");");
+				while(step.execute());
+			}
+
+			Database::pause();
+		}
+
+		return;
+	}
+
+	if(!compact)
+		return;
+
+	std::lock_guard<std::mutex> guard(lock);
+
+	long long free_pages, pages;
+	{
+		lite3::statement free(conn, "pragma freelist_count;");
+		free.execute();
+		free_pages = free.long_integer(0);
+
+		lite3::statement count(conn, "pragma page_count;");
+		count.execute();
+		pages = count.long_integer(0);
+	}
+
+	if(free_pages == 0 || free_pages * COMPACT_FREE_RATIO < pages)
+		return;
+
+	// older databases were made without incremental vacuum, it can only be turned on by a full vacuum
+	// this one time, the whole chat waits for it
+	const time_t start = time(NULL);
+	conn.execute("pragma auto_vacuum=incremental;");
+	conn.execute("vacuum;");
+
+	log("compacted a database with " + std::to_string(free_pages) + " free pages in " + std::to_string(time(NULL) - start) + "s");
+}
+
+// rest between maintenance steps
+void Database::pause(){
+	std::this_thread::sleep_for(std::chrono::milliseconds(MAINTENANCE_PAUSE_MS));
 }
 
 // return true if the file exists and does not need to be created
@@ -241,21 +776,6 @@ std::string Database::gen_name(){
 	return {servername};
 }
 
-// turn a chat object into a csv record
-std::string Database::serialize(const Chat &chat){
-	CSVWriter csv;
-
-	char id_string[10];
-	snprintf(id_string, sizeof(id_string), "%d", (int)chat.id);
-
-	csv.add(id_string);
-	csv.add(chat.name);
-	csv.add(chat.creator);
-	csv.add(chat.description);
-
-	return csv.entry();
-}
-
 // get a chat object from a csv record
 Chat Database::deserialize(const std::string &entry){
 	CSVReader csv(entry);
@@ -293,3 +813,219 @@ int Database::highest_id(const std::vector<Chat> &chat_list){
 
 	return highest;
 }
+
+ChatStore::ChatStore(const std::string &path, const std::string &blob_path, lite3::connection &&c, bool empty)
+	: conn(std::move(c))
+	, written(false)
+	, warm(empty)
+	, floor(0)
+	, recent_bytes(0)
+	, readers(path, [blob_path](lite3::connection &reader){ ChatStore::attach(reader, blob_path); })
+{
+	// readers and the writer don't block each other in wal mode
+	{
+		lite3::statement wal(conn, "pragma journal_mode=wal;");
+		wal.execute();
+	}
+
+	conn.busy_timeout(5000);
+
+	ChatStore::attach(conn, blob_path);
+	ChatStore::limit_wal(conn, "main");
+	ChatStore::limit_wal(conn, "store");
+
+	if(os::is_dir(path + CHAT_LOG_SUFFIX))
+		messages = std::make_unique<SegmentLog>(path + CHAT_LOG_SUFFIX, conn);
+	else{
+		migrate();
+		messages = std::make_unique<SqliteStore>();
+	}
+}
+
+// attach the shared blob store to <conn>
+void ChatStore::attach(lite3::connection &conn, const std::string &blob_path){
+	lite3::statement statement(conn, "attach database ? as store;");
+
+	statement.bind(1, blob_path);
+	statement.execute();
+}
+
+// add a reference to <hash> in the blob store attached to <conn>, storing <raw> if it isn't there yet
+// caller must be in a transaction
+void ChatStore::store_blob(lite3::connection &conn, const std::string &hash, const unsigned char *raw, unsigned long long size){
+	const std::string query =
+	"select 1 from store.blobs where hash=?;";
+	lite3::statement present(conn, query);
+
+	present.bind(1, hash);
+
+	if(present.execute()){
+		const std::string update =
+		"update store.blobs set refs=refs+1 where hash=?;";
+		lite3::statement statement(conn, update);
+
+		statement.bind(1, hash);
+		statement.execute();
+	}
+	else{
+		const std::string insert =
+		"insert into store.blobs (hash,size,refs,data) values\n"
+		"(?,?,1,?);";
+		lite3::statement statement(conn, insert);
+
+		statement.bind(1, hash);
+		statement.bind(2, (std::int64_t)size);
+		statement.bind(3, raw, size);
+		statement.execute();
+	}
+}
+
+// drop a reference to <hash> in the blob store attached to <conn>, deleting it when nobody refers to it anymore
+// returns true if it was deleted
+// caller must be in a transaction
+bool ChatStore::release_blob(lite3::connection &conn, const std::string &hash){
+	lite3::statement update(conn, "update store.blobs set refs=refs-1 where hash=?;");
+	update.bind(1, hash);
+	update.execute();
+
+	lite3::statement remove(conn, "delete from store.blobs where hash=? and refs<=0;");
+	remove.bind(1, hash);
+	remove.execute();
+
+	return conn.changes() > 0;
+}
+
+// don't let the wal of <schema> on <conn> keep the space it grew to, once it's been checkpointed
+void ChatStore::limit_wal(lite3::connection &conn, const std::string &schema){
+	lite3::statement limit(conn, "pragma " + schema + ".journal_size_limit=" + std::to_string(WAL_SIZE_LIMIT) + ";");
+	limit.execute();
+}
+
+// size of the main database behind <conn>, in bytes
+unsigned long long ChatStore::size(lite3::connection &conn){
+	lite3::statement pages(conn, "pragma page_count;");
+	pages.execute();
+	lite3::statement page_size(conn, "pragma page_size;");
+	page_size.execute();
+
+	return pages.long_integer(0) * page_size.long_integer(0);
+}
+
+// bring an older chat database up to CHAT_SCHEMA_VERSION
+void ChatStore::migrate(){
+	int version;
+	{
+		lite3::statement statement(conn, "pragma user_version;");
+		statement.execute();
+
+		version = statement.integer(0);
+		if(version >= CHAT_SCHEMA_VERSION)
+			return;
+	}
+
+	conn.begin_immediate();
+	try{
+		if(version < 1)
+			migrate_inline();
+		if(version < 2)
+			migrate_thumbnails();
+		if(version < 3)
+			migrate_search();
+
+		conn.execute("pragma user_version=" + std::to_string(CHAT_SCHEMA_VERSION) + ";");
+	}catch(const std::exception &e){
+		conn.rollback();
+		throw;
+	}
+	conn.commit();
+}
+
+// version 0 kept content inline in messages.raw, move it into the blob store
+void ChatStore::migrate_inline(){
+	conn.execute("alter table messages add column hash text;");
+	conn.execute("alter table messages add column size int;");
+
+	// don't modify the table while scanning it
+	std::vector<std::int64_t> ids;
+	{
+		lite3::statement inline_rows(conn, "select id from messages where raw is not null;");
+		while(inline_rows.execute())
+			ids.push_back(inline_rows.long_integer(0));
+	}
+
+	for(const std::int64_t id : ids){
+		lite3::statement row(conn, "select raw from messages where id=?;");
+		row.bind(1, id);
+		row.execute();
+
+		const unsigned char *const raw = (unsigned char*)row.blob(0);
+		const unsigned long long size = row.blob_size(0);
+		const std::string hash = SHA256::hex(raw, size);
+
+		ChatStore::store_blob(conn, hash, raw, size);
+
+		lite3::statement update(conn, "update messages set raw=null,hash=?,size=? where id=?;");
+
+		update.bind(1, hash);
+		update.bind(2, (std::int64_t)size);
+		update.bind(3, id);
+		update.execute();
+	}
+
+	if(ids.size() > 0)
+		log("moved " + std::to_string(ids.size()) + " files into the blob store");
+}
+
+// version 1 images had no thumbnail, let the small ones be their own
+void ChatStore::migrate_thumbnails(){
+	conn.execute("alter table messages add column thumb text;");
+
+	const std::string update =
+	"update messages set thumb=hash where type=" + std::to_string((int)MessageType::IMAGE) + " and size<=" + std::to_string(MAX_THUMBNAIL_BYTES) + ";";
+	conn.execute(update);
+
+	// each thumbnail is a reference of its own
+	const std::string refs =
+	"update store.blobs set refs=refs+(select count(*) from messages where messages.thumb=store.blobs.hash)\n"
+	"where hash in (select thumb from messages);";
+	conn.execute(refs);
+}
+
+// version 2 couldn't be searched, index everything that's already there
+void ChatStore::migrate_search(){
+	SqliteStore::create_search(conn);
+	conn.execute("insert into search (search) values ('rebuild');");
+}
+
+// remember a message that was just inserted into the chat
+void ChatStore::remember(Message &&msg){
+	// message ids in a chat are handed out in order with no gaps,
+	// so the first message remembered covers everything after the one before it
+	if(!warm){
+		warm = true;
+		floor = msg.id - 1;
+	}
+
+	recent_bytes += msg.raw_size;
+	recent.push_back(std::move(msg));
+
+	// forget the oldest ones
+	while(recent.size() > HOT_MESSAGE_COUNT || (recent_bytes > HOT_MESSAGE_BYTES && recent.size() > 1)){
+		floor = recent.front().id;
+		recent_bytes -= recent.front().raw_size;
+		recent.pop_front();
+	}
+}
+
+// forget any messages that were deleted, everything up to and including <id>
+void ChatStore::forget(unsigned long long id){
+	while(recent.size() > 0 && recent.front().id <= id){
+		recent_bytes -= recent.front().raw_size;
+		recent.pop_front();
+	}
+}
+
+// true if <recent> holds every message with an id greater than <since>
+bool ChatStore::covers(unsigned long long since)const{
+	return warm && since >= floor;
+}
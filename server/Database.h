@@ -3,47 +3,153 @@
 
 #include <string>
 #include <mutex>
+#include <condition_variable>
 #include <exception>
 #include <vector>
 #include <functional>
 #include <unordered_map>
+#include <unordered_set>
+#include <list>
+#include <deque>
+#include <atomic>
+#include <memory>
 
 #define SERVER_NAME_LENGTH 25 // characters
 
+// limits on the recent messages kept in memory for each open chat
+#define HOT_MESSAGE_COUNT 256
+#define HOT_MESSAGE_BYTES (16*1024*1024)
+
+// how hard maintenance may lean on a chat database, so it never holds up new messages for long
+#define MAINTENANCE_BATCH 500 // messages deleted per transaction
+#define MAINTENANCE_PAUSE_MS 20 // rest between batches and vacuum steps
+#define VACUUM_STEP_PAGES 256 // pages freed per incremental vacuum step
+#define COMPACT_FREE_RATIO 4 // databases without incremental vacuum are compacted once 1/N of their pages are free
+#define WAL_SIZE_LIMIT (4*1024*1024) // wal files are cut back to this after a checkpoint
+
+// version of the messages table schema, kept in "pragma user_version" of each chat database
+// 1: raw content moved to the shared blob store, rows refer to it by hash and size
+// 2: images refer to a thumbnail in the blob store
+// 3: full text index of the messages, in the "search" table
+#define CHAT_SCHEMA_VERSION 3
+
+// chats with Engine::LOG keep their segments in a directory named for the chat database with this on the end
+#define CHAT_LOG_SUFFIX ".log"
+
 class Database;
 
+// what a maintenance pass got rid of
+struct Reclaimed{
+	Reclaimed():messages(0),blobs(0),bytes(0){}
+	Reclaimed &operator+=(const Reclaimed &other){
+		messages+=other.messages;
+		blobs+=other.blobs;
+		bytes+=other.bytes;
+		return *this;
+	}
+
+	unsigned long long messages;
+	unsigned long long blobs;
+	unsigned long long bytes; // shrinkage of the database files
+};
+
 #include "lite3.hpp"
+#include "ReadPool.h"
+#include "MessageStore.h"
 #include "../chat.h"
 
+// an open chat database, along with its most recent messages
+// shared between the client threads, writes go through <conn>, reads through <readers>
+// the shared blob store is attached to every connection as "store"
+// <messages> is where the messages themselves are, in the database or in a log beside it
+struct ChatStore{
+	ChatStore(const std::string&, const std::string&, lite3::connection&&, bool = false);
+	ChatStore(const ChatStore&)=delete;
+	void operator=(const ChatStore&)=delete;
+
+	void remember(Message&&);
+	void forget(unsigned long long);
+	bool covers(unsigned long long)const;
+
+	static void attach(lite3::connection&, const std::string&);
+	static void store_blob(lite3::connection&, const std::string&, const unsigned char*, unsigned long long);
+	static bool release_blob(lite3::connection&, const std::string&);
+	static void limit_wal(lite3::connection&, const std::string&);
+	static unsigned long long size(lite3::connection&);
+	void migrate();
+	void migrate_inline();
+	void migrate_thumbnails();
+	void migrate_search();
+
+	std::mutex write_lock; // guards <conn> and everything below it
+	lite3::connection conn;
+	std::unique_ptr<MessageStore> messages;
+	bool written; // a message went in since the last maintenance pass
+	std::deque<Message> recent; // the most recent messages in the chat, oldest first
+	bool warm; // <recent> has been filled since the database was opened
+	unsigned long long floor; // <recent> holds every message with an id greater than this
+	unsigned long long recent_bytes; // size of the raw components in <recent> (thumbnails, for images)
+	ReadPool readers;
+};
+
 class Database{
 public:
-	explicit Database(const std::string&);
+	Database(const std::string&,unsigned,Engine = Engine::SQLITE);
 	Database(const Database&)=delete;
 
 	Database &operator=(const Database&)=delete;
 
 	const std::string &get_name();
 	const std::vector<Chat> &get_chats();
-	void new_chat(const Chat&);
-	unsigned long long new_msg(const Chat&,const Message&);
+	unsigned long long get_version();
+	Chat new_chat(const Chat&);
+	unsigned long long new_msg(const Chat&,const Message&,const std::vector<unsigned char>&);
 	std::vector<Message> get_messages_since(unsigned long long, int);
-	std::vector<unsigned char> get_file(unsigned long long, int);
+	std::vector<Message> get_messages_range(unsigned long long, unsigned long long, int, unsigned);
+	std::vector<unsigned char> get_file(unsigned long long, int, std::string&);
+	std::vector<Message> search(int,const std::string&,unsigned long long,unsigned);
+	Retention get_retention(int,const Retention&);
+	Reclaimed maintain(int,const Retention&,const std::atomic<bool>&);
+	Reclaimed maintain_blobs(const std::atomic<bool>&);
+	unsigned long long cache_hits()const;
+	unsigned long long cache_misses()const;
 
 private:
 	void initialize();
-	lite3::connection &get(int);
-	void save();
+	void import_directory(const std::string&);
+	std::shared_ptr<ChatStore> get(int,bool = true);
+	std::shared_ptr<ChatStore> peek(int);
+	std::vector<std::pair<int, std::shared_ptr<ChatStore>>> cache(int,const std::shared_ptr<ChatStore>&,bool = true);
+	void close(std::vector<std::pair<int, std::shared_ptr<ChatStore>>>&);
+	bool due(int,const Retention&);
+	void schedule(int,const Retention&,long long);
+	void mark_written(int);
+	unsigned long long delete_through(ChatStore&,unsigned long long,Reclaimed&);
+	void vacuum(lite3::connection&,std::mutex&,const std::atomic<bool>&,bool);
+	static void pause();
 
 	static bool exists(const std::string&);
 	static std::string gen_name();
-	static std::string serialize(const Chat&);
 	static Chat deserialize(const std::string&);
 	static int highest_id(const std::vector<Chat>&);
 
 	std::string unique_name;
 	std::vector<Chat> list;
-	std::unordered_map<int, lite3::connection> dbs;
-	const std::string &db_path;
+	std::mutex catalog_lock; // guards <catalog>
+	lite3::connection catalog; // the chat directory, the retention policies, and when they're next due
+	std::mutex blobs_lock; // guards <blobs>
+	lite3::connection blobs; // file and image content of every chat, keyed by sha-256
+	std::string blob_path;
+	std::mutex open_lock; // guards <open>, <dbs> and <busy>
+	std::list<std::pair<int, std::shared_ptr<ChatStore>>> open; // open chat databases, most recently used first
+	std::unordered_map<int, std::list<std::pair<int, std::shared_ptr<ChatStore>>>::iterator> dbs; // index into <open>
+	std::unordered_set<int> busy; // chats being opened or closed without holding <open_lock>
+	std::condition_variable unbusy; // a chat is out of <busy>
+	const unsigned open_limit; // how many chat databases may be open at once
+	const Engine engine; // where new chats keep their messages
+	std::atomic<unsigned long long> hits; // backlog requests served from ChatStore::recent
+	std::atomic<unsigned long long> misses; // backlog requests that had to go to sqlite
+	const std::string db_path;
 };
 
 #endif // DATABASE_H
@@ -0,0 +1,74 @@
+#ifndef MESSAGESTORE_H
+#define MESSAGESTORE_H
+
+#include <string>
+#include <vector>
+
+#include "lite3.hpp"
+#include "../chat.h"
+
+// how a chat keeps its messages, chosen when the chat is created
+enum class Engine{
+	SQLITE, // rows in the chat database (see SqliteStore)
+	LOG // records appended to segment files beside the chat database, which keeps the search index (see SegmentLog)
+};
+
+// how much history a chat keeps, 0 means no limit
+struct Retention{
+	Retention():max_age(0),max_count(0),max_bytes(0){}
+
+	unsigned long long max_age; // seconds
+	unsigned long long max_count; // messages
+	unsigned long long max_bytes; // file and image content
+};
+
+// everything about a message except its content, which lives in the blob store
+struct Record{
+	unsigned long long id;
+	MessageType type;
+	int unixtime;
+	std::string message;
+	std::string name;
+	std::string hash; // key into the blob store, empty for normal messages
+	unsigned long long size; // size of the content behind <hash>
+	std::string thumb; // key into the blob store for the thumbnail of an image, empty if there isn't one
+};
+
+// the messages of one chat
+// writes come with ChatStore::write_lock held, on the writer connection with a transaction open,
+// prepare() comes just before the transaction commits, and stops it by throwing,
+// then commit() or rollback() once the transaction is over
+// reads come on a connection from ChatStore::readers, from any number of threads
+// both kinds of connection have the blob store attached as "store"
+class MessageStore{
+public:
+	virtual ~MessageStore(){}
+
+	// add <record> and index it for search, returns the id it was given
+	virtual unsigned long long insert(lite3::connection&,const Record&)=0;
+	// take up to <limit> of the oldest messages, none newer than <cutoff>, out of the chat and its index
+	// returns what was taken, so the caller can let go of their blobs
+	virtual std::vector<Record> remove(lite3::connection&,unsigned long long,unsigned)=0;
+	virtual void prepare(){}
+	virtual void commit(){}
+	virtual void rollback(){}
+
+	// messages with an id greater than <after>, up to and including <through>, no more than <limit> of them, oldest first
+	// images come with their thumbnail
+	virtual std::vector<Message> range(lite3::connection&,unsigned long long,unsigned long long,unsigned)=0;
+	// content of the file or image in message <id>, and its key in the blob store (its sha-256)
+	virtual std::vector<unsigned char> file(lite3::connection&,unsigned long long,std::string&)=0;
+	// full text search for <query>, best matches first, see Database::search
+	virtual std::vector<Message> search(lite3::connection&,const std::string&,unsigned long long,unsigned)=0;
+	// the id of the newest message that <policy> says has to go, 0 if none
+	virtual unsigned long long cutoff(lite3::connection&,const Retention&)=0;
+	// unixtime at which cutoff() will next find something too old under <max_age>, if nothing is written meanwhile
+	// 0 if only something new being written can make it find anything
+	virtual long long expires(lite3::connection&,unsigned long long)=0;
+	// bytes kept outside the chat database
+	virtual unsigned long long size(){ return 0; }
+	// get anything kept outside the chat database on to the disk
+	virtual void sync(){}
+};
+
+#endif // MESSAGESTORE_H
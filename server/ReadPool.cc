@@ -0,0 +1,57 @@
+#include "ReadPool.h"
+
+ReadPool::ReadPool(const std::string &p, std::function<void(lite3::connection&)> fn)
+	: path(p)
+	, setup(fn)
+{}
+
+// get a read only connection, opening a new one if they are all in use
+ReadPool::lease ReadPool::borrow(){
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		if(idle.size() > 0){
+			lite3::connection conn = std::move(idle.back());
+			idle.pop_back();
+
+			return {*this, std::move(conn)};
+		}
+	}
+
+	lite3::connection conn(path, SQLITE_OPEN_READONLY);
+	conn.busy_timeout(5000);
+
+	if(setup)
+		setup(conn);
+
+	return {*this, std::move(conn)};
+}
+
+// keep a few connections around for next time
+void ReadPool::give_back(lite3::connection &&conn){
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if(idle.size() < READ_POOL_IDLE)
+		idle.push_back(std::move(conn));
+}
+
+ReadPool::lease::lease(ReadPool &p, lite3::connection &&c)
+	: pool(&p)
+	, conn(std::move(c))
+{}
+
+ReadPool::lease::lease(lease &&other)
+	: pool(other.pool)
+	, conn(std::move(other.conn))
+{
+	other.pool = NULL;
+}
+
+ReadPool::lease::~lease(){
+	if(pool != NULL)
+		pool->give_back(std::move(conn));
+}
+
+lite3::connection &ReadPool::lease::operator*(){
+	return conn;
+}
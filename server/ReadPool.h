@@ -0,0 +1,48 @@
+#ifndef READPOOL_H
+#define READPOOL_H
+
+#include <string>
+#include <mutex>
+#include <vector>
+#include <functional>
+
+#include "lite3.hpp"
+
+// how many idle read only connections a pool holds on to
+#define READ_POOL_IDLE 2
+
+// read only connections to one sqlite database
+// every reading thread gets a connection of its own, so reads don't wait on each other or on the writer
+class ReadPool{
+public:
+	// a connection borrowed from the pool, given back on destruction
+	class lease{
+	public:
+		lease(ReadPool&, lite3::connection&&);
+		lease(const lease&)=delete;
+		lease(lease&&);
+		~lease();
+		void operator=(const lease&)=delete;
+		lite3::connection &operator*();
+
+	private:
+		ReadPool *pool;
+		lite3::connection conn;
+	};
+
+	// <setup> is run on every new connection before it is handed out
+	ReadPool(const std::string&, std::function<void(lite3::connection&)> = nullptr);
+	ReadPool(const ReadPool&)=delete;
+	void operator=(const ReadPool&)=delete;
+	lease borrow();
+
+private:
+	void give_back(lite3::connection&&);
+
+	const std::string path;
+	const std::function<void(lite3::connection&)> setup;
+	std::mutex mutex; // guards <idle>
+	std::vector<lite3::connection> idle;
+};
+
+#endif // READPOOL_H
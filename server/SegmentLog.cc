@@ -0,0 +1,763 @@
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+
+#include <time.h>
+
+#include "SegmentLog.h"
+#include "log.h"
+
+#define LOG_INDEX_MAGIC 0x31584449 // "IDX1"
+#define LOG_RECORD_LIMIT (1u << 30) // anything claiming to be bigger than this is damage
+
+// records and index files are in the byte order of the machine that wrote them
+
+template<typename T> static void put(std::string &out, T value){
+	out.append((const char*)&value, sizeof(value));
+}
+
+static void put_string(std::string &out, const std::string &str){
+	put<std::uint32_t>(out, str.size());
+	out += str;
+}
+
+// fnv-1a, enough to tell a record that was only partly written
+static std::uint32_t checksum(const char *data, size_t size){
+	std::uint32_t hash = 2166136261u;
+	for(size_t i = 0; i < size; ++i){
+		hash ^= (unsigned char)data[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+// reads values back out of what put() wrote, <good> is cleared if it runs off the end
+class Cursor{
+public:
+	Cursor(const char *d, size_t size)
+		: good(true)
+		, data(d)
+		, end(d + size)
+	{}
+
+	template<typename T> T get(){
+		T value = T();
+		if(end - data < (long)sizeof(T)){
+			good = false;
+			return value;
+		}
+
+		memcpy(&value, data, sizeof(T));
+		data += sizeof(T);
+		return value;
+	}
+
+	std::string get_string(){
+		const std::uint32_t size = get<std::uint32_t>();
+		if(!good || (size_t)(end - data) < size){
+			good = false;
+			return "";
+		}
+
+		std::string str(data, size);
+		data += size;
+		return str;
+	}
+
+	bool done()const{
+		return good && data == end;
+	}
+
+	bool good;
+
+private:
+	const char *data;
+	const char *const end;
+};
+
+// a record is its length, a checksum, then the body
+static void encode(const Record &record, std::string &out){
+	std::string body;
+	put<std::uint64_t>(body, record.id);
+	put<std::uint64_t>(body, record.size);
+	put<std::int64_t>(body, record.unixtime);
+	put<std::uint8_t>(body, (std::uint8_t)record.type);
+	put_string(body, record.message);
+	put_string(body, record.name);
+	put_string(body, record.hash);
+	put_string(body, record.thumb);
+
+	put<std::uint32_t>(out, body.size());
+	put<std::uint32_t>(out, checksum(body.data(), body.size()));
+	out += body;
+}
+
+static bool decode(const char *body, size_t size, Record &record){
+	Cursor cursor(body, size);
+	record.id = cursor.get<std::uint64_t>();
+	record.size = cursor.get<std::uint64_t>();
+	record.unixtime = cursor.get<std::int64_t>();
+	record.type = (MessageType)cursor.get<std::uint8_t>();
+	record.message = cursor.get_string();
+	record.name = cursor.get_string();
+	record.hash = cursor.get_string();
+	record.thumb = cursor.get_string();
+
+	return cursor.done();
+}
+
+// open the log in directory <d>, belonging to the chat database on <conn>
+// the last segment is checked record by record, along with any other that lost its index, and cut back to the last whole record
+SegmentLog::SegmentLog(const std::string &d, lite3::connection &conn)
+	: dir(d)
+	, trimmed(0)
+	, pending_trim(0)
+	, appended(false)
+	, dirty(false)
+	, synced(std::chrono::steady_clock::now())
+{
+	std::vector<unsigned long long> firsts;
+	for(const std::string &name : os::list(dir)){
+		// everything else is an index, or a leftover
+		if(name.size() > 4 && name.compare(name.size() - 4, 4, ".seg") == 0)
+			firsts.push_back(std::stoull(name));
+	}
+
+	std::sort(firsts.begin(), firsts.end());
+	if(firsts.size() == 0)
+		firsts.push_back(1);
+
+	for(size_t i = 0; i < firsts.size(); ++i)
+		open(firsts[i], i + 1 == firsts.size());
+
+	{
+		lite3::statement statement(conn, "select through from trimmed;");
+		if(statement.execute())
+			trimmed = statement.long_integer(0);
+	}
+
+	// whatever was indexed past the end of the log never made it to disk
+	// its blobs keep a reference nothing will let go of, which only costs space
+	lite3::statement orphans(conn, "delete from search where rowid>?;");
+	orphans.bind(1, (std::int64_t)segments.rbegin()->second.last);
+	orphans.execute();
+
+	if(conn.changes() > 0)
+		log("dropped " + std::to_string(conn.changes()) + " messages from the index of " + dir + " that never made it to the log");
+
+	// the other way around, the last record went out but its transaction never committed
+	// its blobs were never referenced, so it can't stay
+	Segment &tail = segments.rbegin()->second;
+	if(tail.last >= tail.first){
+		lite3::statement indexed(conn, "select 1 from search where rowid=?;");
+		indexed.bind(1, (std::int64_t)tail.last);
+
+		if(!indexed.execute()){
+			const unsigned long long last = tail.last;
+			tail.last = tail.first - 1;
+			tail.length = 0;
+			tail.bytes = 0;
+			tail.newest = 0;
+			tail.index.clear();
+			recover(tail, last - 1);
+
+			log("cut message " + std::to_string(last) + " off the log of " + dir + ", it never made it to the index");
+		}
+	}
+}
+
+SegmentLog::~SegmentLog(){
+	try{
+		if(dirty)
+			active.sync();
+	}catch(const std::exception &e){
+		log_error(e.what());
+	}
+}
+
+// set up a brand new log in directory <dir>, and the tables it needs in the chat database on <conn>
+void SegmentLog::create(lite3::connection &conn, const std::string &dir){
+	os::mkdir(dir);
+
+	// the log can't be joined against, so the index keeps its own copy of what search results need
+	const std::string create_search =
+	"create virtual table search using fts5(message,name,type unindexed,unixtime unindexed);";
+	conn.execute(create_search);
+
+	// how far retention has gotten (see SegmentLog::remove)
+	conn.execute("create table trimmed (through int not null);");
+	conn.execute("insert into trimmed (through) values (0);");
+}
+
+unsigned long long SegmentLog::insert(lite3::connection &conn, const Record &record){
+	pending_record = record;
+	pending_record.id = segments.rbegin()->second.last + 1;
+
+	const std::string index =
+	"insert into search (rowid,message,name,type,unixtime) values\n"
+	"(?,?,?,?,?);";
+	lite3::statement search(conn, index);
+
+	search.bind(1, (std::int64_t)pending_record.id);
+	search.bind(2, record.message);
+	search.bind(3, record.name);
+	search.bind(4, (int)record.type);
+	search.bind(5, record.unixtime);
+	search.execute();
+
+	pending.clear();
+	encode(pending_record, pending);
+
+	return pending_record.id;
+}
+
+// records are never taken out of the middle of a segment, the whole file goes once every record in it is past <cutoff>
+// until then they are taken out of the index and let go of their blobs <limit> at a time, <trimmed> keeps track
+// the segment being appended to always stays
+std::vector<Record> SegmentLog::remove(lite3::connection &conn, unsigned long long cutoff, unsigned limit){
+	std::vector<Record> taken;
+
+	for(auto it = segments.begin(); std::next(it) != segments.end() && taken.size() == 0; ++it){
+		const Segment &segment = it->second;
+		if(segment.last > cutoff)
+			break;
+
+		if(trimmed < segment.last){
+			View view{os::file(path(segment.first, ".seg"), false), 0, segment.length};
+			for(auto entry = segment.index.rbegin(); entry != segment.index.rend(); ++entry){
+				if(entry->first <= trimmed + 1){
+					view.offset = entry->second;
+					break;
+				}
+			}
+
+			SegmentLog::scan(view, [&](Record &record, unsigned long long, unsigned long long){
+				if(record.id > trimmed)
+					taken.push_back(record);
+
+				return taken.size() < limit;
+			});
+		}
+
+		if(taken.size() == 0 || taken.back().id == segment.last)
+			doomed.push_back(segment.first);
+	}
+
+	if(taken.size() > 0){
+		lite3::statement unindex(conn, "delete from search where rowid>? and rowid<=?;");
+		unindex.bind(1, (std::int64_t)trimmed);
+		unindex.bind(2, (std::int64_t)taken.back().id);
+		unindex.execute();
+
+		lite3::statement progress(conn, "update trimmed set through=?;");
+		progress.bind(1, (std::int64_t)taken.back().id);
+		progress.execute();
+
+		pending_trim = taken.back().id;
+	}
+
+	return taken;
+}
+
+// the transaction is about to commit, write the record that goes with it
+// readers don't see it until commit(), they stop at the end of the segment as they know it
+void SegmentLog::prepare(){
+	if(pending.size() == 0)
+		return;
+
+	try{
+		active.append(pending.data(), pending.size());
+	}catch(const std::exception &e){
+		// don't leave half a record for the next one to land behind
+		active.truncate(segments.rbegin()->second.length);
+		throw;
+	}
+
+	appended = true;
+}
+
+// the transaction went through, let readers at the record that goes with it and delete what's been trimmed
+void SegmentLog::commit(){
+	if(appended){
+		Segment &segment = segments.rbegin()->second;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			if((pending_record.id - segment.first) % LOG_INDEX_INTERVAL == 0)
+				segment.index.push_back({pending_record.id, segment.length});
+
+			segment.last = pending_record.id;
+			segment.length += pending.size();
+			segment.bytes += pending_record.size;
+			segment.newest = pending_record.unixtime;
+		}
+
+		pending.clear();
+		appended = false;
+		dirty = true;
+
+		// the message is in either way, these are tried again with the next one
+		try{
+			if(segment.length >= LOG_SEGMENT_BYTES)
+				seal();
+			else if(std::chrono::steady_clock::now() - synced >= std::chrono::milliseconds(LOG_SYNC_MS))
+				sync();
+		}catch(const std::exception &e){
+			log_error(e.what());
+		}
+	}
+
+	if(pending_trim > 0){
+		std::lock_guard<std::mutex> lock(mutex);
+		trimmed = pending_trim;
+		pending_trim = 0;
+	}
+
+	for(const unsigned long long first : doomed){
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			segments.erase(first);
+		}
+
+		os::remove(path(first, ".seg"));
+		std::remove(path(first, ".idx").c_str());
+	}
+	doomed.clear();
+}
+
+void SegmentLog::rollback(){
+	if(appended){
+		appended = false;
+		active.truncate(segments.rbegin()->second.length);
+	}
+
+	pending.clear();
+	pending_trim = 0;
+	doomed.clear();
+}
+
+std::vector<Message> SegmentLog::range(lite3::connection &conn, unsigned long long after, unsigned long long through, unsigned limit){
+	std::vector<View> views = this->views(after);
+
+	std::vector<Message> messages;
+	std::vector<std::pair<size_t, std::string>> thumbs; // index into <messages>, hash
+	for(View &view : views){
+		SegmentLog::scan(view, [&](Record &record, unsigned long long, unsigned long long){
+			if(record.id > through || messages.size() >= limit)
+				return false;
+
+			if(record.id > after){
+				if(record.type == MessageType::IMAGE && record.thumb != "")
+					thumbs.push_back({messages.size(), record.thumb});
+
+				messages.emplace_back();
+
+				Message &msg = messages.back();
+				msg.id = record.id;
+				msg.type = record.type;
+				msg.unixtime = record.unixtime;
+				msg.msg = std::move(record.message);
+				msg.sender = std::move(record.name);
+			}
+
+			return true;
+		});
+
+		if(messages.size() >= limit || (messages.size() > 0 && messages.back().id >= through))
+			break;
+	}
+
+	// only images come with a blob, and that's their thumbnail
+	if(thumbs.size() > 0){
+		lite3::statement statement(conn, "select data from store.blobs where hash=?;");
+
+		for(const auto &thumb : thumbs){
+			statement.reset();
+			statement.bind(1, thumb.second);
+
+			if(statement.execute()){
+				Message &msg = messages[thumb.first];
+
+				msg.raw_size = statement.blob_size(0);
+				msg.raw = new unsigned char[msg.raw_size];
+				memcpy(msg.raw, statement.blob(0), msg.raw_size);
+			}
+		}
+	}
+
+	return messages;
+}
+
+std::vector<unsigned char> SegmentLog::file(lite3::connection &conn, unsigned long long id, std::string &hash){
+	unsigned long long since = id - 1;
+	std::vector<View> views = this->views(since, true);
+
+	bool found = false;
+	for(View &view : views){
+		SegmentLog::scan(view, [&](Record &record, unsigned long long, unsigned long long){
+			if(record.id == id){
+				found = true;
+				hash = record.hash;
+			}
+
+			return record.id < id;
+		});
+	}
+
+	if(!found)
+		throw std::runtime_error("no record for message id " + std::to_string(id));
+
+	// every chat it was posted in shares the one copy in the blob store
+	lite3::statement statement(conn, "select data from store.blobs where hash=?;");
+	statement.bind(1, hash);
+
+	if(hash == "" || !statement.execute())
+		throw std::runtime_error("raw blob for file id " + std::to_string(id));
+
+	std::vector<unsigned char> raw(statement.blob_size(0));
+	memcpy(raw.data(), statement.blob(0), raw.size());
+
+	return raw;
+}
+
+std::vector<Message> SegmentLog::search(lite3::connection &conn, const std::string &query, unsigned long long offset, unsigned count){
+	const std::string select =
+	"select rowid,type,unixtime,snippet(search,0,'[',']','...',16),name from search\n"
+	"where search match ? order by rank limit ? offset ?;";
+	lite3::statement statement(conn, select);
+
+	statement.bind(1, query);
+	statement.bind(2, (std::int64_t)count);
+	statement.bind(3, (std::int64_t)offset);
+
+	std::vector<Message> results;
+	while(statement.execute()){
+		results.push_back({
+			(decltype(Message::id))statement.long_integer(0),
+			(MessageType)statement.integer(1),
+			statement.integer(2),
+			statement.str(3),
+			statement.str(4),
+			NULL,
+			0
+		});
+	}
+
+	return results;
+}
+
+// worked out a segment at a time from what's kept in memory, remove() only takes whole segments anyway
+unsigned long long SegmentLog::cutoff(lite3::connection&, const Retention &policy){
+	std::lock_guard<std::mutex> lock(mutex);
+
+	unsigned long long cutoff = 0;
+	const unsigned long long last = segments.rbegin()->second.last;
+
+	// too old, sealed segments only, the last one is never empty
+	if(policy.max_age > 0){
+		const long long oldest = time(NULL) - policy.max_age;
+
+		for(auto it = segments.begin(); std::next(it) != segments.end() && it->second.newest < oldest; ++it)
+			cutoff = std::max(cutoff, it->second.last);
+	}
+
+	// too many
+	if(policy.max_count > 0 && last > policy.max_count)
+		cutoff = std::max(cutoff, last - policy.max_count);
+
+	// too big, counting from the newest segment back
+	if(policy.max_bytes > 0){
+		unsigned long long total = 0;
+		for(auto it = segments.rbegin(); it != segments.rend(); ++it){
+			total += it->second.bytes;
+
+			if(total > policy.max_bytes){
+				cutoff = std::max(cutoff, it->second.first - 1);
+				break;
+			}
+		}
+	}
+
+	return cutoff;
+}
+
+// the oldest sealed segment goes once its newest record is too old, the one being appended to never goes by age
+long long SegmentLog::expires(lite3::connection&, unsigned long long max_age){
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if(segments.size() < 2)
+		return 0;
+
+	return segments.begin()->second.newest + max_age + 1;
+}
+
+unsigned long long SegmentLog::size(){
+	std::lock_guard<std::mutex> lock(mutex);
+
+	unsigned long long total = 0;
+	for(const auto &segment : segments)
+		total += segment.second.length;
+
+	return total;
+}
+
+// get whatever has been appended so far on to the disk
+void SegmentLog::sync(){
+	if(dirty)
+		active.sync();
+
+	dirty = false;
+	synced = std::chrono::steady_clock::now();
+}
+
+// path of a file belonging to segment <first>
+std::string SegmentLog::path(unsigned long long first, const char *extension)const{
+	char name[32];
+	snprintf(name, sizeof(name), "%020llu", first);
+
+	return dir + "/" + name + extension;
+}
+
+// load segment <first>, along with its index, and make it the one being appended to if <last> is set
+void SegmentLog::open(unsigned long long first, bool last){
+	Segment segment;
+	segment.first = first;
+	segment.last = first - 1;
+	segment.length = 0;
+	segment.bytes = 0;
+	segment.newest = 0;
+
+	if(last || !read_index(segment)){
+		recover(segment);
+
+		if(!last)
+			write_index(segment);
+	}
+
+	if(last)
+		active = os::file(path(first, ".seg"));
+
+	segments.emplace(first, std::move(segment));
+}
+
+// read <segment> from the start, filling in everything about it
+// anything after the last whole record, records out of order, or any past <through>, are cut off
+// returns how many bytes were cut
+unsigned long long SegmentLog::recover(Segment &segment, unsigned long long through){
+	const std::string file = path(segment.first, ".seg");
+
+	View view{os::file(file), 0, 0};
+	const unsigned long long length = view.file.size();
+	view.end = length;
+
+	bool wanted = false; // stopped at a good record past <through>, the caller says why
+	segment.length = SegmentLog::scan(view, [&](Record &record, unsigned long long offset, unsigned long long){
+		if(record.id != segment.last + 1)
+			return false;
+		if(record.id > through){
+			wanted = true;
+			return false;
+		}
+
+		if((record.id - segment.first) % LOG_INDEX_INTERVAL == 0)
+			segment.index.push_back({record.id, offset});
+
+		segment.last = record.id;
+		segment.bytes += record.size;
+		segment.newest = record.unixtime;
+		return true;
+	});
+
+	if(segment.length < length){
+		view.file.truncate(segment.length);
+
+		if(!wanted)
+			log("cut " + std::to_string(length - segment.length) + " bytes of damaged records off the end of " + file);
+	}
+
+	return length - segment.length;
+}
+
+// the last segment is full, start a new one
+// what's in it so far is synced, and its index written out, so it never has to be read through again
+void SegmentLog::seal(){
+	Segment &full = segments.rbegin()->second;
+
+	active.sync();
+	write_index(full);
+
+	Segment next;
+	next.first = full.last + 1;
+	next.last = full.last;
+	next.length = 0;
+	next.bytes = 0;
+	next.newest = 0;
+
+	os::file file(path(next.first, ".seg"));
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		segments.emplace(next.first, std::move(next));
+	}
+
+	active = std::move(file);
+	dirty = false;
+	synced = std::chrono::steady_clock::now();
+}
+
+// keep what's known about sealed <segment> beside it, written to a temporary file first so it's never seen half done
+void SegmentLog::write_index(const Segment &segment){
+	std::string data;
+	put<std::uint32_t>(data, LOG_INDEX_MAGIC);
+	put<std::uint64_t>(data, segment.first);
+	put<std::uint64_t>(data, segment.last);
+	put<std::uint64_t>(data, segment.length);
+	put<std::uint64_t>(data, segment.bytes);
+	put<std::int64_t>(data, segment.newest);
+	put<std::uint64_t>(data, segment.index.size());
+	for(const auto &entry : segment.index){
+		put<std::uint64_t>(data, entry.first);
+		put<std::uint64_t>(data, entry.second);
+	}
+
+	const std::string temp = path(segment.first, ".idx.tmp");
+	const std::string final = path(segment.first, ".idx");
+
+	std::remove(temp.c_str());
+	{
+		os::file file(temp);
+		file.append(data.data(), data.size());
+		file.sync();
+	}
+
+	std::remove(final.c_str());
+	if(std::rename(temp.c_str(), final.c_str()))
+		throw std::runtime_error("could not rename " + temp + " to " + final);
+}
+
+// fill in <segment> from the index beside it, false if it's missing or doesn't match the segment
+bool SegmentLog::read_index(Segment &segment){
+	std::ifstream in(path(segment.first, ".idx"), std::ios::binary);
+	if(!in)
+		return false;
+
+	const std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	Cursor cursor(data.data(), data.size());
+
+	if(cursor.get<std::uint32_t>() != LOG_INDEX_MAGIC || cursor.get<std::uint64_t>() != segment.first)
+		return false;
+
+	Segment loaded;
+	loaded.first = segment.first;
+	loaded.last = cursor.get<std::uint64_t>();
+	loaded.length = cursor.get<std::uint64_t>();
+	loaded.bytes = cursor.get<std::uint64_t>();
+	loaded.newest = cursor.get<std::int64_t>();
+
+	const unsigned long long entries = cursor.get<std::uint64_t>();
+	for(unsigned long long i = 0; i < entries && cursor.good; ++i){
+		const unsigned long long id = cursor.get<std::uint64_t>();
+		const unsigned long long offset = cursor.get<std::uint64_t>();
+		loaded.index.push_back({id, offset});
+	}
+
+	if(!cursor.done() || os::file(path(segment.first, ".seg"), false).size() != loaded.length)
+		return false;
+
+	segment = std::move(loaded);
+	return true;
+}
+
+// the segments with records after <since>, the first one starting from the nearest index entry
+// <since> is moved up past anything retention has already trimmed
+// if <one> is set, only the segment holding the record right after <since>
+std::vector<SegmentLog::View> SegmentLog::views(unsigned long long &since, bool one){
+	std::lock_guard<std::mutex> lock(mutex);
+
+	since = std::max(since, trimmed);
+
+	auto it = segments.upper_bound(since + 1);
+	if(it != segments.begin())
+		--it;
+
+	std::vector<View> views;
+	for(; it != segments.end(); ++it){
+		const Segment &segment = it->second;
+		if(segment.last <= since)
+			continue;
+
+		unsigned long long offset = 0;
+		auto entry = std::upper_bound(segment.index.begin(), segment.index.end(), since + 1, [](unsigned long long id, const std::pair<unsigned long long, unsigned long long> &indexed){
+			return id < indexed.first;
+		});
+		if(entry != segment.index.begin())
+			offset = std::prev(entry)->second;
+
+		// read only, one that's gone stays gone instead of coming back empty
+		views.push_back({os::file(path(segment.first, ".seg"), false), offset, segment.length});
+
+		if(one)
+			break;
+	}
+
+	return views;
+}
+
+// call <fn> with each record in <view> in order, along with its offset and size in the file, until it returns false
+// <fn> may move things out of the record
+// stops early at a record that's cut short or damaged
+// returns the offset just past the last record <fn> accepted
+unsigned long long SegmentLog::scan(View &view, const std::function<bool(Record&, unsigned long long, unsigned long long)> &fn){
+	std::vector<char> buffer(LOG_READ_BYTES);
+	unsigned long long base = view.offset; // offset in the file of the start of <buffer>
+	size_t have = 0; // bytes in <buffer>
+	size_t at = 0; // start of the next record in <buffer>
+
+	// get <n> bytes starting at <at> into the buffer, false if the view ends first
+	const auto fill = [&](size_t n){
+		if(have - at >= n)
+			return true;
+		if(base + at + n > view.end)
+			return false;
+
+		memmove(buffer.data(), buffer.data() + at, have - at);
+		base += at;
+		have -= at;
+		at = 0;
+
+		if(buffer.size() < n)
+			buffer.resize(n);
+
+		const unsigned long long want = std::min<unsigned long long>(buffer.size() - have, view.end - (base + have));
+		have += view.file.read(buffer.data() + have, want, base + have);
+
+		return have >= n;
+	};
+
+	Record record;
+	while(fill(8)){
+		std::uint32_t length, sum;
+		memcpy(&length, buffer.data() + at, 4);
+		memcpy(&sum, buffer.data() + at + 4, 4);
+
+		if(length > LOG_RECORD_LIMIT || !fill(8 + length))
+			break;
+
+		const char *const body = buffer.data() + at + 8;
+		if(checksum(body, length) != sum || !decode(body, length, record))
+			break;
+
+		if(!fn(record, base + at, 8 + length))
+			break;
+
+		at += 8 + length;
+	}
+
+	return base + at;
+}
@@ -0,0 +1,89 @@
+#ifndef SEGMENTLOG_H
+#define SEGMENTLOG_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include <climits>
+
+#include "MessageStore.h"
+#include "os.h"
+
+#define LOG_SEGMENT_BYTES (8*1024*1024) // a segment is sealed and a new one started once it grows past this
+#define LOG_INDEX_INTERVAL 64 // records between entries in the sparse index of a segment
+#define LOG_SYNC_MS 1000 // appending syncs the segment to disk if it hasn't been for this long
+#define LOG_READ_BYTES (1024*1024) // segments are scanned this much at a time
+
+// messages as records appended to a directory of segment files, named for the id of their first record
+// a backlog is one sequential scan from the nearest sparse index entry, instead of a walk through a b-tree
+// the chat database only keeps the search index (which holds its own copy of the text) and the retention progress
+// records are written just before the sqlite transaction they go with commits, and cut back off if it doesn't
+// they're synced along with the first record to come LOG_SYNC_MS after the last sync, when their segment is sealed, by maintenance, and on close;
+// if the machine goes down in between, whatever didn't make it is taken back out of the index on the next open,
+// and a record left behind by a transaction that never committed is cut off the log
+class SegmentLog:public MessageStore{
+public:
+	SegmentLog(const std::string&,lite3::connection&);
+	SegmentLog(const SegmentLog&)=delete;
+	~SegmentLog();
+	void operator=(const SegmentLog&)=delete;
+
+	static void create(lite3::connection&,const std::string&);
+
+	unsigned long long insert(lite3::connection&,const Record&);
+	std::vector<Record> remove(lite3::connection&,unsigned long long,unsigned);
+	void prepare();
+	void commit();
+	void rollback();
+	std::vector<Message> range(lite3::connection&,unsigned long long,unsigned long long,unsigned);
+	std::vector<unsigned char> file(lite3::connection&,unsigned long long,std::string&);
+	std::vector<Message> search(lite3::connection&,const std::string&,unsigned long long,unsigned);
+	unsigned long long cutoff(lite3::connection&,const Retention&);
+	long long expires(lite3::connection&,unsigned long long);
+	unsigned long long size();
+	void sync();
+
+private:
+	struct Segment{
+		unsigned long long first; // id of the first record, and the name of the file
+		unsigned long long last; // id of the last record, first-1 while it's empty
+		unsigned long long length; // bytes of records in the file
+		unsigned long long bytes; // file and image content its records refer to
+		long long newest; // unixtime of the last record
+		std::vector<std::pair<unsigned long long,unsigned long long>> index; // id to file offset, every LOG_INDEX_INTERVALth record
+	};
+
+	// part of a segment to be scanned, taken while holding <mutex> and read without it
+	struct View{
+		os::file file;
+		unsigned long long offset;
+		unsigned long long end;
+	};
+
+	std::string path(unsigned long long,const char*)const;
+	void open(unsigned long long,bool);
+	unsigned long long recover(Segment&,unsigned long long = ULLONG_MAX);
+	void seal();
+	void write_index(const Segment&);
+	bool read_index(Segment&);
+	std::vector<View> views(unsigned long long&,bool = false);
+	static unsigned long long scan(View&,const std::function<bool(Record&,unsigned long long,unsigned long long)>&);
+
+	const std::string dir;
+	std::mutex mutex; // guards <segments> and <trimmed> against readers, the writer changes them only while holding it
+	std::map<unsigned long long,Segment> segments; // by first id, the last one is being appended to
+	os::file active; // the file of the last segment
+	unsigned long long trimmed; // every record up to this id is out of the search index and has let go of its blobs
+	std::string pending; // encoded record waiting on its transaction
+	Record pending_record;
+	unsigned long long pending_trim; // new value of <trimmed> waiting on its transaction, 0 if none
+	std::vector<unsigned long long> doomed; // segments to delete once the transaction commits
+	bool appended; // <pending> is in the file, past the end of the last segment
+	bool dirty; // appended to since the last sync
+	std::chrono::steady_clock::time_point synced;
+};
+
+#endif // SEGMENTLOG_H
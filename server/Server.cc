@@ -1,38 +1,76 @@
 #include <string>
+#include <algorithm>
 
 #include "log.h"
+#include "os.h"
 #include "Server.h"
 
-Server::Server(unsigned short port,const std::string &dbname):tcp(port),db(dbname){
+Server::Server(unsigned short port,const std::string &dbname,unsigned open_chats,const Retention &policy,unsigned interval,Engine engine)
+	:tcp(port)
+	,db(dbname,open_chats,engine)
+	,spool(dbname+"/spool")
+	,retention(policy)
+	,maintenance_interval(interval)
+{
 	good.store(true);
 	if(!tcp)
 		throw ServerException(std::string("can't bind to port ")+std::to_string(port));
 
+	os::mkdir(spool);
+
 	servername=db.get_name();
 	chats=db.get_chats();
+	chats_version=db.get_version();
+
+	maintenance=std::thread(&Server::maintain,this);
 }
 
 Server::~Server(){
-	good.store(false);
+	{
+		std::lock_guard<std::mutex> lock(maintenance_mutex);
+		good.store(false);
+	}
+	maintenance_cvar.notify_one();
+	maintenance.join();
 
 	// join all the client threads
 	for(std::unique_ptr<Client> &client:client_list)
 		client->join();
+
+	log("backlog cache: "+std::to_string(db.cache_hits())+" hits, "+std::to_string(db.cache_misses())+" misses");
 }
 
 void Server::accept(){
 	int connector=tcp.accept(1000);
 
-	if(connector!=-1){
+	while(connector!=-1){
 		// yay someone connected
 		new_client(connector);
+
+		// drain the rest of the backlog, lots of clients will (re)connect at once after a restart
+		connector=tcp.accept();
 	}
 
+	// client threads resume and evict parked sessions, which live in client_list
+	std::lock_guard<std::mutex> lock(mutex);
+	const time_t now=time(NULL);
+
 	// remove dead clients from client_list
+	// parked ones stay for a while, still collecting fan-out, in case they come back
 	for(auto it=client_list.begin();it!=client_list.end();){
 		auto &client = *it;
 
 		if(client->dead()){
+			if(client->parked()){
+				if(!client->expired(now)){
+					++it;
+					continue;
+				}
+
+				unindex(*client);
+				release_name(client->get_name());
+			}
+
 			client->join();
 			it=client_list.erase(it);
 			continue;
@@ -56,12 +94,28 @@ std::vector<Chat> Server::get_chats(){
 	return chats;
 }
 
+// return the chats that were created after directory version <since>
+// <version> is set to the current directory version
+std::vector<Chat> Server::get_chats_since(unsigned long long since, unsigned long long &version){
+	std::lock_guard<std::mutex> lock(mutex);
+
+	version=chats_version;
+
+	// chats are kept in order of increasing id (which is also their version)
+	auto first=std::upper_bound(chats.begin(), chats.end(), since, [](unsigned long long v, const Chat &chat){
+		return v < chat.id;
+	});
+
+	return {first, chats.end()};
+}
+
 // create a new chat
 bool Server::new_chat(const Chat &chat){
 	std::lock_guard<std::mutex> lock(mutex);
 
+	Chat created;
 	try{
-		db.new_chat(chat);
+		created=db.new_chat(chat);
 		log(chat.creator + " has created a new chat: \"" + chat.name + "\" description: \"" + chat.description + "\"");
 	}catch(const std::exception &e){
 		log_error(e.what());
@@ -69,15 +123,21 @@ bool Server::new_chat(const Chat &chat){
 	}
 
 	chats=db.get_chats();
+	chats_version=db.get_version();
+
+	// let everyone know about it, so they don't have to ask for the chat list again
+	for(std::unique_ptr<Client> &client:client_list)
+		client->addchat(created, chats_version);
+
 	return true;
 }
 
-void Server::new_msg(const Chat &chat,Message &msg){
+void Server::new_msg(const Chat &chat,Message &msg,const std::vector<unsigned char> &thumbnail){
 	std::lock_guard<std::mutex> lock(mutex);
 
 	// insert into the database
 	try{
-		msg.id=db.new_msg(chat,msg);
+		msg.id=db.new_msg(chat,msg,thumbnail);
 	}catch(const std::exception &e){
 		log_error(e.what());
 		return;
@@ -85,11 +145,22 @@ void Server::new_msg(const Chat &chat,Message &msg){
 
 	// if the message contains the file, remove it before sending to everyone
 	// clients obtain files by specifically requesting it, not inline in the message
+	// images go out as their thumbnail, the full image is requested the same way as files
 	if(msg.type==MessageType::FILE){
 		delete[] msg.raw;
 		msg.raw=NULL;
 		msg.raw_size=0;
 	}
+	else if(msg.type==MessageType::IMAGE){
+		delete[] msg.raw;
+		msg.raw=NULL;
+		msg.raw_size=thumbnail.size();
+
+		if(msg.raw_size>0){
+			msg.raw=new unsigned char[msg.raw_size];
+			memcpy(msg.raw,thumbnail.data(),msg.raw_size);
+		}
+	}
 
 	// inform all subscribed clients of the new message
 	for(std::unique_ptr<Client> &client:client_list){
@@ -98,35 +169,166 @@ void Server::new_msg(const Chat &chat,Message &msg){
 	}
 }
 
+// maintenance thread, every <maintenance_interval> seconds until the server shuts down
+void Server::maintain(){
+	std::unique_lock<std::mutex> lock(maintenance_mutex);
+
+	while(!maintenance_cvar.wait_for(lock,std::chrono::seconds(maintenance_interval),[this]{ return !good.load(); })){
+		lock.unlock();
+
+		try{
+			maintenance_pass();
+		}catch(const std::exception &e){
+			log_error(std::string("maintenance: ")+e.what());
+		}
+
+		lock.lock();
+	}
+}
+
+// enforce retention policies, then give the space back
+void Server::maintenance_pass(){
+	const time_t start=time(NULL);
+	Reclaimed total;
+
+	for(const Chat &chat:get_chats()){
+		if(!good.load())
+			return;
+
+		total+=db.maintain(chat.id,db.get_retention(chat.id,retention),good);
+	}
+
+	total+=db.maintain_blobs(good);
+
+	if(total.messages>0||total.bytes>0)
+		log("maintenance: deleted "+std::to_string(total.messages)+" messages and "+std::to_string(total.blobs)+" blobs, reclaimed "+Client::format(total.bytes)+" in "+std::to_string(time(NULL)-start)+"s");
+
+	const unsigned expired=expire_spool();
+	if(expired>0)
+		log("maintenance: let go of "+std::to_string(expired)+" abandoned uploads");
+}
+
+// remove spooled uploads that haven't been touched in UPLOAD_SPOOL_SECONDS, finished or not
+unsigned Server::expire_spool(){
+	const time_t cutoff=time(NULL)-UPLOAD_SPOOL_SECONDS;
+
+	unsigned expired=0;
+	for(const std::string &name:os::list(spool)){
+		// a client thread may finish (and remove) it at the same time
+		try{
+			if(os::modified(spool_path(name))<cutoff){
+				os::remove(spool_path(name));
+				++expired;
+			}
+		}catch(const std::exception&){}
+	}
+
+	return expired;
+}
+
+// reads don't need the server lock, the database hands each reader its own connection
 std::vector<Message> Server::get_messages_since(unsigned long long id, int chatid){
+	return db.get_messages_since(id, chatid);
+}
+
+// messages a client missed, between <after> and <through>, no lock either
+std::vector<Message> Server::get_messages_range(unsigned long long after, unsigned long long through, int chatid, unsigned limit){
+	return db.get_messages_range(after, through, chatid, limit);
+}
+
+// full text search of chat <chatid>, doesn't need the server lock either
+std::vector<Message> Server::search(int chatid,const std::string &query,unsigned long long offset,unsigned count){
+	return db.search(chatid, query, offset, count);
+}
+
+// get and return file contents from the database, and their sha-256
+std::vector<unsigned char> Server::get_file(unsigned long long id, int chatid, std::string &hash){
+	return db.get_file(id, chatid, hash);
+}
+
+// where the spool file <name> goes
+std::string Server::spool_path(const std::string &name)const{
+	return spool+"/"+name;
+}
+
+// reserve a name for a client, returns <requested> or an unused variation of it
+std::string Server::claim_name(const std::string &requested){
+	std::lock_guard<std::mutex> lock(names_mutex);
+
+	if(names.insert(requested).second)
+		return requested;
+
+	const std::string clone=std::string("clone of ")+requested;
+	std::string name=clone;
+	for(int i=2;!names.insert(name).second;++i)
+		name=clone+" ("+std::to_string(i)+")";
+
+	return name;
+}
+
+// give up a name previously handed out by claim_name()
+void Server::release_name(const std::string &name){
+	std::lock_guard<std::mutex> lock(names_mutex);
+
+	names.erase(name);
+}
+
+// <client> lost its connection and waits to be resumed, make it findable by its token and name (called from its own thread)
+// every introduction and resume looks here, walking <client_list> instead would make a reconnect storm quadratic
+void Server::park(Client &client){
 	std::lock_guard<std::mutex> lock(mutex);
 
-	return db.get_messages_since(id, chatid);
+	parked_tokens[client.get_token()]=&client;
+	parked_names[client.get_name()]=&client;
 }
 
-// get and return file contents from the database
-std::vector<unsigned char> Server::get_file(unsigned long long id, int chatid){
+// hand the parked session that <token> belongs to over to <client>
+// returns false if there isn't one, or it has expired
+bool Server::resume(const std::string &token,Client &client){
 	std::lock_guard<std::mutex> lock(mutex);
 
-	return db.get_file(id, chatid);
+	auto it=parked_tokens.find(token);
+	if(it==parked_tokens.end())
+		return false;
+
+	Client &old=*it->second;
+	if(!old.parked()||old.expired(time(NULL)))
+		return false;
+
+	unindex(old);
+	client.adopt(old);
+	return true;
 }
 
-// validate a client's name
-std::string Server::validate_name(const Client &user){
+// forget the parked session holding <name>, if there is one
+// whoever owned it is introducing themselves again rather than resuming, or has given up on it
+void Server::evict(const std::string &name){
 	std::lock_guard<std::mutex> lock(mutex);
 
-	for(auto &client:client_list){
-		if(client.get()==&user)
-			continue;
+	auto it=parked_names.find(name);
+	if(it==parked_names.end())
+		return;
 
-		if(client->get_name()==user.get_name())
-			return std::string("clone of ")+user.get_name();
-	}
+	Client &old=*it->second;
+	unindex(old);
+	old.unpark();
+	release_name(name);
+}
+
+// take parked <client> out of <parked_tokens> and <parked_names>, with the server lock held
+void Server::unindex(Client &client){
+	auto token=parked_tokens.find(client.get_token());
+	if(token!=parked_tokens.end()&&token->second==&client)
+		parked_tokens.erase(token);
 
-	return user.get_name();
+	auto name=parked_names.find(client.get_name());
+	if(name!=parked_names.end()&&name->second==&client)
+		parked_names.erase(name);
 }
 
 // accept a new client
 void Server::new_client(int connector){
+	std::lock_guard<std::mutex> lock(mutex);
+
 	client_list.push_back({std::make_unique<Client>(*this,connector)});
 }
@@ -4,13 +4,21 @@
 #include <memory>
 #include <mutex>
 #include <vector>
+#include <unordered_set>
+#include <unordered_map>
 #include <exception>
+#include <thread>
+#include <condition_variable>
 
 #include "network.h"
 #include "Client.h"
 #include "Database.h"
 #include "../chat.h"
 
+// how long an unfinished upload is kept for its client to come back and finish it
+// and how long a finished one is remembered, in case the client never got the receipt and sends it again
+#define UPLOAD_SPOOL_SECONDS (24*60*60)
+
 class ServerException:public std::exception{
 public:
 	explicit ServerException(const std::string &m):msg(m){}
@@ -23,7 +31,7 @@ private:
 
 class Server{
 public:
-	Server(unsigned short,const std::string&);
+	Server(unsigned short,const std::string&,unsigned,const Retention& = Retention(),unsigned = 600,Engine = Engine::SQLITE);
 	Server(const Server&)=delete;
 	~Server();
 	void operator=(const Server&)=delete;
@@ -31,22 +39,45 @@ public:
 	bool running()const;
 	const std::string &get_name();
 	std::vector<Chat> get_chats();
+	std::vector<Chat> get_chats_since(unsigned long long, unsigned long long&);
 	bool new_chat(const Chat&);
-	void new_msg(const Chat&,Message&);
+	void new_msg(const Chat&,Message&,const std::vector<unsigned char>&);
 	std::vector<Message> get_messages_since(unsigned long long, int);
-	std::vector<unsigned char> get_file(unsigned long long, int);
-	std::string validate_name(const Client&);
+	std::vector<Message> get_messages_range(unsigned long long, unsigned long long, int, unsigned);
+	std::vector<unsigned char> get_file(unsigned long long, int, std::string&);
+	std::vector<Message> search(int,const std::string&,unsigned long long,unsigned);
+	std::string claim_name(const std::string&);
+	void release_name(const std::string&);
+	void park(Client&);
+	bool resume(const std::string&,Client&);
+	void evict(const std::string&);
+	std::string spool_path(const std::string&)const;
 
 private:
 	void new_client(int);
+	void maintain();
+	void maintenance_pass();
+	unsigned expire_spool();
+	void unindex(Client&);
 
 	std::string servername; // the name of the server
 	std::atomic<bool> good; // server is currently operating
 	std::vector<std::unique_ptr<Client>> client_list;
+	std::unordered_map<std::string,Client*> parked_tokens; // parked sessions in <client_list> by resume token, guarded by <mutex>
+	std::unordered_map<std::string,Client*> parked_names; // the same sessions by name
 	std::vector<Chat> chats; // chats associated with this server
+	unsigned long long chats_version; // version of the chat directory
 	std::mutex mutex;
+	std::unordered_set<std::string> names; // names of all introduced clients
+	std::mutex names_mutex; // guards <names>, kept apart from <mutex> so introductions don't wait on chat traffic
 	net::tcp_server tcp;
 	Database db;
+	const std::string spool; // directory uploads are put back together in, see Client::clientcmd_upload()
+	const Retention retention; // default retention policy for every chat
+	const unsigned maintenance_interval; // seconds between maintenance passes
+	std::mutex maintenance_mutex;
+	std::condition_variable maintenance_cvar; // wakes the maintenance thread up to quit
+	std::thread maintenance;
 };
 
 #endif // SERVER_H
@@ -0,0 +1,295 @@
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+
+#include <time.h>
+
+#include "SqliteStore.h"
+
+// create the messages table and its index in a brand new chat database
+void SqliteStore::create(lite3::connection &conn){
+	const std::string create_table =
+	"create table messages (\n"
+	"id integer primary key autoincrement,\n"
+	"type int not null,\n" // MessageType enum in chat.h
+	"unixtime int not null,\n" // unix time
+	"message text not null,\n"
+	"name varchar(511) not null,\n"
+	"raw blob,\n" // only used by schema version 0, content now lives in the blob store
+	"hash text,\n" // key into the blob store for file content, image content, will be null for normal messages
+	"size int,\n" // size of the content behind <hash>
+	"thumb text);"; // key into the blob store for the thumbnail of an image, null if there isn't one
+
+	conn.execute(create_table);
+	SqliteStore::create_search(conn);
+}
+
+// create the full text index of the messages table
+// it doesn't keep a copy of the text, it reads it out of the messages table when it needs to
+void SqliteStore::create_search(lite3::connection &conn){
+	const std::string create_table =
+	"create virtual table search using fts5(message,name,content='messages',content_rowid='id');";
+
+	conn.execute(create_table);
+}
+
+unsigned long long SqliteStore::insert(lite3::connection &conn, const Record &record){
+	const std::string insert =
+	"insert into messages (type,unixtime,message,name,hash,size,thumb) values\n"
+	"(?,?,?,?,?,?,?);";
+
+	lite3::statement statement(conn, insert);
+
+	statement.bind(1, static_cast<int>(record.type));
+	statement.bind(2, record.unixtime);
+	statement.bind(3, record.message);
+	statement.bind(4, record.name);
+	if(record.hash != ""){
+		statement.bind(5, record.hash);
+		statement.bind(6, (std::int64_t)record.size);
+	}
+	if(record.thumb != "")
+		statement.bind(7, record.thumb);
+
+	statement.execute();
+
+	// get id of last inserted item
+	const std::string query =
+	"select max(id) from messages;";
+	lite3::statement maxid(conn, query);
+
+	maxid.execute();
+	const unsigned long long id = maxid.long_integer(0);
+
+	// and make it searchable
+	const std::string index =
+	"insert into search (rowid,message,name) values\n"
+	"(?,?,?);";
+	lite3::statement search(conn, index);
+
+	search.bind(1, (std::int64_t)id);
+	search.bind(2, record.message);
+	search.bind(3, record.name);
+	search.execute();
+
+	return id;
+}
+
+std::vector<Record> SqliteStore::remove(lite3::connection &conn, unsigned long long cutoff, unsigned limit){
+	std::vector<Record> doomed;
+	{
+		const std::string query =
+		"select id,type,unixtime,message,name,coalesce(hash,''),coalesce(size,0),coalesce(thumb,'') from messages where id<=? order by id limit ?;";
+		lite3::statement statement(conn, query);
+
+		statement.bind(1, (std::int64_t)cutoff);
+		statement.bind(2, (std::int64_t)limit);
+
+		while(statement.execute()){
+			doomed.push_back({
+				(unsigned long long)statement.long_integer(0),
+				(MessageType)statement.integer(1),
+				statement.integer(2),
+				statement.str(3),
+				statement.str(4),
+				statement.str(5),
+				(unsigned long long)statement.long_integer(6),
+				statement.str(7)
+			});
+		}
+	}
+
+	if(doomed.size() == 0)
+		return doomed;
+
+	for(const Record &record : doomed){
+		// the index has to be told what it's forgetting
+		const std::string unindex =
+		"insert into search (search,rowid,message,name) values\n"
+		"('delete',?,?,?);";
+		lite3::statement statement(conn, unindex);
+
+		statement.bind(1, (std::int64_t)record.id);
+		statement.bind(2, record.message);
+		statement.bind(3, record.name);
+		statement.execute();
+	}
+
+	lite3::statement remove(conn, "delete from messages where id<=?;");
+	remove.bind(1, (std::int64_t)doomed.back().id);
+	remove.execute();
+
+	return doomed;
+}
+
+std::vector<Message> SqliteStore::range(lite3::connection &conn, unsigned long long after, unsigned long long through, unsigned limit){
+	// only images come with a blob, and that's their thumbnail
+	const std::string query =
+	"select messages.id,messages.type,messages.unixtime,messages.message,messages.name,store.blobs.data\n"
+	"from messages left join store.blobs on store.blobs.hash=messages.thumb\n"
+	"where messages.id > ? and messages.id <= ? order by messages.id limit ?;";
+	lite3::statement statement(conn, query);
+
+	statement.bind(1, (std::int64_t)after);
+	statement.bind(2, (std::int64_t)std::min<unsigned long long>(through, INT64_MAX));
+	statement.bind(3, (std::int64_t)limit);
+
+	std::vector<Message> messages;
+	while(statement.execute()){
+		const MessageType type = (MessageType)statement.integer(1);
+
+		unsigned char *raw=NULL;
+		int raw_size=0;
+		if(type == MessageType::IMAGE){
+			// get the blob first
+			raw_size = statement.blob_size(5);
+			const unsigned char *const r = (unsigned char*)statement.blob(5);
+			if(r != NULL){
+				// must copy it from sqlite's memory
+				raw=new unsigned char[raw_size];
+				memcpy(raw, r, raw_size);
+			}
+		}
+
+		messages.push_back({
+			(decltype(Message::id))statement.integer(0),
+			type,
+			statement.integer(2),
+			statement.str(3),
+			statement.str(4),
+			raw,
+			(decltype(Message::raw_size))raw_size
+		});
+	}
+
+	return messages;
+}
+
+std::vector<unsigned char> SqliteStore::file(lite3::connection &conn, unsigned long long id, std::string &hash){
+	// every chat it was posted in shares the one copy in the blob store
+	const std::string query =
+	"select coalesce(store.blobs.data,messages.raw),coalesce(messages.hash,'') from messages left join store.blobs on store.blobs.hash=messages.hash\n"
+	"where messages.id=?;";
+	lite3::statement statement(conn, query);
+
+	statement.bind(1, (std::int64_t)id);
+
+	std::vector<unsigned char> raw;
+	if(statement.execute()){
+		raw.resize(statement.blob_size(0));
+		const unsigned char *const r = (unsigned char*)statement.blob(0);
+
+		if(r != NULL)
+			memcpy(raw.data(), r, raw.size());
+		else
+			throw std::runtime_error("raw blob for file id " + std::to_string(id));
+
+		hash = statement.str(1);
+	}
+	else
+		throw std::runtime_error("no record for message id " + std::to_string(id));
+
+	return raw;
+}
+
+std::vector<Message> SqliteStore::search(lite3::connection &conn, const std::string &query, unsigned long long offset, unsigned count){
+	const std::string select =
+	"select messages.id,messages.type,messages.unixtime,snippet(search,0,'[',']','...',16),messages.name\n"
+	"from search join messages on messages.id=search.rowid\n"
+	"where search match ? order by rank limit ? offset ?;";
+	lite3::statement statement(conn, select);
+
+	statement.bind(1, query);
+	statement.bind(2, (std::int64_t)count);
+	statement.bind(3, (std::int64_t)offset);
+
+	std::vector<Message> results;
+	while(statement.execute()){
+		results.push_back({
+			(decltype(Message::id))statement.long_integer(0),
+			(MessageType)statement.integer(1),
+			statement.integer(2),
+			statement.str(3),
+			statement.str(4),
+			NULL,
+			0
+		});
+	}
+
+	return results;
+}
+
+unsigned long long SqliteStore::cutoff(lite3::connection &conn, const Retention &policy){
+	unsigned long long cutoff = 0;
+
+	// too old
+	// messages are stamped by the server as they arrive, so they are in order of time as well as id,
+	// and the first one young enough to keep can be found by bisecting the ids rather than scanning the table
+	if(policy.max_age > 0){
+		const std::int64_t oldest = time(NULL) - policy.max_age;
+
+		lite3::statement bounds(conn, "select coalesce(min(id),0),coalesce(max(id),0) from messages;");
+		bounds.execute();
+
+		// ids have gaps, each probe looks at the first message at or after the id it's given
+		lite3::statement probe(conn, "select unixtime from messages where id>=? order by id limit 1;");
+
+		unsigned long long low = bounds.long_integer(0);
+		unsigned long long high = bounds.long_integer(1) + 1;
+		while(low < high){
+			const unsigned long long middle = low + (high - low) / 2;
+
+			probe.reset();
+			probe.bind(1, (std::int64_t)middle);
+
+			if(probe.execute() && probe.long_integer(0) >= oldest)
+				high = middle;
+			else
+				low = middle + 1;
+		}
+
+		if(low > 0)
+			cutoff = std::max<unsigned long long>(cutoff, low - 1);
+	}
+
+	// too many
+	if(policy.max_count > 0){
+		const std::string query =
+		"select id from messages order by id desc limit 1 offset ?;";
+		lite3::statement statement(conn, query);
+
+		statement.bind(1, (std::int64_t)policy.max_count);
+
+		if(statement.execute())
+			cutoff = std::max<unsigned long long>(cutoff, statement.long_integer(0));
+	}
+
+	// too big, counting from the newest message back
+	if(policy.max_bytes > 0){
+		const std::string query =
+		"select id,size from messages where size is not null order by id desc;";
+		lite3::statement statement(conn, query);
+
+		unsigned long long total = 0;
+		while(statement.execute()){
+			total += statement.long_integer(1);
+
+			if(total > policy.max_bytes){
+				cutoff = std::max<unsigned long long>(cutoff, statement.long_integer(0));
+				break;
+			}
+		}
+	}
+
+	return cutoff;
+}
+
+long long SqliteStore::expires(lite3::connection &conn, unsigned long long max_age){
+	lite3::statement statement(conn, "select unixtime from messages order by id limit 1;");
+
+	if(!statement.execute())
+		return 0;
+
+	return statement.long_integer(0) + max_age + 1;
+}
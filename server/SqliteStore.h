@@ -0,0 +1,21 @@
+#ifndef SQLITESTORE_H
+#define SQLITESTORE_H
+
+#include "MessageStore.h"
+
+// messages as rows of the "messages" table in the chat database, with an external content search index over it
+class SqliteStore:public MessageStore{
+public:
+	static void create(lite3::connection&);
+	static void create_search(lite3::connection&);
+
+	unsigned long long insert(lite3::connection&,const Record&);
+	std::vector<Record> remove(lite3::connection&,unsigned long long,unsigned);
+	std::vector<Message> range(lite3::connection&,unsigned long long,unsigned long long,unsigned);
+	std::vector<unsigned char> file(lite3::connection&,unsigned long long,std::string&);
+	std::vector<Message> search(lite3::connection&,const std::string&,unsigned long long,unsigned);
+	unsigned long long cutoff(lite3::connection&,const Retention&);
+	long long expires(lite3::connection&,unsigned long long);
+};
+
+#endif // SQLITESTORE_H
@@ -18,7 +18,7 @@ public:
 				escape = true;
 			}
 			else if((!escape && c == ',') || c == 0){
-				fields.push_back(strip(entry.substr(field_start, i - field_start)));
+				fields.push_back(strip(field_start, i));
 				field_start = i + 1;
 			}
 			else{
@@ -42,17 +42,24 @@ public:
 	}
 
 private:
-	std::string strip(const std::string &l){
-		std::string line = l;
+	// copy entry[begin, end) without the escape characters
+	std::string strip(int begin, int end){
+		std::string field;
+		field.reserve(end - begin);
 
-		for(unsigned i = 0; i < line.size(); ++i){
-			const char c = line.at(i);
+		bool escape = false;
+		for(int i = begin; i < end; ++i){
+			const char c = entry[i];
 
-			if(c == '\\')
-				line.erase(line.begin() + i);
+			if(!escape && c == '\\')
+				escape = true;
+			else{
+				field.push_back(c);
+				escape = false;
+			}
 		}
 
-		return line;
+		return field;
 	}
 
 	std::vector<std::string> fields;
@@ -60,30 +67,4 @@ private:
 	unsigned index;
 };
 
-class CSVWriter{
-public:
-	CSVWriter() = default;
-
-	void add(const std::string &field){
-		if(record.size() != 0)
-			record.push_back(',');
-
-		for(const char c : field){
-			if(c == '\\')
-				record.append("\\\\");
-			else if(c == ',')
-				record.append("\\,");
-			else
-				record.push_back(c);
-		}
-	}
-
-	const std::string &entry()const{
-		return record;
-	}
-
-private:
-	std::string record;
-};
-
 #endif // CSV_H
@@ -25,6 +25,12 @@ lite3::connection::connection(const std::string &filepath)
 	open(filepath);
 }
 
+// db file path constructor with sqlite3_open_v2() flags
+lite3::connection::connection(const std::string &filepath, int flags)
+{
+	open(filepath, flags);
+}
+
 // move constructor
 lite3::connection::connection(connection &&other)
 {
@@ -41,6 +47,8 @@ lite3::connection::~connection()
 // move assignment
 lite3::connection &lite3::connection::operator=(connection &&other)
 {
+	close();
+
 	conn = other.conn;
 	other.conn = NULL;
 
@@ -58,6 +66,24 @@ void lite3::connection::open(const std::string &filepath)
 	}
 }
 
+// open with sqlite3_open_v2() flags, e.g. SQLITE_OPEN_READONLY
+void lite3::connection::open(const std::string &filepath, int flags)
+{
+	if(sqlite3_open_v2(filepath.c_str(), &conn, flags, NULL) != SQLITE_OK)
+	{
+		exception e(sqlite3_errmsg(conn));
+		sqlite3_close(conn);
+
+		throw e;
+	}
+}
+
+// wait up to <millis> milliseconds for other connections to release their locks
+void lite3::connection::busy_timeout(int millis)
+{
+	sqlite3_busy_timeout(conn, millis);
+}
+
 void lite3::connection::close()
 {
 	if(conn != NULL)
@@ -79,11 +105,24 @@ void lite3::connection::execute(const std::string &exec)
 		throw exception("results were returned from static execute");
 }
 
+// number of rows changed by the most recent insert, update or delete
+int lite3::connection::changes()
+{
+	return sqlite3_changes(conn);
+}
+
 void lite3::connection::begin()
 {
 	execute("BEGIN TRANSACTION");
 }
 
+// take the write lock up front, on every attached database too
+// a deferred transaction that reads first can't wait for a writer that got in meanwhile, it fails with SQLITE_BUSY_SNAPSHOT
+void lite3::connection::begin_immediate()
+{
+	execute("BEGIN IMMEDIATE TRANSACTION");
+}
+
 void lite3::connection::rollback()
 {
 	execute("ROLLBACK");
@@ -121,13 +160,10 @@ lite3::statement::statement(statement &&other)
 }
 
 // destructor
+// sqlite3_finalize() hands back the error from the last execute(), which has already been thrown
 lite3::statement::~statement()
 {
-	if(sqlite3_finalize(stmt) != SQLITE_OK)
-	{
-		std::cerr << "the statement could not be finalized" << std::endl;
-		std::abort();
-	}
+	sqlite3_finalize(stmt);
 }
 
 // execute the query specified in the constructor
@@ -142,6 +178,12 @@ bool lite3::statement::execute()
 	return result == SQLITE_ROW;
 }
 
+// get the statement ready to be executed again, bindings are kept
+void lite3::statement::reset()
+{
+	sqlite3_reset(stmt);
+}
+
 void lite3::statement::bind(int column, const void *blob, int size)
 {
 	if(sqlite3_bind_blob(stmt, column, blob, size, SQLITE_TRANSIENT) != SQLITE_OK)
@@ -49,6 +49,7 @@ namespace lite3{
 	public:
 		connection();
 		connection(const std::string&);
+		connection(const std::string&, int);
 		connection(const connection&) = delete;
 		connection(connection&&);
 		~connection();
@@ -57,9 +58,13 @@ namespace lite3{
 		connection& operator=(connection&&);
 
 		void open(const std::string&);
+		void open(const std::string&, int);
+		void busy_timeout(int);
+		int changes();
 		void execute(const std::string&);
 		void close();
 		void begin();
+		void begin_immediate();
 		void rollback();
 		void commit();
 
@@ -79,6 +84,7 @@ namespace lite3{
 		statement &operator=(statement&&) = delete;
 
 		bool execute();
+		void reset();
 
 		void bind(int, const void*, int);
 		void bind(int, double);
@@ -5,6 +5,7 @@
 #include <exception>
 
 #include <string.h>
+#include <stdlib.h>
 
 #include "../chat.h"
 #include "Server.h"
@@ -21,10 +22,16 @@ static void handler(int);
 struct config{
 	unsigned short port;
 	std::string dbname;
+	unsigned open_chats; // how many chat databases to keep open at once
+	Retention retention; // default for chats without a policy of their own in the catalog
+	unsigned maintenance_interval; // seconds
+	Engine engine; // where new chats keep their messages
 };
 
 static std::atomic<bool> running;
 static std::string getdbpath();
+static bool parse(int, char**, config&);
+static bool number(int&, int, char**, long long&);
 static void go(const config&);
 
 int main(int argc, char **argv){
@@ -45,7 +52,16 @@ int main(int argc, char **argv){
 	// parameters
 	config cfg;
 	cfg.port=CHAT_PORT;
-	cfg.dbname=argc>1?argv[1]:getdbpath();
+	cfg.dbname=getdbpath();
+	cfg.open_chats=128;
+	cfg.maintenance_interval=600;
+	cfg.engine=Engine::SQLITE;
+	if(!parse(argc, argv, cfg)){
+		std::cout<<"usage: chat-server [database path] [--open-chats N]"<<std::endl;
+		std::cout<<"                   [--keep-days N] [--keep-messages N] [--keep-bytes N] [--maintenance-interval SECONDS]"<<std::endl;
+		std::cout<<"                   [--engine sqlite|log]"<<std::endl;
+		return 1;
+	}
 
 	try{
 		go(cfg);
@@ -85,8 +101,83 @@ std::string getdbpath(){
 }
 #endif // _WIN32
 
+// read the command line into <cfg>, false if it doesn't make sense
+bool parse(int argc, char **argv, config &cfg){
+	for(int i=1;i<argc;++i){
+		const std::string arg=argv[i];
+
+		if(arg=="--open-chats"){
+			if(i+1>=argc)
+				return false;
+
+			const int open_chats=atoi(argv[++i]);
+			if(open_chats<1)
+				return false;
+
+			cfg.open_chats=open_chats;
+		}
+		else if(arg=="--keep-days"){
+			long long days;
+			if(!number(i, argc, argv, days))
+				return false;
+
+			cfg.retention.max_age=days*24*60*60;
+		}
+		else if(arg=="--keep-messages"){
+			long long count;
+			if(!number(i, argc, argv, count))
+				return false;
+
+			cfg.retention.max_count=count;
+		}
+		else if(arg=="--keep-bytes"){
+			long long bytes;
+			if(!number(i, argc, argv, bytes))
+				return false;
+
+			cfg.retention.max_bytes=bytes;
+		}
+		else if(arg=="--maintenance-interval"){
+			long long seconds;
+			if(!number(i, argc, argv, seconds)||seconds<1)
+				return false;
+
+			cfg.maintenance_interval=seconds;
+		}
+		else if(arg=="--engine"){
+			if(i+1>=argc)
+				return false;
+
+			const std::string engine=argv[++i];
+			if(engine=="sqlite")
+				cfg.engine=Engine::SQLITE;
+			else if(engine=="log")
+				cfg.engine=Engine::LOG;
+			else
+				return false;
+		}
+		else if(arg.rfind("--",0)==0)
+			return false;
+		else
+			cfg.dbname=arg;
+	}
+
+	return true;
+}
+
+// read the number after option <i> into <value>, false if it isn't there or is negative
+bool number(int &i, int argc, char **argv, long long &value){
+	if(i+1>=argc)
+		return false;
+
+	char *end;
+	value=strtoll(argv[++i], &end, 10);
+
+	return *end==0&&value>=0;
+}
+
 void go(const config &cfg){
-	Server server(cfg.port,cfg.dbname);
+	Server server(cfg.port,cfg.dbname,cfg.open_chats,cfg.retention,cfg.maintenance_interval,cfg.engine);
 
 	// status line
 	std::cout<<"[ready on tcp:"<<cfg.port<<"]"<<std::endl;
@@ -384,7 +384,13 @@ bool net::tcp::poll_recv(int millis){
 	else if(result == 0) // timeout
 		return false;
 
-	return peek() > 0; // ready for reading if condition holds
+	// readable with nothing to read means the other end hung up
+	if(peek() == 0){
+		this->close();
+		return false;
+	}
+
+	return true;
 }
 
 // blocking send
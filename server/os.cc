@@ -1,10 +1,22 @@
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+
 #include "os.h"
 
 #ifdef _WIN32
 #include <direct.h>
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <windows.h>
 #else
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
 #endif // _WIN32
 
 void os::mkdir(const std::string &dir){
@@ -14,3 +26,243 @@ void os::mkdir(const std::string &dir){
 	::mkdir(dir.c_str(), S_IRUSR | S_IWUSR | S_IXUSR);
 #endif // _WIN32
 }
+
+// true if <path> is an existing directory
+bool os::is_dir(const std::string &path){
+#ifdef _WIN32
+	struct _stat64 st;
+	return _stat64(path.c_str(), &st) == 0 && (st.st_mode & _S_IFDIR);
+#else
+	struct stat st;
+	return ::stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+#endif // _WIN32
+}
+
+// true if there's anything at <path>
+bool os::exists(const std::string &path){
+#ifdef _WIN32
+	struct _stat64 st;
+	return _stat64(path.c_str(), &st) == 0;
+#else
+	struct stat st;
+	return ::stat(path.c_str(), &st) == 0;
+#endif // _WIN32
+}
+
+// names of the files in directory <dir>, in no particular order
+std::vector<std::string> os::list(const std::string &dir){
+	std::vector<std::string> names;
+
+#ifdef _WIN32
+	WIN32_FIND_DATAA entry;
+	HANDLE find = FindFirstFileA((dir + "\\*").c_str(), &entry);
+	if(find == INVALID_HANDLE_VALUE)
+		throw std::runtime_error("could not list " + dir);
+
+	do{
+		if(!(entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+			names.push_back(entry.cFileName);
+	}while(FindNextFileA(find, &entry));
+
+	FindClose(find);
+#else
+	DIR *d = opendir(dir.c_str());
+	if(d == NULL)
+		throw std::runtime_error("could not list " + dir + ": " + strerror(errno));
+
+	while(const dirent *entry = readdir(d)){
+		if(entry->d_name[0] != '.')
+			names.push_back(entry->d_name);
+	}
+
+	closedir(d);
+#endif // _WIN32
+
+	return names;
+}
+
+// delete file <path>
+void os::remove(const std::string &path){
+	if(std::remove(path.c_str()))
+		throw std::runtime_error("could not delete " + path + ": " + strerror(errno));
+}
+
+// when file <path> was last written to
+time_t os::modified(const std::string &path){
+#ifdef _WIN32
+	struct _stat64 st;
+	if(_stat64(path.c_str(), &st))
+#else
+	struct stat st;
+	if(::stat(path.c_str(), &st))
+#endif // _WIN32
+		throw std::runtime_error("could not stat " + path + ": " + strerror(errno));
+
+	return st.st_mtime;
+}
+
+os::file::file()
+	: fd(-1)
+{}
+
+// open <p>, creating it if it isn't there
+// unless <writable> is set it's only read from, and has to be there already
+os::file::file(const std::string &p, bool writable)
+	: path(p)
+{
+#ifdef _WIN32
+	if(writable)
+		fd = _open(path.c_str(), _O_RDWR | _O_CREAT | _O_APPEND | _O_BINARY, _S_IREAD | _S_IWRITE);
+	else
+		fd = _open(path.c_str(), _O_RDONLY | _O_BINARY);
+#else
+	if(writable)
+		fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR);
+	else
+		fd = ::open(path.c_str(), O_RDONLY);
+#endif // _WIN32
+
+	if(fd == -1)
+		throw std::runtime_error("could not open " + path + ": " + strerror(errno));
+}
+
+os::file::file(file &&other)
+	: fd(other.fd)
+	, path(std::move(other.path))
+{
+	other.fd = -1;
+}
+
+os::file::~file(){
+	close();
+}
+
+os::file &os::file::operator=(file &&other){
+	close();
+
+	fd = other.fd;
+	path = std::move(other.path);
+	other.fd = -1;
+
+	return *this;
+}
+
+// write <size> bytes of <data> to the end of the file
+void os::file::append(const void *data, unsigned long long size){
+	const char *p = (const char*)data;
+
+	while(size > 0){
+#ifdef _WIN32
+		const int written = _write(fd, p, size > (1u << 30) ? (1u << 30) : (unsigned)size);
+#else
+		const ssize_t written = ::write(fd, p, size);
+#endif // _WIN32
+
+		if(written < 0){
+			if(errno == EINTR)
+				continue;
+
+			throw std::runtime_error("could not write to " + path + ": " + strerror(errno));
+		}
+
+		p += written;
+		size -= written;
+	}
+}
+
+// read up to <size> bytes starting <offset> bytes into the file, returns how many there were
+// doesn't move the file position, so it's safe alongside other reads and append()
+unsigned long long os::file::read(void *data, unsigned long long size, unsigned long long offset){
+	char *p = (char*)data;
+	unsigned long long total = 0;
+
+	while(total < size){
+#ifdef _WIN32
+		OVERLAPPED at;
+		memset(&at, 0, sizeof(at));
+		at.Offset = (DWORD)(offset + total);
+		at.OffsetHigh = (DWORD)((offset + total) >> 32);
+
+		DWORD got = 0;
+		const DWORD want = size - total > (1u << 30) ? (1u << 30) : (DWORD)(size - total);
+		if(!ReadFile((HANDLE)_get_osfhandle(fd), p + total, want, &got, &at)){
+			if(GetLastError() == ERROR_HANDLE_EOF)
+				break;
+
+			throw std::runtime_error("could not read from " + path);
+		}
+#else
+		const ssize_t got = ::pread(fd, p + total, size - total, offset + total);
+		if(got < 0){
+			if(errno == EINTR)
+				continue;
+
+			throw std::runtime_error("could not read from " + path + ": " + strerror(errno));
+		}
+#endif // _WIN32
+
+		if(got == 0)
+			break;
+
+		total += got;
+	}
+
+	return total;
+}
+
+// make sure everything written so far would survive the machine going down
+void os::file::sync(){
+#ifdef _WIN32
+	const int result = _commit(fd);
+#else
+	const int result = ::fsync(fd);
+#endif // _WIN32
+
+	if(result)
+		throw std::runtime_error("could not sync " + path + ": " + strerror(errno));
+}
+
+unsigned long long os::file::size(){
+#ifdef _WIN32
+	const long long length = _filelengthi64(fd);
+	if(length < 0)
+		throw std::runtime_error("could not get the size of " + path);
+
+	return length;
+#else
+	struct stat st;
+	if(::fstat(fd, &st))
+		throw std::runtime_error("could not get the size of " + path + ": " + strerror(errno));
+
+	return st.st_size;
+#endif // _WIN32
+}
+
+// cut the file back to <size> bytes
+void os::file::truncate(unsigned long long size){
+#ifdef _WIN32
+	const int result = _chsize_s(fd, size);
+#else
+	const int result = ::ftruncate(fd, size);
+#endif // _WIN32
+
+	if(result)
+		throw std::runtime_error("could not truncate " + path + ": " + strerror(errno));
+}
+
+void os::file::close(){
+	if(fd == -1)
+		return;
+
+#ifdef _WIN32
+	_close(fd);
+#else
+	::close(fd);
+#endif // _WIN32
+
+	fd = -1;
+}
+
+bool os::file::is_open()const{
+	return fd != -1;
+}
@@ -2,9 +2,41 @@
 #define CHAT_OS_H
 
 #include <string>
+#include <vector>
+#include <ctime>
 
 namespace os{
 	void mkdir(const std::string&);
+	bool is_dir(const std::string&);
+	bool exists(const std::string&);
+	std::vector<std::string> list(const std::string&);
+	void remove(const std::string&);
+	time_t modified(const std::string&);
+
+	// an unbuffered file, written only at the end and read from anywhere
+	// reads may come from any number of threads at once
+	class file{
+	public:
+		file();
+		explicit file(const std::string&,bool = true);
+		file(const file&)=delete;
+		file(file&&);
+		~file();
+		void operator=(const file&)=delete;
+		file &operator=(file&&);
+
+		void append(const void*,unsigned long long);
+		unsigned long long read(void*,unsigned long long,unsigned long long);
+		void sync();
+		unsigned long long size();
+		void truncate(unsigned long long);
+		void close();
+		bool is_open()const;
+
+	private:
+		int fd;
+		std::string path;
+	};
 }
 
 #endif // CHAT_OS_H
@@ -20,6 +20,11 @@ move chat.lib ..\qt
 move chat.dll ..\qt
 cd ..
 
+echo BUILDING THE COMMAND LINE CLIENT
+cd client\cli
+cl /EHsc /std:c++17 *.cc ..\..\qt\chat.lib /link /out:chat-cli.exe
+cd ..\..
+
 echo BUILDING QT FRONT END
 cd qt
 cl /I%qtpath%\include /I%qtpath%\include\QtCore /I%qtpath%\include\QtGui /I%qtpath%\include\QtWidgets /EHsc /std:c++17 *.cc chat.lib %qtpath%\lib\Qt5Core.lib %qtpath%\lib\Qt5Widgets.lib %qtpath%\lib\Qt5Gui.lib /link /out:chatqt.exe